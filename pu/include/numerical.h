@@ -29,6 +29,7 @@ extern void geth P_((double *h, double *hsum, double *hratio, double *hfactor,
                      int n));
 extern double simps P_((double *y, double *h, double *hsum, double *hratio,
                         double *hfactor, int n));
+extern void simpsweights P_((double *h, double *w, int n));
 extern void makeh P_((double *x, double *h, int n));
 extern inline double simpson P_((double *y, double *hsum, double *hratio,
                                  double *hfactor, int n));
@@ -11,7 +11,9 @@
 #include <stdlib.h>
 #include <stdio.h>
 
-#define VOIGT_QUICK 0x00001   //Quick integration.
+#define VOIGT_QUICK  0x00001   //Quick integration.
+#define VOIGT_LEGACY 0x00002   //Pierluissi et al. series (long double).
+#define VOIGT_FAST   0x00004   //16-term Weideman approximation (~1e-6).
 extern int _voigt_maxelements;
 
 //function definition (voigt.h)
@@ -464,6 +464,46 @@ simps(double *y,
 }
 
 
+/* FUNCTION
+   Weights of the Simpson-rule integration, such that simps() of any y
+   over the intervals h equals sum_k w[k]*y[k].  Use it to integrate many
+   functions sampled at the same points.                                    */
+void
+simpsweights(double *h,  /* Intervals between the samples                   */
+             double *w,  /* Output weights [n]                              */
+             int n){     /* Number of samples                               */
+  int i, j,                /* for-loop index, array index                   */
+      even = n%2 == 0;     /* Trapezoidal first interval                    */
+  double hsum, hratio, hfactor;  /* See geth function                       */
+
+  for (i=0; i<n; i++)
+    w[i] = 0.0;
+  if (n < 2)
+    return;
+  if (n == 2){
+    w[0] = w[1] = h[0] / 2;
+    return;
+  }
+
+  /* Same terms as simpson(), collected per sample:                         */
+  for (i=0; i < (n-1)/2; i++){
+    j = 2*i + even;
+    hsum    = h[j] + h[j+1];
+    hratio  = h[j+1] / h[j];
+    hfactor = hsum * hsum / (h[j] * h[j+1]);
+    w[j  ] += (2.0 - hratio)     * hsum / 6.0;
+    w[j+1] += hfactor            * hsum / 6.0;
+    w[j+2] += (2.0 - 1.0/hratio) * hsum / 6.0;
+  }
+
+  /* Trapezoidal rule for the first interval if n is even:                  */
+  if (even){
+    w[0] += h[0] / 2;
+    w[1] += h[0] / 2;
+  }
+}
+
+
 /* FUNCTION
    Make a spacing array for integration                                     */
 void
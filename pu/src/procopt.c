@@ -75,6 +75,10 @@ static char *cs;
 static int getn,shortn;
 static _Bool process_defaults=0;
 
+//State of the parameter files being read by getopt_long_files()
+static int fpn=-1, fpa=4;
+static _Bool needs_open=0;
+
 static int getoptfrom(char *line, struct option *getopts, int *longindex);
 static void cfg_free();
 
@@ -298,8 +302,6 @@ getopt_long_files(int argc,	/* number of arguments */
 					  to this function, is the only
 					  one that matters. */
 {
-  static int fpn=-1, fpa=4;
-  static _Bool needs_open=0;
   int ret;
   char *fn;
 
@@ -708,7 +710,8 @@ getoptfrom(char *line,		/* line that should be of the form
 /* \fcnfh
    Frees all the memory allocated. This have to be called after any
    other call to getprocopt. Otherwise, because of the argv reordering
-   everything will be mixed up.
+   everything will be mixed up.  Afterwards, procopt() can process a new
+   set of arguments from the start.
  */
 void
 procopt_free()
@@ -728,6 +731,21 @@ procopt_free()
   free(fp);
   free(paramfiles);
   if(line) free(line);
+
+  //reset the state so that a new set of arguments can be processed
+  prgname=NULL;
+  getopts=NULL;
+  shortopts=NULL;
+  fp=NULL;
+  paramfiles=NULL;
+  line=NULL;
+  getalloc=shortalloc=8;
+  givenparamf=-1;
+  process_defaults=0;
+  fpn=-1;
+  fpa=4;
+  needs_open=0;
+  optind=1;
 }
 
 
@@ -106,6 +106,79 @@ static double ferf[MAXCONV] = {
   6.05939744697137480783e-83, //59
   9.93207019544894768776e-85
 };
+
+/* Weideman (1994, SIAM J. Numer. Anal. 31, 1497) rational approximation
+   to the complex error function w(z), with z = x + iy:
+     w(z) = 2 p(Z) / (L-iz)^2  +  1/sqrt(pi) / (L-iz),  Z = (L+iz)/(L-iz)
+   where p is a polynomial of N terms (coefficients wcoefN, lowest order
+   first) and L = sqrt(N/sqrt(2)).  The N=32 approximation is accurate to
+   ~1e-13, the N=16 one to ~1e-6 (absolute) in the upper half plane.        */
+#define WL16 3.363585661014858
+#define WL32 4.756828460010884
+static const double wcoef16[16] = {
+   1.7483958860819615e+00,  //0
+   1.3622408222719589e+00,  //1
+   8.8644783020505469e-01,  //2
+   4.6929090090360354e-01,  //3
+   1.9124172674669479e-01,  //4
+   5.1822402431611431e-02,  //5
+   3.6825673170917672e-03,  //6
+  -3.8810151890228128e-03,  //7
+  -1.5276597401220338e-03,  //8
+   8.7031584284635866e-05,  //9
+   2.1071056396548826e-04,  //10
+   2.1709867932206972e-05,  //11
+  -2.7346404624289944e-05,  //12
+  -5.5842334110156600e-06,  //13
+   3.9812875751443766e-06,  //14
+   9.9393225361232851e-07   //15
+};
+static const double wcoef32[32] = {
+   2.5722534081245696e+00,  //0
+   2.2635372999002681e+00,  //1
+   1.8256696296324813e+00,  //2
+   1.3455441692345453e+00,  //3
+   9.0192548936479988e-01,  //4
+   5.4601397206393409e-01,  //5
+   2.9544451071508726e-01,  //6
+   1.4060716226893771e-01,  //7
+   5.7304403529837067e-02,  //8
+   1.9006155784845435e-02,  //9
+   4.5195411053493284e-03,  //10
+   3.9259136070068923e-04,  //11
+  -2.4532980270014493e-04,  //12
+  -1.3075449254615346e-04,  //13
+  -2.1409619201689933e-05,  //14
+   6.8210319440209499e-06,  //15
+   4.4015317313961244e-06,  //16
+   4.2558331370123881e-07,  //17
+  -4.1840763700951022e-07,  //18
+  -1.4813078919040379e-07,  //19
+   2.2930438964285926e-08,  //20
+   2.3797556786275820e-08,  //21
+   8.1248899275188080e-10,  //22
+  -3.2080154088731661e-09,  //23
+  -5.2310189513349314e-10,  //24
+   4.1537465134133811e-10,  //25
+   1.1658260468117021e-10,  //26
+  -5.5442206381428605e-11,  //27
+  -2.1543433703641313e-11,  //28
+   8.0304374261430667e-12,  //29
+   3.7407299480207712e-12,  //30
+  -1.3034850976367807e-12   //31
+};
+
+/* Number of points evaluated together by the Weideman kernel:              */
+#define VOIGT_BLOCK 64
+
+/* On x86-64 compile AVX-512 and AVX2 versions of the kernel besides the
+   baseline one, the best one available is selected at run time:            */
+#if defined(__x86_64__) && defined(__GNUC__) && __GNUC__ >= 6
+#define VOIGT_CLONES __attribute__((target_clones("avx512f","avx2","default")))
+#else
+#define VOIGT_CLONES
+#endif
+
 int _voigt_maxelements=99999;
 int _voigt_computeeach=10;
 
@@ -200,6 +273,90 @@ voigtxy(double x,
 } __attribute__((always_inline))
 
 
+/* Voigt function K(x,y) = Re[w(x+iy)] for n (<= VOIGT_BLOCK) values of x
+   at once, with Weideman's approximation of nc coefficients c.  The loops
+   are branch free and run over the points, so that the compiler can
+   vectorize them.                                                          */
+static inline void
+voigtwblock(int n,            /* Number of points                           */
+            const double *x,  /* Normalized positions                       */
+            double y,         /* Normalized width                           */
+            double *K,        /* Output Voigt function                      */
+            const double *c,  /* Polynomial coefficients                    */
+            int nc,           /* Number of coefficients                     */
+            double L){        /* Weideman's scale parameter                 */
+  double zr[VOIGT_BLOCK], zi[VOIGT_BLOCK],  /* Z = (L+iz)/(L-iz)            */
+         ur[VOIGT_BLOCK], ui[VOIGT_BLOCK],  /* u = 1/(L-iz)                 */
+         pr[VOIGT_BLOCK], pim[VOIGT_BLOCK], /* p(Z)                         */
+         d, tmp;
+  const double ly   = L + y,
+               l2y2 = L*L - y*y;
+  int i, k;
+
+  for(i=0; i<n; i++){
+    d      = 1.0/(ly*ly + x[i]*x[i]);
+    zr[i]  = (l2y2 - x[i]*x[i]) * d;
+    zi[i]  = 2.0*L*x[i] * d;
+    ur[i]  = ly   * d;
+    ui[i]  = x[i] * d;
+    pr[i]  = c[nc-1];
+    pim[i] = 0.0;
+  }
+  /* Horner evaluation of the polynomial:                                   */
+  for(k=nc-2; k>=0; k--)
+    for(i=0; i<n; i++){
+      tmp    = pr[i]*zr[i] - pim[i]*zi[i] + c[k];
+      pim[i] = pr[i]*zi[i] + pim[i]*zr[i];
+      pr[i]  = tmp;
+    }
+  /* K = Re[2 p u^2 + u/sqrt(pi)]:                                          */
+  for(i=0; i<n; i++)
+    K[i] = 2.0*(pr[i]*(ur[i]*ur[i] - ui[i]*ui[i]) - 2.0*pim[i]*ur[i]*ui[i])
+           + ur[i]*TWOOSQRTPI/2.0;
+}
+
+
+/* Voigt profile at the n equispaced wavenumbers i*dint, centered at shft.
+   Unless VOIGT_LEGACY is set in flags, use Weideman's approximation (with
+   16 terms if VOIGT_FAST is set, 32 otherwise) in blocks of VOIGT_BLOCK
+   points, else call voigtxy() point by point.                              */
+VOIGT_CLONES static void
+voigtgrid(int n,              /* Number of points                           */
+          double dint,        /* Wavenumber spacing                         */
+          double shft,        /* Profile center                             */
+          double y,           /* Normalized width                           */
+          PREC_VOIGTP alphaD, /* Doppler width                              */
+          PREC_VOIGT *res,    /* Output profile                             */
+          PREC_VOIGTP eps,    /* voigtxy() precision                        */
+          int flags){         /* Evaluation flags                           */
+  double x[VOIGT_BLOCK], K[VOIGT_BLOCK];
+  const double *c = wcoef32;
+  double L = WL32;
+  int nc = 32,
+      i, j, nb;
+
+  if(flags & VOIGT_LEGACY){
+    for(i=0; i<n; i++)
+      voigtxy(SQRTLN2*fabs(dint*i-shft)/alphaD, y, res+i, eps, alphaD);
+    return;
+  }
+  if(flags & VOIGT_FAST){
+    c  = wcoef16;
+    L  = WL16;
+    nc = 16;
+  }
+
+  for(i=0; i<n; i+=VOIGT_BLOCK){
+    nb = n-i < VOIGT_BLOCK ? n-i : VOIGT_BLOCK;
+    for(j=0; j<nb; j++)
+      x[j] = SQRTLN2*fabs(dint*(i+j)-shft)/alphaD;
+    voigtwblock(nb, x, y, K, c, nc, L);
+    for(j=0; j<nb; j++)
+      res[i+j] = SQRTLN2PI/alphaD*K[j];
+  }
+}
+
+
 //\fcnfh
 //Computes Voigt Profile 
 inline int
@@ -244,14 +401,14 @@ voigtn2(int m,              /* Number of fine resolution bins (deviation
         int flags){         /* Miscellaneous flags, so far there is support
                                for: 'VOIGT_QUICK' that performs a quick
                                integration, i.e., the height multiplied
-                               by the bin width                             */
+                               by the bin width; and 'VOIGT_LEGACY' or
+                               'VOIGT_FAST' (see voigtgrid())               */
 
   /* The calculation is done filling the array from the centerpoint
      outwards.  The wavenumber value of each bin is considered to be the
      lower value of the bin (not the center as usual).                    */
 
   double y,      /* Normalized width:    y = sqrt(ln 2) * alphaL/alphaD   */
-         x,      /* Normalized position: x = sqrt(ln 2) * |nu-nu0|/alphaD */
          ddwn,   /* Spacing between wavenumbers                           */
          dcshft; /* Centershift spacing                                   */
   int i, j;
@@ -320,10 +477,7 @@ voigtn2(int m,              /* Number of fine resolution bins (deviation
        array is not possible because the center of
        the profile won't always coincide with the center of the array;
        only when \vr{m}=0. Then, for each element of the array.          */
-    for(i=0; i<nint; i++){
-      x = SQRTLN2*fabs(dint*i-shft)/alphaD;
-      voigtxy(x, y, aint+i, eps, alphaD);
-    }
+    voigtgrid(nint, dint, shft, y, alphaD, aint, eps, flags);
 
     /* Integration: */
     /* If user wants a quick integration, return the value at the
@@ -378,14 +532,14 @@ voigtn(int nwn,            /* Number of wavenumber sample of the profile    */
        int flags){         /* Miscellaneous flags, so far there is support 
                               for: 'VOIGT_QUICK' that performs a quick
                               integration, i.e., the height multiplied
-                              by the bin width                              */
+                              by the bin width; and 'VOIGT_LEGACY' or
+                              'VOIGT_FAST' (see voigtgrid())                */
 
   /* The calculation is done filling the array from the centerpoint
      outwards.  The wavenumber value of each bin is considered to be the
      lower value of the bin (not the center as usual).                    */
 
   double y,      /* Normalized width:    y = sqrt(ln 2) * alphaL/alphaD   */
-         x,      /* Normalized position: x = sqrt(ln 2) * |nu-nu0|/alphaD */
          ddwn;   /* Centershift spacing                                   */
   int i;
 
@@ -445,10 +599,7 @@ voigtn(int nwn,            /* Number of wavenumber sample of the profile    */
      array is not possible because the center of
      the profile won't always coincide with the center of the array;
      only when \vr{m}=0. Then, for each element of the array.          */
-  for(i=0; i<nint; i++){
-    x = SQRTLN2*fabs(dint*i-dwn)/alphaD;
-    voigtxy(x, y, aint+i, eps, alphaD);
-  }
+  voigtgrid(nint, dint, dwn, y, alphaD, aint, eps, flags);
 
   /* Integration:                                                           */
   /* If user wants a quick integration, return the value at the
@@ -571,3 +722,8 @@ meanintegTrap(PREC_VOIGT *in,        /* Input Array */
 #undef B3
 #undef B4
 
+#undef WL16
+#undef WL32
+#undef VOIGT_BLOCK
+#undef VOIGT_CLONES
+
@@ -0,0 +1,117 @@
+// Copyright (C) 2015-2016 University of Central Florida. All rights reserved.
+// Transit is under an open-source, reproducible-research license (see LICENSE).
+
+/*
+  bench_voigt.c: Compare speed and accuracy of the Voigt-profile
+  evaluation modes of voigtn(): the Pierluissi et al. series
+  (VOIGT_LEGACY), and the 32-term (default) and 16-term (VOIGT_FAST)
+  Weideman approximations.
+
+  The profiles are computed over a log-spaced grid of Doppler and Lorentz
+  widths, as calcprofiles() in transit does.  The deviations are given
+  with respect to the 32-term approximation, relative to the peak of
+  each profile.
+
+  Compile (after building libpu.a) from this directory with:
+    gcc -O3 -ffast-math -fgnu89-inline -std=c99 -I../include \
+        bench_voigt.c ../libpu.a -lm -o bench_voigt
+  Usage:
+    ./bench_voigt [nwidths] [wavenumber_spacing] [times_alpha]            */
+
+#include <profile.h>
+#include <sys/time.h>
+
+/* Seconds since an arbitrary reference:                                    */
+static double
+seconds(void){
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + 1e-6*tv.tv_usec;
+}
+
+
+/* Compute the profile grid with the given flags, store the profiles in
+   pr[nw*nw], and return the elapsed time:                                  */
+static double
+profgrid(int nw,          /* Number of Doppler and Lorentz widths           */
+         double *dop,     /* Doppler widths                                 */
+         double *lor,     /* Lorentz widths                                 */
+         double dwn,      /* Wavenumber spacing                             */
+         double ta,       /* Profile half-width in number of widths         */
+         int *nvgt,       /* Number of points of each profile               */
+         PREC_VOIGT **pr, /* Profiles                                       */
+         int flags){      /* voigtn() flags                                 */
+  int i, j, k;
+  double t0 = seconds();
+
+  for   (i=0; i<nw; i++){
+    for (j=0; j<nw; j++){
+      k = i*nw + j;
+      nvgt[k] = 2*(long)(fmax(dop[i], lor[j])*ta/dwn + 0.5) + 1;
+      pr[k] = (PREC_VOIGT *)calloc(nvgt[k], sizeof(PREC_VOIGT));
+      voigtn(nvgt[k], dwn*(long)(nvgt[k]/2), lor[j], dop[i], pr+k, -1,
+             flags);
+    }
+  }
+  return seconds() - t0;
+}
+
+
+int
+main(int argc, char **argv){
+  int nw = 40,        /* Number of Doppler and Lorentz widths             */
+      nmode = 3,
+      flags[3] = {VOIGT_LEGACY, 0, VOIGT_FAST},
+      i, k, m, *nvgt;
+  char *names[3] = {"legacy", "accurate", "fast"};
+  double dwn = 1.0/2160, /* Wavenumber spacing (cm-1)                       */
+         ta  = 20.0,     /* Profile half-width in number of widths          */
+         *dop, *lor, time[3], dev[3], peak, d;
+  long npoints = 0;
+  PREC_VOIGT **pr[3];
+
+  if (argc > 1)
+    nw  = atoi(argv[1]);
+  if (argc > 2)
+    dwn = atof(argv[2]);
+  if (argc > 3)
+    ta  = atof(argv[3]);
+
+  /* Log-spaced widths, same ranges as transit's defaults:                  */
+  dop = (double *)calloc(nw, sizeof(double));
+  lor = (double *)calloc(nw, sizeof(double));
+  for (i=0; i<nw; i++){
+    dop[i] = 1e-3 * pow(0.25/1e-3, i/(nw-1.0));
+    lor[i] = 1e-4 * pow(10.0/1e-4, i/(nw-1.0));
+  }
+  nvgt = (int *)calloc(nw*nw, sizeof(int));
+
+  for (m=0; m<nmode; m++){
+    pr[m] = (PREC_VOIGT **)calloc(nw*nw, sizeof(PREC_VOIGT *));
+    time[m] = profgrid(nw, dop, lor, dwn, ta, nvgt, pr[m], flags[m]);
+  }
+  for (k=0; k<nw*nw; k++)
+    npoints += nvgt[k];
+
+  /* Maximum deviation w.r.t. the accurate mode, relative to the peak:      */
+  for (m=0; m<nmode; m++){
+    dev[m] = 0.0;
+    for (k=0; k<nw*nw; k++){
+      peak = pr[1][k][nvgt[k]/2];
+      for (i=0; i<nvgt[k]; i++){
+        d = fabs(pr[m][k][i] - pr[1][k][i]) / peak;
+        if (d > dev[m])
+          dev[m] = d;
+      }
+    }
+  }
+
+  printf("%d profiles, %li points, spacing %.3g cm-1.\n",
+         nw*nw, npoints, dwn);
+  printf("Mode         Time (s)   Speedup   Max deviation\n");
+  for (m=0; m<nmode; m++)
+    printf("%-10s %10.4f %9.2f   %.3e\n", names[m], time[m],
+           time[0]/time[m], dev[m]);
+
+  return EXIT_SUCCESS;
+}
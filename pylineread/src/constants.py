@@ -21,9 +21,14 @@ C2   = sc.h * sc.c / sc.k * 100.0        # cm / Kelvin units
 
 # Version Constants:
 TLI_VERSION = 5  # TLI version
+TLI_BLOCK_VERSION = 6  # Blocked TLI version
 LR_VERSION  = 5  # Lineread version
 LR_REVISION = 0  # Lineread revision
 
+# Blocked TLI column formats:
+TLI_DOUBLE  = 0  # double wavelength, Elow, and gf
+TLI_COMPACT = 1  # uint32 scaled wavelength, float Elow and gf
+
 # H2O Isotopic Physical Constants:
 PS_CROSS = np.pi * ((3.2e-08)/2)**2.0 # Collision cross section
 
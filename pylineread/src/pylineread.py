@@ -21,6 +21,7 @@ import db_pands  as ps
 import db_hitran as hit
 import db_tioschwenke as ts
 import db_voplez as vo
+import tliblock  as tb
 
 
 def parseargs():
@@ -115,6 +116,18 @@ def parseargs():
   group.add_argument("-f", "--wl-final",      action="store",
                      help="Final wavelength (microns) [default: %(default)s].",
                      dest="fwav", type=float, default=2.0)
+  # Output Options:
+  group = parser.add_argument_group("Output Options")
+  group.add_argument("-b", "--blocksize",     action="store",
+                     help="If positive, write a blocked TLI file (version "
+                          "{:d}) with up to this many lines per block "
+                          "[default: %(default)s].".
+                          format(c.TLI_BLOCK_VERSION),
+                     dest="blocksize", type=int, default=0)
+  group.add_argument("--compact",             action="store_true",
+                     help="Write the blocked TLI wavelengths as 32-bit "
+                          "integers and Elow and gf as 32-bit floats.",
+                     dest="compact", default=False)
   parser.set_defaults(**defaults)
   args = parser.parse_args(remaining_argv)
 
@@ -149,6 +162,16 @@ if __name__ == "__main__":
   dbtype     = cla.dbtype 
   outputfile = cla.output
   defn       = cla.defn
+  blocksize  = int(cla.blocksize)
+  compact    = cla.compact in [True, "True", "true", "1"]
+
+  if compact and blocksize <= 0:
+    ut.printexit("The compact format requires a positive blocksize.")
+  # TLI version, blocked or column file:
+  if blocksize > 0:
+    tliversion = c.TLI_BLOCK_VERSION
+  else:
+    tliversion = c.TLI_VERSION
 
   # Number of files:
   Nfiles = len(dblist)
@@ -188,7 +211,7 @@ if __name__ == "__main__":
   # TLI header: Tells endianness of binary, TLI version, and number of
   # databases used.
   header = magic
-  header += struct.pack("3h", c.TLI_VERSION, c.LR_VERSION, c.LR_REVISION)
+  header += struct.pack("3h", tliversion, c.LR_VERSION, c.LR_REVISION)
   # Add initial and final wavelength boundaries:
   header += struct.pack("2d", cla.iwav, cla.fwav)
 
@@ -212,7 +235,7 @@ if __name__ == "__main__":
                         "Initial wavelength (um): %7.3f\n"
                         "Final   wavelength (um): %7.3f"%(
                          struct.unpack('i', magic)[0],
-                         c.TLI_VERSION, c.LR_VERSION, c.LR_REVISION,
+                         tliversion, c.LR_VERSION, c.LR_REVISION,
                          cla.iwav, cla.fwav))
   ut.lrprint(verbose-8, "There are {:d} databases in {:d} files.".
                          format(Ndb, Nfiles))
@@ -410,19 +433,26 @@ if __name__ == "__main__":
   TLIout.write(struct.pack("i",nIso))
   TLIout.write(struct.pack(str(nIso)+"i", *list(Nisotran)))
 
-  # Write the Line-transition data:
-  ti = time.time()
-  transinfo += struct.pack("{:d}d".format(nTransitions), *list(wlength))
-  transinfo += struct.pack("{:d}h".format(nTransitions), *list(isoID))
-  transinfo += struct.pack("{:d}d".format(nTransitions), *list(elow))
-  transinfo += struct.pack("{:d}d".format(nTransitions), *list(gf))
-  tf = time.time()
-  ut.lrprint(verbose-3, "Packing time: {:8.3f} seconds".format(tf-ti))
-
-  ti = time.time()
-  TLIout.write(transinfo)
-  tf = time.time()
-  ut.lrprint(verbose-3, "Writing time: {:8.3f} seconds".format(tf-ti))
+  # Write the Line-transition data in blocks:
+  if blocksize > 0:
+    ti = time.time()
+    tb.writeblocks(TLIout, wlength, isoID, elow, gf, blocksize, compact)
+    tf = time.time()
+    ut.lrprint(verbose-3, "Writing time: {:8.3f} seconds".format(tf-ti))
+  # Write the Line-transition data in columns:
+  else:
+    ti = time.time()
+    transinfo += struct.pack("{:d}d".format(nTransitions), *list(wlength))
+    transinfo += struct.pack("{:d}h".format(nTransitions), *list(isoID))
+    transinfo += struct.pack("{:d}d".format(nTransitions), *list(elow))
+    transinfo += struct.pack("{:d}d".format(nTransitions), *list(gf))
+    tf = time.time()
+    ut.lrprint(verbose-3, "Packing time: {:8.3f} seconds".format(tf-ti))
+
+    ti = time.time()
+    TLIout.write(transinfo)
+    tf = time.time()
+    ut.lrprint(verbose-3, "Writing time: {:8.3f} seconds".format(tf-ti))
 
   TLIout.close()
   ut.lrprint(verbose, "Done.\n")
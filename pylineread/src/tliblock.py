@@ -0,0 +1,221 @@
+#!/usr/bin/env python
+
+# Copyright (C) 2015-2016 University of Central Florida. All rights reserved.
+# Transit is under an open-source, reproducible-research license (see LICENSE).
+
+"""
+Blocked TLI files (version c.TLI_BLOCK_VERSION).
+
+The line transitions are stored in blocks of up to blocksize lines of a
+single isotope (sorted by isotope and then by wavelength), each one with
+its own wavelength, Elow, and gf columns.  An index in front of the
+blocks lists the wavelength range and line-strength bounds of each
+block, so that transit reads only the blocks within its wavelength range
+(and, optionally, only those above its extinction threshold).
+
+Run as a script to convert a column TLI file (version c.TLI_VERSION) into
+a blocked one:
+  ./tliblock.py input.tli output.tli [--blocksize N] [--compact]
+"""
+
+import struct, sys
+import argparse
+
+import constants as c
+
+# Block-index entry: isotope ID, number of lines, wavelength range, largest
+# gf, smallest Elow, Elow and wavelength of the line with largest gf, and
+# position of the block data in the file (64 bytes):
+INDEX_FORMAT = "2i6dq"
+# Largest scaled wavelength of the compact format:
+WL_SCALE = 4294967295
+
+
+def blockranges(isoID, blocksize):
+  """
+  Split a line list (sorted by isotope) into blocks of a single isotope.
+
+  Parameters:
+  -----------
+  isoID: 1D integer iterable
+     Isotope ID of the lines.
+  blocksize: Integer
+     Maximum number of lines per block.
+
+  Returns:
+  --------
+  blocks: List of (first, last) tuples
+     Index range [first, last) of the lines of each block.
+  """
+  blocks = []
+  nlines = len(isoID)
+  first = 0
+  for i in range(1, nlines+1):
+    if i == nlines or isoID[i] != isoID[first] or i-first == blocksize:
+      blocks.append((first, i))
+      first = i
+  return blocks
+
+
+def writeblocks(TLIout, wlength, isoID, elow, gf, blocksize, compact=False):
+  """
+  Write the line-transition data of a blocked TLI file: the column format,
+  the number of blocks, the block index, and the block data.  Call it
+  right after writing the number of transitions per isotope.
+
+  Parameters:
+  -----------
+  TLIout: File object
+     Output TLI file (open in binary mode).
+  wlength: 1D float iterable
+     Line wavelength (microns), sorted by isotope, then by wavelength.
+  isoID: 1D integer iterable
+     Line isotope ID.
+  elow: 1D float iterable
+     Line lower-state energy (cm-1).
+  gf: 1D float iterable
+     Line gf.
+  blocksize: Integer
+     Maximum number of lines per block.
+  compact: Bool
+     If True, store the wavelength as an unsigned 32-bit integer scaled
+     within the block's wavelength range, and Elow and gf as 32-bit floats,
+     else store all three as doubles.
+  """
+  fmt = c.TLI_COMPACT if compact else c.TLI_DOUBLE
+  # Size of a wavelength, and of an Elow and gf value:
+  wsize, csize = (4, 4) if compact else (8, 8)
+  blocks = blockranges(isoID, blocksize)
+  nblocks = len(blocks)
+
+  # Position of the first block (8-byte aligned):
+  offset = TLIout.tell() + struct.calcsize("2i") + \
+           nblocks*struct.calcsize(INDEX_FORMAT)
+  pad = (-offset) % 8
+  offset += pad
+
+  TLIout.write(struct.pack("2i", fmt, nblocks))
+  # Block index:
+  for first, last in blocks:
+    n = last - first
+    irep = max(range(first, last), key=lambda i:gf[i])
+    TLIout.write(struct.pack(INDEX_FORMAT, int(isoID[first]), n,
+                             wlength[first], wlength[last-1], gf[irep],
+                             min(elow[first:last]), elow[irep], wlength[irep],
+                             offset))
+    size = n*(wsize + 2*csize)
+    offset += size + (-size) % 8
+  TLIout.write(b"\0"*pad)
+
+  # Block data:
+  for first, last in blocks:
+    n = last - first
+    wl = wlength[first:last]
+    if compact:
+      wlmin, wlmax = wl[0], wl[n-1]
+      scale = WL_SCALE/(wlmax-wlmin) if wlmax > wlmin else 0.0
+      data  = struct.pack("{:d}I".format(n),
+                 *[min(int(round((w-wlmin)*scale)), WL_SCALE) for w in wl])
+      data += struct.pack("{:d}f".format(n), *elow[first:last])
+      data += struct.pack("{:d}f".format(n), *gf  [first:last])
+    else:
+      data  = struct.pack("{:d}d".format(n), *wl)
+      data += struct.pack("{:d}d".format(n), *elow[first:last])
+      data += struct.pack("{:d}d".format(n), *gf  [first:last])
+    TLIout.write(data + b"\0"*((-len(data)) % 8))
+
+
+def readheader(data):
+  """
+  Parse the header of a TLI file up to the line-transition data.
+
+  Parameters:
+  -----------
+  data: Bytes
+     Content of the TLI file.
+
+  Returns:
+  --------
+  pos: Integer
+     Position of the number of transitions in the file.
+  version: Integer
+     TLI version.
+  """
+  version = struct.unpack_from("h", data, 4)[0]
+  pos = 4 + struct.calcsize("=3h2d")
+  ndb = struct.unpack_from("h", data, pos)[0]
+  pos += 2
+  for i in range(ndb):
+    # Database and molecule names:
+    for j in range(2):
+      pos += 2 + struct.unpack_from("h", data, pos)[0]
+    Ntemp, Niso = struct.unpack_from("2h", data, pos)
+    pos += 4 + 8*Ntemp
+    for j in range(Niso):
+      # Isotope name, mass, isotopic ratio, and partition function:
+      pos += 2 + struct.unpack_from("h", data, pos)[0]
+      pos += 16 + 8*Ntemp
+  return pos, version
+
+
+def convert(infile, outfile, blocksize, compact=False):
+  """
+  Convert a column TLI file into a blocked TLI file.
+
+  Parameters:
+  -----------
+  infile: String
+     Input TLI file name (version c.TLI_VERSION).
+  outfile: String
+     Output TLI file name.
+  blocksize: Integer
+     Maximum number of lines per block.
+  compact: Bool
+     Write the compact column format (see writeblocks()).
+  """
+  f = open(infile, "rb")
+  data = f.read()
+  f.close()
+
+  pos, version = readheader(data)
+  if version != c.TLI_VERSION:
+    raise ValueError("Input TLI version ({:d}) is not {:d}.".
+                     format(version, c.TLI_VERSION))
+  nTransitions, nIso = struct.unpack_from("2i", data, pos)
+  nlines = struct.calcsize("2i{:d}i".format(nIso))
+
+  # Line-transition columns:
+  start = pos + nlines
+  wlength = struct.unpack_from("{:d}d".format(nTransitions), data, start)
+  start += 8*nTransitions
+  isoID   = struct.unpack_from("{:d}h".format(nTransitions), data, start)
+  start += 2*nTransitions
+  elow    = struct.unpack_from("{:d}d".format(nTransitions), data, start)
+  start += 8*nTransitions
+  gf      = struct.unpack_from("{:d}d".format(nTransitions), data, start)
+
+  TLIout = open(outfile, "wb")
+  TLIout.write(data[0:4] + struct.pack("h", c.TLI_BLOCK_VERSION))
+  TLIout.write(data[6:pos+nlines])
+  writeblocks(TLIout, wlength, isoID, elow, gf, blocksize, compact)
+  TLIout.close()
+
+
+if __name__ == "__main__":
+  parser = argparse.ArgumentParser(description=__doc__,
+                           formatter_class=argparse.RawDescriptionHelpFormatter)
+  parser.add_argument("input",  help="Input column TLI file.")
+  parser.add_argument("output", help="Output blocked TLI file.")
+  parser.add_argument("-b", "--blocksize", action="store",
+                      help="Maximum number of lines per block "
+                           "[default: %(default)s].",
+                      dest="blocksize", type=int, default=4096)
+  parser.add_argument("--compact", action="store_true",
+                      help="Store the wavelength as a 32-bit integer and "
+                           "Elow and gf as 32-bit floats.",
+                      dest="compact", default=False)
+  args = parser.parse_args()
+  if args.blocksize < 1:
+    print("The block size must be a positive integer.")
+    sys.exit(1)
+  convert(args.input, args.output, args.blocksize, args.compact)
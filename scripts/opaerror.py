@@ -0,0 +1,170 @@
+#!/usr/bin/env python
+
+# Copyright (C) 2015-2016 University of Central Florida. All rights reserved.
+# Transit is under an open-source, reproducible-research license (see LICENSE).
+
+"""
+Report the error of an encoded opacity file (written with transit's
+--opatol option) with respect to the same grid stored as doubles, and
+optionally the error of the spectrum computed with each file.
+
+Usage:
+  ./opaerror.py reference.opa encoded.opa [--spectra ref.dat test.dat]
+
+The grid error is the relative error of each non-zero opacity value,
+reported per molecule and for the whole grid.  The spectrum error
+compares the last column of two transit output spectra.
+"""
+
+import argparse
+import math
+import struct
+import sys
+from array import array
+
+# Opacity-file constants (see flags_tr.h):
+OPA_MAGIC  = -0x4f5041
+OPA_DOUBLE = 0
+OPA_FLOAT  = 1
+OPA_INT16  = 2
+OPA_QBLOCK = 256
+FORMAT_NAME = {OPA_DOUBLE:"double", OPA_FLOAT:"float", OPA_INT16:"16-bit"}
+LN10 = math.log(10.0)
+
+
+class OpacityFile(object):
+  """
+  Row reader of an opacity file (aligned or legacy layout).  A row holds
+  the Nwave opacities of a (layer, temperature, molecule) cell.
+  """
+  def __init__(self, filename):
+    self.f = open(filename, "rb")
+    magic = struct.unpack("q", self.f.read(8))[0]
+    if magic == OPA_MAGIC:
+      (version, self.Nmol, self.Ntemp, self.Nlayer, self.Nwave, self.grid,
+       self.format) = struct.unpack("7q", self.f.read(56))
+      if version == 1:
+        self.format = OPA_DOUBLE
+      molpos = 64
+    else:
+      # Legacy layout (doubles, arrays packed after the dimensions):
+      self.Nmol = magic
+      self.Ntemp, self.Nlayer, self.Nwave = struct.unpack("3q",
+                                                          self.f.read(24))
+      self.format = OPA_DOUBLE
+      molpos = 32
+      self.grid = molpos + 4*self.Nmol + 8*(self.Ntemp+self.Nlayer+self.Nwave)
+    self.f.seek(molpos)
+    self.molID = array("i")
+    self.molID.fromfile(self.f, self.Nmol)
+    self.nrow  = self.Nlayer * self.Ntemp * self.Nmol
+    self.nqblk = (self.Nwave + OPA_QBLOCK - 1) // OPA_QBLOCK
+
+  def row(self, n):
+    """
+    Decode row n of the grid into a list of opacities.
+    """
+    Nwave = self.Nwave
+    if self.format == OPA_DOUBLE:
+      self.f.seek(self.grid + 8*n*Nwave)
+      values = array("d")
+      values.fromfile(self.f, Nwave)
+      return values
+    if self.format == OPA_FLOAT:
+      self.f.seek(self.grid + 4*n*Nwave)
+      values = array("f")
+      values.fromfile(self.f, Nwave)
+      return [math.exp(LN10*v) if v != -float("inf") else 0.0
+              for v in values]
+    # 16-bit steps: offset and step per block, then the codes:
+    self.f.seek(self.grid + 8*n*self.nqblk)
+    par = array("f")
+    par.fromfile(self.f, 2*self.nqblk)
+    self.f.seek(self.grid + 8*self.nrow*self.nqblk + 2*n*Nwave)
+    codes = array("H")
+    codes.fromfile(self.f, Nwave)
+    values = [0.0]*Nwave
+    for i in range(Nwave):
+      if codes[i]:
+        b = i // OPA_QBLOCK
+        values[i] = math.exp(LN10*(par[2*b] + (codes[i]-1)*par[2*b+1]))
+    return values
+
+
+def griderror(reffile, testfile):
+  """
+  Print the relative error of the opacities of testfile w.r.t. reffile.
+  """
+  ref  = OpacityFile(reffile)
+  test = OpacityFile(testfile)
+  if (ref.Nmol, ref.Ntemp, ref.Nlayer, ref.Nwave) != \
+     (test.Nmol, test.Ntemp, test.Nlayer, test.Nwave):
+    print("The opacity grids have different dimensions.")
+    sys.exit(1)
+
+  print("Grid encoding: {:s} (reference: {:s}).".format(
+        FORMAT_NAME[test.format], FORMAT_NAME[ref.format]))
+  maxerr = [0.0]*ref.Nmol
+  sumsq  = [0.0]*ref.Nmol
+  count  = [0]*ref.Nmol
+  for n in range(ref.nrow):
+    m = n % ref.Nmol
+    for r, t in zip(ref.row(n), test.row(n)):
+      if r != 0:
+        err = abs(t - r)/abs(r)
+        maxerr[m] = max(maxerr[m], err)
+        sumsq[m] += err*err
+        count[m] += 1
+      elif t != 0:
+        maxerr[m] = float("inf")
+
+  for m in range(ref.Nmol):
+    rms = math.sqrt(sumsq[m]/count[m]) if count[m] else 0.0
+    print("Molecule {:4d}:  max relative error {:.3e},  rms {:.3e}".
+          format(ref.molID[m], maxerr[m], rms))
+  total = sum(count)
+  rms = math.sqrt(sum(sumsq)/total) if total else 0.0
+  print("Whole grid:     max relative error {:.3e},  rms {:.3e}".
+        format(max(maxerr), rms))
+
+
+def readspectrum(filename):
+  """
+  Read the last column of a transit output spectrum.
+  """
+  spectrum = []
+  for line in open(filename, "r"):
+    if line.strip() == "" or line.startswith("#"):
+      continue
+    spectrum.append(float(line.split()[-1]))
+  return spectrum
+
+
+def spectrumerror(reffile, testfile):
+  """
+  Print the error of spectrum testfile w.r.t. reffile.
+  """
+  ref  = readspectrum(reffile)
+  test = readspectrum(testfile)
+  if len(ref) != len(test):
+    print("The spectra have different lengths.")
+    sys.exit(1)
+  diff = [abs(t - r) for r, t in zip(ref, test)]
+  rel  = [d/abs(r) for d, r in zip(diff, ref) if r != 0]
+  print("Spectrum:       max absolute error {:.3e},  max relative error "
+        "{:.3e},  rms absolute error {:.3e}".format(max(diff),
+        max(rel) if rel else 0.0, math.sqrt(sum(d*d for d in diff)/len(diff))))
+
+
+if __name__ == "__main__":
+  parser = argparse.ArgumentParser(description=__doc__,
+                           formatter_class=argparse.RawDescriptionHelpFormatter)
+  parser.add_argument("reference", help="Opacity file stored as doubles.")
+  parser.add_argument("encoded",   help="Encoded opacity file.")
+  parser.add_argument("--spectra", nargs=2, metavar=("REF", "TEST"),
+                      help="Spectra computed with the reference and the "
+                           "encoded opacity files.")
+  args = parser.parse_args()
+  griderror(args.reference, args.encoded)
+  if args.spectra is not None:
+    spectrumerror(*args.spectra)
@@ -12,7 +12,7 @@
     defined(PI)        || defined (SIGCTE)     || defined(EXPCTE)      ||  \
     defined(WNU_O_WLU) || defined(AU)          || defined(SUNMASS)     ||  \
     defined(SUNRADIUS) || defined(HOUR)        || defined(ONEOSQRT2PI) ||  \
-    defined(SQRTLN2)
+    defined(SQRTLN2)   || defined(LN10)
 #error Some of the preprocessor constants were already defined!
 #endif
 
@@ -39,6 +39,7 @@
 
 #define ONEOSQRT2PI (0.3989422804)         /* 1.0/sqrt(2pi)                  */
 #define SQRTLN2  (0.83255461115769775635)  /* sqrt(ln(2))                    */
+#define LN10     (2.30258509299404568402)  /* ln(10)                         */
 
 #define MAXNAMELEN 20
 
@@ -13,6 +13,5 @@ extern int emergent_intens P_((struct transit *tr));
 extern int flux P_((struct transit *tr));
 extern void printflux P_((struct transit *tr));
 extern int freemem_intensityGrid P_((struct grid *intens, long *pi));
-extern void freemem_localeclipse P_((void));
 
 #undef P_
@@ -8,8 +8,12 @@
 #endif
 
 /* src/extinction.c */
+extern int profilesize P_((double dwn, float dop, float lor, float ta,
+                           int nwave));
 extern int getprofile P_((float **pr,         double dwn, float dop,
-                                 float lor, float ta, int nwave));
+                                 float lor, float ta, int nwave, int flags));
+extern float *voigtprofile P_((struct transit *tr, int i, int j));
+extern void trimprofiles P_((struct opacity *op));
 extern void savefile_extinct P_((char *filename, double **e, short *c,
                                  long nrad, long nwav));
 extern void restfile_extinct P_((char *filename, double **e, short *c,
@@ -22,8 +26,17 @@ extern void printone P_((struct transit *tr));
 extern int freemem_extinction P_((struct extinction *ex, long *pi));
 extern int restextinct P_((FILE *in, long nrad, short niso, long nwn,
                            struct extinction *ex));
+extern int alloc_extwork P_((struct transit *tr, struct extwork *ew,
+                             int permol));
+extern int freemem_extwork P_((struct extwork *ew));
 extern int computemolext P_((struct transit *tr, PREC_RES **kiso,
-                   PREC_ATM temp, PREC_ATM *density, double *Z, int permol));
+                   PREC_ATM temp, PREC_ATM *density, double *Z, int permol,
+                   struct extwork *ew));
+extern int gridwidths P_((struct transit *tr));
+extern double gridhalfwidth P_((struct transit *tr));
+extern double *gridlinemax P_((struct transit *tr));
+extern int gridmolext P_((struct transit *tr, double *kmax, long r0, long r1,
+                          PREC_RES *grid));
 extern int interpolmolext P_((struct transit *tr, PREC_NREC r, PREC_RES **kiso));
 extern void computeextscat P_((double *e, long n, 
                                       struct extscat *sc, double *rad,
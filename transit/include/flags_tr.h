@@ -120,4 +120,36 @@
 #define TSHM_WRITTEN      0x000002 /* Space written     */
 #define TSHM_ERROR        0x000004 /* Error             */
 
+/* Locked bytes of the shared-memory object: */
+#define TSHM_SETUP        0        /* Creation and removal */
+#define TSHM_ALIVE        1        /* Attached processes   */
+
+/* Opacity-file format: */
+#define OPA_MAGIC       (-0x4f5041L) /* First long of the file */
+#define OPA_VERSION       2          /* File-format version    */
+#define OPA_ALIGN         65536      /* Grid alignment (bytes) */
+
+/* Opacity-grid encodings (see encodefile()): */
+#define OPA_DOUBLE        0          /* Opacity as double           */
+#define OPA_FLOAT         1          /* log10(opacity) as float     */
+#define OPA_INT16         2          /* 16-bit log10(opacity) steps */
+#define OPA_QBLOCK        256        /* Values per 16-bit block     */
+
+/* Voigt-profile cache format: */
+#define VPC_MAGIC       (-0x565043L) /* First long of the file */
+#define VPC_VERSION       1          /* File-format version    */
+
+/* Opacity-grid engines: */
+#define OPA_CELL          0          /* computemolext() per cell */
+#define OPA_LINE          1          /* gridmolext(), line-major */
+#define OPA_LINEMEM  (256L << 20)    /* Grid bytes per gridmolext() pass */
+
+/* Line-store array alignment (bytes): */
+#define LINE_ALIGN        64
+
+/* Column formats of the blocked TLI files (version blocktliversion): */
+#define TLI_DOUBLE        0          /* double wl, elow, and gf         */
+#define TLI_COMPACT       1          /* uint32 wl, float elow and gf    */
+#define TLI_BLOCKINFO     64         /* Size of a block-index entry     */
+
 #endif /* _FLAGS_TR_H */
@@ -9,12 +9,17 @@
 
 /* src/opacity.c */
 extern int opacity P_((struct transit *tr));
+extern long pressbracket P_((PREC_RES *press, long n, double p, double *frac));
 extern int calcprofiles P_((struct transit *tr));
-extern int calcopacity P_((struct transit *tr, FILE *fp));
+extern int calcopacity P_((struct transit *tr, FILE *fp,
+                            struct opacity *old));
+extern int opaoffsets P_((struct opacity *op, long *off));
+extern int readopahead P_((struct opacity *op, FILE *fp, long *off));
+extern int indexopacity P_((struct opacity *op, PREC_RES *grid));
 extern int readopacity P_((struct transit *tr, FILE *fp));
 extern int shareopacity P_((struct transit *tr, FILE *fp));
-extern int attachopacity P_((struct transit *tr));
-extern int mountopacity P_((struct transit *tr));
+extern int mountopacity P_((struct opacity *op, char *base, long *off));
+extern int detachopacity P_((struct opacity *op));
 extern int freemem_opacity P_((struct opacity *op, long *pi));
 
 #undef P_
@@ -8,15 +8,20 @@
 #endif
 
 /* src/readlineinfo.c                                                       */
-extern void datafileBS P_((FILE *fp, PREC_NREC offs, PREC_NREC nfields,
-                           PREC_LNDATA target, PREC_NREC *resultp,
-                           int reclength, int up));
+extern void datafileBS P_((const struct tliseg *seg, PREC_NREC nfields,
+                           PREC_LNDATA target, PREC_NREC *resultp, int up));
 extern int readtli_bin P_((FILE *fp, struct transit *tr, struct lineinfo *li));
 extern int setimol P_((struct transit *tr));
 extern int checkrange P_((struct transit *tr, struct lineinfo *li));
 extern int readinfo_tli P_((struct transit *tr, struct lineinfo *li));
 extern int readdatarng P_((struct transit *tr, struct lineinfo *li));
+extern int setlinestore P_((struct transit *tr, struct lineinfo *li,
+                             struct tlimap *map));
 extern int readlineinfo P_((struct transit *tr));
+extern int alloc_linecursor P_((struct transit *tr, struct linecursor *lc));
+extern struct line_transition *linefirst P_((struct linecursor *lc));
+extern struct line_transition *linenext P_((struct linecursor *lc));
+extern int freemem_linecursor P_((struct linecursor *lc));
 extern int freemem_isotopes P_((struct isotopes *iso, long *pi));
 extern int freemem_lineinfo P_((struct lineinfo *li, long *pi));
 extern int freemem_linetransition P_((struct line_transition *lt, long *pi));
@@ -8,6 +8,7 @@
 #endif
 
 /* src/slantpath.c */
+extern int slantweights P_((struct transit *tr));
 extern int modulation P_((struct transit *tr));
 extern void printmod P_((struct transit *tr));
 extern int freemem_outputray P_((struct outputray *out, long *pi));
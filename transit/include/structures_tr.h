@@ -92,13 +92,89 @@ struct atm_isoprop{    /* Proportional-abundance isotopic parameters: */
 };
 
 
+/* Range of lines of a memory-mapped TLI file (see readdatarng()).  The
+   columns start at arbitrary byte offsets of the file, thus their values
+   are copied out with memcpy() rather than dereferenced:                   */
+struct tliseg{
+  const char *wl;        /* Wavelength column                               */
+  const char *elow;      /* Lower-state energy column                       */
+  const char *gf;        /* gf column                                       */
+  int fmt;               /* Column format (TLI_DOUBLE or TLI_COMPACT)       */
+  short iso;             /* Isotope ID                                      */
+  double wl0, dwl;       /* Compact wavelengths: wl = wl0 + dwl*value       */
+  PREC_NREC first,       /* Column index of the first line to read          */
+            count;       /* Number of lines to read                         */
+};
+
+/* Memory-mapped TLI file:                                                  */
+struct tlimap{
+  char *base;            /* Start of the mapping                            */
+  size_t size;           /* Size of the mapping (bytes)                     */
+  int nseg;              /* Number of line ranges to read                   */
+  struct tliseg *seg;    /* Line ranges to read [nseg]                      */
+};
+
+/* Line list streamed from the TLI file in chunks (see linefirst()):        */
+struct linestream{
+  struct tlimap map;     /* Mapped TLI file and line ranges to read         */
+  int fd;                /* TLI file descriptor (the chunks are read with
+                            pread(), not through the mapping)               */
+  PREC_NREC *segstart;   /* Stream index of the first line of each range    */
+  PREC_NREC nline;       /* Number of lines in the stream                   */
+  int nrun;              /* Number of isotope runs in the stream            */
+  PREC_NREC chunk;       /* Maximum number of lines per chunk               */
+  prop_samp *owns;       /* Oversampled wavenumbers, which set the groups
+                            of co-added lines (see computemolext())         */
+  double wn0;            /* First wavenumber of the run (cm-1)              */
+  _Bool warned;          /* A chunk already ended within a co-added group   */
+  double wfct, efct;     /* Wavelength and Elow units factors to cgs        */
+  struct isotopes *iso;  /* Isotope ratios and masses                       */
+};
+
+/* Block-index entry of a blocked TLI file (TLI_BLOCKINFO bytes, see
+   doc/dataformat.tli.txt).  A block holds the lines of a single isotope:   */
+struct tliblock{
+  int iso;               /* Isotope ID                                      */
+  int n;                 /* Number of lines                                 */
+  double wlmin, wlmax;   /* Wavelength range of the lines (microns)         */
+  double gfmax;          /* Largest gf of the lines                         */
+  double elowmin;        /* Smallest lower-state energy of the lines        */
+  double elowrep, wlrep; /* Elow and wl of the line with largest gf         */
+  int64_t offset;        /* Position of the block data in the file (bytes)  */
+};
+
+
 struct line_transition{  /* Line transition parameters:                     */
-  PREC_LNDATA *wl;       /* Wavelength                                      */
-  PREC_LNDATA *elow;     /* Lower-state energy                              */
-  PREC_LNDATA *gf;       /* gf value                                        */
-  short *isoid;          /* Isotope ID (Assumed to be in range)             */
   double wfct;           /* wl units factor to cgs                          */
   double efct;           /* elow units factor to cgs                        */
+  /* Line store for computemolext() (see setlinestore()), built from the
+     TLI wavelength, lower-state energy, and gf columns.  The lines come in
+     runs of a same isotope, sorted by decreasing wavenumber within each
+     run:                                                                   */
+  double *wn;            /* Wavenumber (cm-1)                               */
+  double *elr;           /* -EXPCTE times the lower-state energy (K)        */
+  double *lgf;           /* log(SIGCTE * gf * isoratio / isotope mass)      */
+  int nrun;              /* Number of isotope runs                          */
+  PREC_NREC *rfirst;     /* Index of the first line of each run [nrun+1]    */
+  short *riso;           /* Isotope ID of each run [nrun]                   */
+  struct linestream *ls; /* If not NULL, the lines are not stored, but
+                            streamed from the TLI file (see linefirst())    */
+};
+
+/* Cursor over the line store, one chunk at a time (see linefirst()).
+   While the current chunk is in use, a background thread reads the next
+   one into the other buffer:                                               */
+struct linecursor{
+  struct line_transition *lt;    /* Line store                              */
+  struct line_transition buf[2]; /* Chunk buffers                           */
+  char *raw[2];          /* Raw TLI columns of each chunk buffer            */
+  PREC_NREC pos[2];      /* Stream index of the chunk in each buffer        */
+  PREC_NREC end[2];      /* Stream index past the chunk in each buffer      */
+  int cur;               /* Buffer of the current chunk                     */
+  _Bool busy;            /* The read-ahead thread is running                */
+  pthread_t thread;      /* Read-ahead thread                               */
+  int maxrun;            /* Maximum number of isotope runs in a chunk       */
+  PREC_NREC maxline;     /* Maximum number of lines in a chunk              */
 };
 
 
@@ -129,6 +205,7 @@ struct atm_data{     /* Atmospheric file parameters:                    */
   _Bool mass;        /* Abundances in isov by mass (1) of by number (0) */
   int begline;       /* Line of first radius dependent info             */
   long begpos;       /* Position of first radius dependent info         */
+  double zerorad;    /* Radius offset added to the file's radii         */
 };
 
 
@@ -143,20 +220,99 @@ struct extinction{
 };
 
 
+/* Scratch buffers for computemolext(), one set per worker thread:          */
+struct extwork{
+  PREC_VOIGTP *alphal, /* Lorentz width per isotope [niso]                  */
+              *alphad; /* Doppler width (over wavenumber) per isotope       */
+  int *idop, *ilor;    /* Doppler and Lorentz profile indices [niso]        */
+  int *ilev,           /* Sampling level of each isotope [niso]             */
+      *lof;            /* Oversampling factor of each level [niso]          */
+  long *lpos;          /* Offset of each level in a tile [niso]             */
+  double *kmax, *kmin; /* Line-strength extrema per species [nmol]          */
+  double **ktmp;       /* Dynamic-sampling extinction tiles, one set per
+                          thread [nthr*nmol][ntile]                         */
+  int nmol;            /* Number of species rows in kmax, kmin, and ktmp    */
+  int nthr;            /* Number of threads with a set of tiles             */
+  long ntile;          /* Length of a tile (all levels)                     */
+  long cell;           /* Opacity-grid cell (layer*Ntemp + temperature
+                          index) of the call, -1 if none                    */
+  long k0, k1;         /* Output wavenumber-index range to compute (k1 < 0:
+                          up to the end of the array)                       */
+  _Bool *molmask;      /* Species to compute, per output species (NULL:
+                          all)                                              */
+  struct linecursor lc; /* Line-store cursor                                */
+};
+
+
+/* Head of the shared-memory opacity segment, followed (at OPA_ALIGN) by
+   an image of an aligned opacity file:                                     */
 struct opacityhint{
-  int master_PID;       /* Process that will write the shared memory        */
-  int num_attached;     /* Count of processes attached to the main segment  */
   volatile long status; /* Flags concerning the state of the shared memory  */
-  long Nwave, Ntemp, Nlayer, Nmol; /* Info necessary for sizing shared mem  */
+  long Nwave, Ntemp, Nlayer, Nmol; /* Dimensions of the shared grid         */
+};
+
+
+/* Opacity-file header.  Legacy files start directly with Nmol > 0, thus a
+   negative magic number tells the two layouts apart.  The grid starts at
+   a multiple of OPA_ALIGN bytes, so that it is page aligned when mapped:   */
+struct opahead{
+  long magic;           /* OPA_MAGIC                                        */
+  long version;         /* OPA_VERSION                                      */
+  long Nmol, Ntemp, Nlayer, Nwave; /* Opacity-grid dimensions               */
+  long grid;            /* Byte offset of the opacity grid                  */
+  long format;          /* Grid encoding (OPA_DOUBLE in version 1 files)    */
+};
+
+
+/* Voigt-profile cache-file header, followed by the offset of each
+   profile [nDop*nLor] (long, in values from the first profile, -1 for
+   those that take the profile of the first Doppler width), and the half
+   profiles.  The fields from dwn to flags determine the profiles, the
+   file name holds a hash of them:                                          */
+struct vprofhead{
+  long magic;           /* VPC_MAGIC                                        */
+  long version;         /* VPC_VERSION                                      */
+  double dwn;           /* Oversampled wavenumber spacing                   */
+  double dmin, dmax, lmin, lmax; /* Broadening-width samples boundaries     */
+  double timesalpha;    /* Profile half width in number of widths           */
+  long nwave;           /* Maximum profile half-size                        */
+  long nDop, nLor;      /* Number of broadening-width samples               */
+  long flags;           /* voigtn() evaluation flags                        */
+  long size;            /* Number of profile values                         */
 };
 
 
 struct opacity{
   PREC_RES ****o;         /* Opacity grid [temp][iso][rad][wav]             */
-  PREC_VOIGT ***profile;  /* Voigt profiles [nDop][nLor][2*profsize+1]      */
+  int format;             /* Grid encoding (OPA_DOUBLE, OPA_FLOAT, or
+                             OPA_INT16), o is only set for OPA_DOUBLE       */
+  float *lgrid;           /* log10 of the opacity (OPA_FLOAT)
+                             [rad][temp][mol][wav]                          */
+  unsigned short *qgrid;  /* 16-bit log10 steps (OPA_INT16)
+                             [rad][temp][mol][wav]                          */
+  float *qpar;            /* Offset and step of each block of OPA_QBLOCK
+                             values of qgrid [rad][temp][mol][block][2]     */
+  PREC_VOIGT ***profile;  /* Voigt half profiles [nDop][nLor][profsize+1],
+                             NULL until first used (see voigtprofile())     */
   PREC_NREC **profsize;   /* Half-size of Voigt profiles [nDop][nLor]       */
+  long *profuse;          /* Last period of use of each profile [nDop*nLor] */
+  long profclock;         /* Current period of use of the profiles          */
+  size_t profmem,         /* Memory held by the Voigt profiles (bytes)      */
+         profbudget;      /* Voigt-profile memory budget (bytes, 0: none)   */
+  void *vpcaddr;          /* Address of the mapped Voigt-profile cache      */
+  size_t vpcsize;         /* Size of the mapping in bytes                   */
   double *aDop,           /* Sample of Doppler widths [nDop]                */
          *aLor;           /* Sample of Lorentz widths [nLor]                */
+  double lDop, dlDop,     /* log10 of the first Doppler-width sample and
+                             log10 spacing of the (log-uniform) samples     */
+         lLor, dlLor;     /* Same for the Lorentz-width samples             */
+  double *mm,             /* Mean molecular mass at grid pressures [rad]    */
+         *q;              /* Abundance of each species at the grid
+                             pressures [mol][rad], see gridpressures()      */
+  double *alphal,         /* Lorentz width per cell and isotope [cell][iso] */
+         *alphad;         /* Doppler width (over wavenumber) [temp][iso]    */
+  int *idop, *ilor;       /* Profile indices per cell and isotope [cell][iso],
+                             see gridwidths()                               */
   PREC_RES *temp,         /* Opacity-grid temperature array                 */
            *press,        /* Opacity-grid pressure array                    */
            *wns;          /* Opacity-grid wavenumber array                  */
@@ -164,10 +320,12 @@ struct opacity{
   int *molID;             /* Opacity-grid molecule ID array                 */
   long Nwave, Ntemp, Nlayer, Nmol, /* Number of elements in opacity grid    */
       nDop, nLor;         /* Number of Doppler and Lorentz-width samples    */
-  int hintID;             /* Shared memory ID of the hint segment           */
   struct opacityhint *hint; /* Information about the shared memory          */
-  int mainID;             /* Shared memory ID of the main segment           */
-  void *mainaddr;         /* Shared memory address of the main segment      */
+  int shmfd;              /* Descriptor of the shared-memory object         */
+  char shmname[80];       /* Name of the shared-memory object (if attached) */
+  void *mapaddr;          /* Address of the memory-mapped opacity file, or
+                             of the shared-memory segment                   */
+  size_t mapsize;         /* Size of the mapping in bytes                   */
 };
 
 
@@ -192,6 +350,10 @@ struct optdepth{
                        optical depth increases inwards)  [wn]               */
   double toomuch;   /* Optical depth values greater than this won't be
                        calculated: the extinction is assumed to be zero.    */
+  PREC_RES **w;     /* Slant-path weights, tau[ip] = sum_j w[ip][j] *
+                       ex[first[ip]+j]  [ip][nw[ip]]                        */
+  long *first,      /* Index of the first layer in each path [ip]           */
+       *nw;         /* Number of weights per path, -1 if not tabulated [ip] */
 };
 
 
@@ -286,6 +448,7 @@ struct detailout{
 struct cross{
   int nfiles;         /* Number of cross-section files                      */
   PREC_CS **e;        /* Extinction from all CS sources [nwn][nrad]         */
+  PREC_CS **et;       /* Interpolation scratch array    [nwn][nrad]         */
   PREC_CS ***cs;      /* Tabulated CS extinction     [nfiles][nwave][ntemp] */
   PREC_CS **wn;       /* Tabulated wavenumber arrays [nfiles][nwave]        */
   PREC_CS **temp;     /* Tabulated temperatures      [nfiles][ntemp]        */
@@ -303,6 +466,7 @@ struct transithint{
   char *f_atm,          /* Atmosphere filename                              */
        *f_line,         /* TLI filename                                     */
        *f_opa,          /* Opacity filename                                 */
+       *f_voigt,        /* Voigt-profile cache directory                    */
        *f_outspec,      /* Output spectrum filename                         */
        *f_toomuch,      /* Output toomuch filename                          */
        *f_outsample,    /* Output sample filename                           */
@@ -319,13 +483,24 @@ struct transithint{
                            calculated profile, one side only                */
   int voigtfine;        /* Fine-binning for Voigt function in kapwl(), if
                            accepted it goes to tr.ds.op.vf                  */
+  int voigtflags;       /* Voigt-function evaluation flags (VOIGT_*)        */
   int nDop, nLor;       /* Number of broadening width samples               */
   float dmin, dmax, lmin, lmax; /* Broadening-width samples boundaries      */
+  double voigtmem;      /* Voigt-profile memory budget (MB, 0: no limit)    */
+  double opatol;        /* Relative-error tolerance of the stored opacity
+                           grid (0: store doubles)                          */
+  double plow, phigh;   /* Opacity-grid pressure boundaries (bar)           */
+  int pnum;             /* Number of opacity-grid pressures (0: the layers) */
   int verbnoise;        /* Noisiest verbose level in a non debugging run    */ 
   _Bool mass;           /* Whether the abundances read by getatm are by
                            mass or number                                   */
   _Bool opabreak;       /* Break after opacity calculation flag             */
   _Bool opashare;       /* Attempt to place opacity grid in shared memory.  */
+  _Bool opaextend;      /* Extend the grid of an existing opacity file      */
+  int gridengine;       /* Opacity-grid engine (OPA_CELL or OPA_LINE)       */
+  _Bool blockcut;       /* Skip the TLI blocks below the ethreshold cut     */
+  long linechunk;       /* Lines per streamed chunk (0: load all at once)   */
+  int nthreads;         /* Number of worker threads (0: OpenMP default)     */
   long fl;              /* flags                                            */
   _Bool userefraction;  /* Whether to use variable refraction               */
   _Bool savefiles    ;  /* Whether to save files                            */
@@ -344,6 +519,7 @@ struct transithint{
   struct detailout det;
 
   double ethresh;       /* Lower extinction-coefficient threshold           */
+  double sthresh;       /* Super-line (weak-line binning) threshold         */
   char **csfile;
   int ncross;
 
@@ -372,9 +548,13 @@ struct transit{
   prop_atm atm;      /* Sampled atmospheric data                            */
   _Bool opabreak;    /* Break after opacity calculation                     */
   _Bool opashare;    /* Attempt to place opacity grid in shared memory.     */
+  _Bool opaextend;   /* Extend the grid of an existing opacity file         */
+  int gridengine;    /* Opacity-grid engine (OPA_CELL or OPA_LINE)          */
+  int nthreads;      /* Number of threads of the parallel regions           */
   int ndivs,         /* Number of exact divisors of the oversampling factor */
      *odivs;         /* Exact divisors of the oversampling factor           */
   int voigtfine;     /* Number of fine-bins of the Voigt function           */
+  int voigtflags;    /* Voigt-function evaluation flags (VOIGT_*)           */
   float timesalpha;  /* Broadening profile width in number of Doppler or
                         Lorentz half width                                  */
   double p0, r0;     /* Pressure and radius reference level                 */
@@ -419,6 +599,36 @@ struct transit{
     struct detailout   *det;
     struct cross       *cross;
   }ds;
+
+  struct {           /* Storage of the data structures above, so that each
+                        transit context owns a separate set                 */
+    struct transithint th;
+    struct lineinfo    li;
+    struct atm_data    at;
+    struct extinction  ex;
+    struct opacity     op;
+    struct grid        intens;
+    struct optdepth    tau;
+    struct idxref      ir;
+    struct geometry    sg;
+    struct isotopes    iso;
+    struct molecules   mol;
+    struct outputray   out,    /* Modulation or flux spectrum               */
+                       intout; /* Emergent intensity                        */
+    struct extcloud    cl;
+    struct detailout   det;
+    struct cross       cross;
+  }st;
+
+  long itr;          /* Number of spectra computed                          */
+  double t0;         /* Time of the last check point (seconds)              */
+  _Bool init;        /* Context is initialized (transit_init() ran)         */
+  long runrad, runip; /* Number of layers and impact parameters of the
+                         per-model arrays kept from the last run (0: none)  */
+  int nwk;           /* Number of batch worker contexts                     */
+  struct transit **wk; /* Batch worker contexts (see tr_runbatch())         */
+  struct transit *parent; /* Context whose read-only data this batch worker
+                             shares (NULL if not a worker)                  */
 };
 
 #endif /* _TRANSIT_STRUCTURES_H */
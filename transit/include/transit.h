@@ -8,10 +8,14 @@
 #define _TRANSIT_H
 
 #include <stdarg.h>
+#include <stdint.h>
 #include <math.h>
+#include <float.h>
 #include <errno.h>
-#include <sys/ipc.h>
-#include <sys/shm.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
@@ -26,27 +30,41 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <alloca.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #define compattliversion 5
+#define blocktliversion  6
 
 #include <flags_tr.h>
 #include <constants_tr.h>
 #include <types_tr.h>
 
+/* Transit contexts (handle API), see src/transit.c:                       */
+struct transit;
+extern struct transit *tr_create(void);
+extern void tr_init(struct transit *tr, int argc, char **argv);
+extern int  tr_nsamples(struct transit *tr);
+extern void tr_waveno(struct transit *tr, double *waveno_arr, int waveno);
+extern void tr_setradius(struct transit *tr, double refradius);
+extern void tr_run(struct transit *tr, double *re_input, int transint,
+                   double *transit_out, int transit_out_size);
+extern void tr_runbatch(struct transit *tr, double *re_batch, int nmodels,
+                        int ninput, double *batch_out, int nout, int nwave);
+extern void tr_free(struct transit *tr);
+
+/* Single-context interface, acting on the global transit struct:          */
 extern struct transit transit;
-extern long itr;
-extern struct timeval tv;
-extern double t0;
-extern int argc;
-extern char ** argv;
-extern int init_run;
-
 extern void transit_init(int argc, char **argv);
 extern int  get_no_samples(void);
 extern void get_waveno_arr(double * waveno_arr, int waveno);
 extern void set_radius(double refradius);
 extern void run_transit(double * re_input, int transint, double *\
 		transit_out,int transit_out_size);
+extern void run_transit_batch(double *re_batch, int nmodels, int ninput,
+                              double *batch_out, int nout, int nwave);
+extern void free_memory(void);
 
 
 /*****   Macros   *****/
@@ -87,7 +105,8 @@ stateeqnford(_Bool mass,  /* Abundance by mass (1) or by number (0)         */
     vtransiterror_fcn(flag DBGERR, __FILE__, __LINE__, __VA_ARGS__)
 
 
-long fw_status;
+/* Status returned by the last fw() call (one per thread):                  */
+extern __thread long fw_status;
 #define fw(fcn, failurecondition, ...) do{               \
     if((fw_status=fcn(__VA_ARGS__)) failurecondition) {  \
       tr_output(TOUT_ERROR,                              \
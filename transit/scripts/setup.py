@@ -10,7 +10,9 @@ pu_objs = [op.realpath(f) for f in glob.glob("../pu/src/*.o")
 
 transit_module = Extension('_transit_module',
       sources = ['python/transit_wrap.c'],
-      extra_objects = transit_objs + pu_objs)
+      extra_objects = transit_objs + pu_objs,
+      extra_compile_args = ['-fopenmp'],
+      extra_link_args = ['-fopenmp', '-lrt'])
 
 setup (name="transit_module",
        version= '0.1',
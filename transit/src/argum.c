@@ -74,6 +74,9 @@ processparameters(int argc,            /* Number of command-line args  */
     CLA_TAULEVEL,
     CLA_MODLEVEL,
     CLA_ETHRESH,
+    CLA_STHRESH,
+    CLA_BLOCKCUT,
+    CLA_LINECHUNK,
     CLA_CLOUD,
     CLA_TRANSPARENT,
     CLA_DETEXT,
@@ -88,14 +91,24 @@ processparameters(int argc,            /* Number of command-line args  */
     CLA_TEMPLOW,
     CLA_TEMPHIGH,
     CLA_TEMPDELT,
+    CLA_PRESSLOW,
+    CLA_PRESSHIGH,
+    CLA_PRESSNUM,
     CLA_MOLFILE,
     CLA_RPRESS,
     CLA_RRADIUS,
     CLA_GSURF,
     CLA_OPABREAK,
     CLA_OPASHARE,
+    CLA_OPAEXTEND,
+    CLA_GRIDENGINE,
+    CLA_OPATOL,
+    CLA_NTHREADS,
     CLA_NDOP,
     CLA_NLOR,
+    CLA_VOIGTMODE,
+    CLA_VOIGTMEM,
+    CLA_VOIGTCACHE,
     CLA_DMIN,
     CLA_DMAX,
     CLA_LMIN,
@@ -229,6 +242,19 @@ processparameters(int argc,            /* Number of command-line args  */
     {"nwidth",  'a',      required_argument, "20",   "number",
      "Number of the max-widths (the greater of Voigt or Doppler widths) "
      "that needs to be contained in a calculated profile."},
+    {"voigtmode", CLA_VOIGTMODE, required_argument, "accurate", "mode",
+     "Voigt-profile evaluation: 'accurate' (32-term Weideman approximation, "
+     "~1e-13 precision), 'fast' (16 terms, ~1e-6), or 'legacy' (Pierluissi "
+     "et al. series)."},
+    {"voigtmem",  CLA_VOIGTMEM,  required_argument, "0",        "MB",
+     "Memory budget for the Voigt profiles, which are evaluated when first "
+     "needed.  Beyond it, the least recently used profiles are freed "
+     "between layers, between blocks of layers of the opacity grid, or "
+     "between line chunks of '--gridengine line' (0 sets no limit)."},
+    {"voigtcache", CLA_VOIGTCACHE, required_argument, NULL,     "directory",
+     "Directory of the Voigt-profile cache files.  The profiles are read "
+     "from (mapped) the file of the current sampling parameters, which is "
+     "written first if it does not exist."},
 
     /* Extinction calculation options:                                      */
     {NULL,         0,               HELPTITLE,         NULL,    NULL,
@@ -236,6 +262,21 @@ processparameters(int argc,            /* Number of command-line args  */
     {"ethreshold", CLA_ETHRESH,   required_argument, "1e-8",    "ethreshold",
      "Minimum extinction-coefficient ratio (w.r.t. maximum in a layer) to "
      "consider in the calculation."},
+    {"sthreshold", CLA_STHRESH,   required_argument, "0",       "sthreshold",
+     "Line-strength ratio (w.r.t. maximum in a layer) below which the lines "
+     "above ethreshold are binned into super-lines: the lines of a same "
+     "profile within a dynamic-sampling interval are added up and "
+     "evaluated as a single profile (0 evaluates every line)."},
+    {"blockcut",   CLA_BLOCKCUT,  no_argument,       NULL,      NULL,
+     "If set, skip the blocks of a blocked TLI file (version 6) whose lines "
+     "all fall below the ethreshold cut at the atmospheric and opacity-grid "
+     "temperatures."},
+    {"linechunk",  CLA_LINECHUNK, required_argument, "0",       "lines",
+     "Stream the line list from the TLI file in chunks of up to this many "
+     "lines, read ahead by a background thread, instead of loading the "
+     "whole wavelength range into memory (0 loads it at once).  The 'cell' "
+     "grid engine reads the list once per grid cell, the 'line' engine "
+     "twice per block of layers."},
     {"cloud",      CLA_CLOUD,      required_argument, NULL,
      "cloudext,cloudtop,cloudbot",
      "Gray-opacity layer with extinction linearly increasing from 0 at "
@@ -266,10 +307,35 @@ processparameters(int argc,            /* Number of command-line args  */
      "Upper temp"},
     {"tempdelt",  CLA_TEMPDELT,   required_argument,  "100.0",  "spacing",
      "Temperature sample spacing (in kelvin)."},
+    {"plow",   CLA_PRESSLOW,   required_argument,  "1e-8",   "pressure",
+     "Lower pressure sample (in bar), see pnum."},
+    {"phigh",  CLA_PRESSHIGH,  required_argument,  "100",    "pressure",
+     "Upper pressure sample (in bar), see pnum."},
+    {"pnum",   CLA_PRESSNUM,   required_argument,  "0",      "number",
+     "Number of log-uniform pressure samples of a new opacity grid, from "
+     "plow to phigh, so that the grid does not depend on the atmospheric "
+     "layers (0 samples the grid at the atmospheric layers)."},
     {"justOpacity",      CLA_OPABREAK,  no_argument, NULL, NULL,
      "If set, End execution after the opacity-grid calculation."},
     {"shareOpacity",      CLA_OPASHARE,  no_argument, NULL, NULL,
      "If set, attempt to place the opacity grid into shared memory."},
+    {"extendOpacity",     CLA_OPAEXTEND, no_argument, NULL, NULL,
+     "If set, and the opacity file exists, compute only the molecules, "
+     "temperatures, and wavenumbers missing from it, and rewrite it with "
+     "the merged grid."},
+    {"gridengine", CLA_GRIDENGINE, required_argument, "cell", "engine",
+     "Opacity-grid construction: 'cell' (go through the line list once per "
+     "layer and temperature) or 'line' (evaluate each line at every layer "
+     "and temperature in a single pass through the line list per block of "
+     "layers)."},
+    {"opatol",     CLA_OPATOL,     required_argument, "0",    "tolerance",
+     "Relative-error tolerance of a new opacity file.  If positive, the grid "
+     "stores log10(opacity) as 16-bit steps per block of wavenumbers, or as "
+     "floats if 16 bits exceed the tolerance (0 stores doubles)."},
+    {"nthreads",   CLA_NTHREADS,   required_argument, "0",  "number",
+     "Number of threads used to compute the opacity grid, and the optical "
+     "depth and modulation of the transit geometry (0 uses the OpenMP "
+     "default, i.e., OMP_NUM_THREADS or the number of cores)."},
 
     /* Resulting ray options:                 */
     {NULL,        0,            HELPTITLE,         NULL, NULL,
@@ -319,16 +385,14 @@ processparameters(int argc,            /* Number of command-line args  */
   var_cfg.files   = DOTCFGFILE PREPEXTRACFGFILES;
   var_cfg.columns = 70;
 
-  /* Declare transithint:                                                   */
-  static struct transithint st_trh;
-  memset(&st_trh, 0, sizeof(struct transithint));
   /* Assign pointer-to-transithint to transit data structure (ds):          */
-  struct transithint *hints = tr->ds.th = &st_trh;
+  struct transithint *hints = tr->ds.th = &tr->st.th;
+  memset(hints, 0, sizeof(struct transithint));
   /* Setup flags, verbose level, and wheter abundance is by mass or number: */
-  st_trh.fl |= TRU_ATMASK1P | TRU_SAMPSPL | TRH_MASS;
-  st_trh.verbnoise = 4;
-  st_trh.mass = 1;
-  st_trh.savefiles = 0;
+  hints->fl |= TRU_ATMASK1P | TRU_SAMPSPL | TRH_MASS;
+  hints->verbnoise = 4;
+  hints->mass = 1;
+  hints->savefiles = 0;
 
   int rn,  /* optdocs' short option */
       i;   /* Auxilliary index      */
@@ -407,6 +471,15 @@ processparameters(int argc,            /* Number of command-line args  */
     case CLA_ETHRESH:    /* Minimum extiction-coefficient threshold */
       hints->ethresh = atof(optarg);
       break;
+    case CLA_STHRESH:    /* Super-line threshold */
+      hints->sthresh = atof(optarg);
+      break;
+    case CLA_BLOCKCUT:   /* Bool: Skip the TLI blocks below ethresh */
+      hints->blockcut = 1;
+      break;
+    case CLA_LINECHUNK:  /* Number of lines per streamed chunk */
+      hints->linechunk = atol(optarg);
+      break;
     case 's':            /* Ray-solution type name     */
       hints->solname = (char *)realloc(hints->solname, strlen(optarg)+1);
       strcpy(hints->solname, optarg);
@@ -481,6 +554,26 @@ processparameters(int argc,            /* Number of command-line args  */
     case CLA_OPASHARE: /* Bool: Place opacity grid in shared memory         */
       hints->opashare = 1;
       break;
+    case CLA_OPAEXTEND: /* Bool: Extend the existing opacity grid           */
+      hints->opaextend = 1;
+      break;
+    case CLA_GRIDENGINE: /* Opacity-grid construction engine                */
+      if (strcmp(optarg, "cell") == 0)
+        hints->gridengine = OPA_CELL;
+      else if (strcmp(optarg, "line") == 0)
+        hints->gridengine = OPA_LINE;
+      else{
+        tr_output(TOUT_ERROR, "Invalid gridengine '%s', it must be "
+          "'cell' or 'line'.\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case CLA_OPATOL:   /* Opacity-file error tolerance                      */
+      hints->opatol = atof(optarg);
+      break;
+    case CLA_NTHREADS: /* Number of worker threads                          */
+      hints->nthreads = atoi(optarg);
+      break;
 
     /* Radius parameters:                                                   */
     case CLA_RADLOW:  /* Lower limit                                        */
@@ -535,6 +628,15 @@ processparameters(int argc,            /* Number of command-line args  */
     case CLA_TEMPDELT:
       hints->temp.d = atof(optarg);
       break;
+    case CLA_PRESSLOW:
+      hints->plow = atof(optarg);
+      break;
+    case CLA_PRESSHIGH:
+      hints->phigh = atof(optarg);
+      break;
+    case CLA_PRESSNUM:
+      hints->pnum = atoi(optarg);
+      break;
 
     case 'a':  /* Number of half-widths in a profile:            */
       hints->timesalpha = atof(optarg);
@@ -545,6 +647,25 @@ processparameters(int argc,            /* Number of command-line args  */
     case CLA_NLOR:
       hints->nLor = atoi(optarg);
       break;
+    case CLA_VOIGTMODE:  /* Voigt-profile evaluation method            */
+      if (strcmp(optarg, "accurate") == 0)
+        hints->voigtflags = 0;
+      else if (strcmp(optarg, "fast") == 0)
+        hints->voigtflags = VOIGT_FAST;
+      else if (strcmp(optarg, "legacy") == 0)
+        hints->voigtflags = VOIGT_LEGACY;
+      else{
+        tr_output(TOUT_ERROR, "Invalid voigtmode '%s', it must be "
+          "'accurate', 'fast', or 'legacy'.\n", optarg);
+        exit(EXIT_FAILURE);
+      }
+      break;
+    case CLA_VOIGTMEM:   /* Voigt-profile memory budget               */
+      hints->voigtmem = atof(optarg);
+      break;
+    case CLA_VOIGTCACHE: /* Voigt-profile cache directory             */
+      hints->f_voigt = xstrdup(optarg);
+      break;
     case CLA_DMIN:
       hints->dmin = atof(optarg);
       break;
@@ -719,9 +840,8 @@ acceptgenhints(struct transit *tr){
   setgeomhint(tr);
 
   /* Accept hints for detailed output:                                      */
-  static struct detailout det;
-  memcpy(&det, &th->det, sizeof(struct detailout));
-  tr->ds.det = &det;
+  memcpy(&tr->st.det, &th->det, sizeof(struct detailout));
+  tr->ds.det = &tr->st.det;
 
   /* Accept line-profile arguments:                                         */
   /* Check that timesalpha (profile half width in units of Doppler/Lorentz
@@ -733,6 +853,27 @@ acceptgenhints(struct transit *tr){
     return -1;
   }
   tr->timesalpha = th->timesalpha;
+  tr->voigtflags = th->voigtflags;
+  if (th->voigtmem < 0){
+    tr_output(TOUT_ERROR,
+      "Voigt-profile memory budget (%g MB) cannot be negative.\n",
+      th->voigtmem);
+    return -1;
+  }
+
+  if (th->pnum != 0 &&
+      (th->pnum < 2 || th->plow <= 0 || th->phigh <= th->plow)){
+    tr_output(TOUT_ERROR, "Opacity-grid pressure sampling needs at least "
+      "two samples (%i) and 0 < plow (%g) < phigh (%g).\n", th->pnum,
+      th->plow, th->phigh);
+    return -1;
+  }
+
+  if (th->opatol < 0){
+    tr_output(TOUT_ERROR,
+      "Opacity-grid tolerance (%g) cannot be negative.\n", th->opatol);
+    return -1;
+  }
 
   if (th->ethresh <= 0){
     tr_output(TOUT_ERROR,
@@ -740,6 +881,17 @@ acceptgenhints(struct transit *tr){
       th->ethresh);
     return -1;
   }
+  if (th->sthresh < 0){
+    tr_output(TOUT_ERROR,
+      "Super-line threshold (%.3e) cannot be negative.\n", th->sthresh);
+    return -1;
+  }
+  if (th->linechunk < 0){
+    tr_output(TOUT_ERROR,
+      "Number of lines per chunk (%li) cannot be negative.\n",
+      th->linechunk);
+    return -1;
+  }
 
   /* Pass atmospheric flags into transit struct:                            */
   transitacceptflag(tr->fl, th->fl, TRU_ATMBITS); /* See transit.h          */
@@ -750,6 +902,25 @@ acceptgenhints(struct transit *tr){
   /* Pass flag to place opacity grid in shared memory:                      */
   tr->opashare = th->opashare;
 
+  /* Pass flag to extend an existing opacity grid:                          */
+  tr->opaextend = th->opaextend;
+
+  /* Pass the opacity-grid engine:                                          */
+  tr->gridengine = th->gridengine;
+
+  /* Set the number of worker threads of this context (the parallel regions
+     take it in their num_threads clause, so that the contexts of a process
+     do not change each other's thread count):                              */
+  if (th->nthreads < 0){
+    tr_output(TOUT_ERROR,
+      "Number of threads (%d) cannot be negative.\n", th->nthreads);
+    return -1;
+  }
+  tr->nthreads = 1;
+#ifdef _OPENMP
+  tr->nthreads = th->nthreads > 0 ? th->nthreads : omp_get_max_threads();
+#endif
+
   /* Set interpolation function flag:                                       */
   switch(tr->fl & TRU_SAMPBITS){
   case TRU_SAMPLIN:
@@ -916,9 +1087,11 @@ freemem_hints(struct transithint *h){
   free(h->f_toomuch);
   free(h->f_outsample);
   free(h->f_molfile);
+  free(h->save.ext);
 
   /* Free other strings:                                                    */
   free(h->solname);
+  free(h->f_voigt);
   if (h->ncross){
     free(h->csfile[0]);
     free(h->csfile);
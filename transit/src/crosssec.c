@@ -14,8 +14,7 @@ readcs(struct transit *tr){
   PREC_CS **a,    /* Cross-section cross sections sample                    */
            *wn;   /* Cross-section sampled wavenumber array                 */
 
-  static struct cross st_cross;  /* Cross-section structure                 */
-  tr->ds.cross = &st_cross;
+  struct cross *cross = tr->ds.cross = &tr->st.cross; /* Cross sections     */
   /* Number of Cross-section files:                                         */
   int nfiles = tr->ds.cross->nfiles = tr->ds.th->ncross;
   long nt = 0, wa;        /* Number of temperature & wn samples in CSfile   */
@@ -34,15 +33,21 @@ readcs(struct transit *tr){
                                             "makeradsample", TRPI_MAKERAD);
 
   /* Allocate Transit extinction array (in cm-1):                           */
-  st_cross.e    = (PREC_CS **)calloc(tr->wns.n,            sizeof(PREC_CS *));
-  st_cross.e[0] = (PREC_CS  *)calloc(tr->wns.n*tr->rads.n, sizeof(PREC_CS));
+  cross->e    = (PREC_CS **)calloc(tr->wns.n,            sizeof(PREC_CS *));
+  cross->e[0] = (PREC_CS  *)calloc(tr->wns.n*tr->rads.n, sizeof(PREC_CS));
   for(j=1; j < tr->wns.n; j++)
-    st_cross.e[j] = st_cross.e[0] + j*tr->rads.n;
-  memset(st_cross.e[0], 0, tr->wns.n*tr->rads.n*sizeof(double));
+    cross->e[j] = cross->e[0] + j*tr->rads.n;
+  memset(cross->e[0], 0, tr->wns.n*tr->rads.n*sizeof(double));
+  /* Allocate the interpolation scratch array (reused by every interpcs()
+     call):                                                                 */
+  cross->et    = (PREC_CS **)calloc(tr->wns.n,            sizeof(PREC_CS *));
+  cross->et[0] = (PREC_CS  *)calloc(tr->wns.n*tr->rads.n, sizeof(PREC_CS));
+  for(j=1; j < tr->wns.n; j++)
+    cross->et[j] = cross->et[0] + j*tr->rads.n;
 
   /* Min and max allowed temperatures in CS files:                          */
-  st_cross.tmin =     0.0;
-  st_cross.tmax = 70000.0;
+  cross->tmin =     0.0;
+  cross->tmax = 70000.0;
 
   /* If there are no files, allocate tr.ds.cross.e (extinction) and return: */
   if(!nfiles){
@@ -55,19 +60,19 @@ readcs(struct transit *tr){
   colname = (char *)calloc(maxline, sizeof(char));
 
   /* Allocate species' ID array:                                            */
-  st_cross.mol    = (int **)calloc(nfiles, sizeof(int *));
-  st_cross.mol[0] = (int  *)calloc(nfiles*2, sizeof(int));
+  cross->mol    = (int **)calloc(nfiles, sizeof(int *));
+  cross->mol[0] = (int  *)calloc(nfiles*2, sizeof(int));
   for(i=1; i < nfiles; i++)
-    st_cross.mol[i] = st_cross.mol[0] + i*2;
+    cross->mol[i] = cross->mol[0] + i*2;
 
   /* Number of temperature and wavenumber samples per file:                 */
-  st_cross.ntemp = (int  *)calloc(nfiles, sizeof(int));
-  st_cross.nwave = (int  *)calloc(nfiles, sizeof(int));
-  st_cross.nspec = (int  *)calloc(nfiles, sizeof(int));
+  cross->ntemp = (int  *)calloc(nfiles, sizeof(int));
+  cross->nwave = (int  *)calloc(nfiles, sizeof(int));
+  cross->nspec = (int  *)calloc(nfiles, sizeof(int));
   /* Temperature and wavenumber samples:                                    */
-  st_cross.cs   = (PREC_CS ***)calloc(nfiles, sizeof(PREC_CS **));
-  st_cross.temp = (PREC_CS  **)calloc(nfiles, sizeof(PREC_CS  *));
-  st_cross.wn   = (PREC_CS  **)calloc(nfiles, sizeof(PREC_CS  *));
+  cross->cs   = (PREC_CS ***)calloc(nfiles, sizeof(PREC_CS **));
+  cross->temp = (PREC_CS  **)calloc(nfiles, sizeof(PREC_CS  *));
+  cross->wn   = (PREC_CS  **)calloc(nfiles, sizeof(PREC_CS  *));
 
   for (j=0; j < nfiles; j++){
     /* Copy file names from hint:                                           */
@@ -99,7 +104,7 @@ readcs(struct transit *tr){
       case 'i': /* Read the name of the isotopes:                           */
         while(isblank(*++lp));
         /* Count the number of species:                                     */
-        nspec = st_cross.nspec[j] = countfields(lp, ' ');
+        nspec = cross->nspec[j] = countfields(lp, ' ');
         if (nspec != 1 && nspec != 2) {
           tr_output(TOUT_ERROR,
             "Wrong header in cross section file '%s', The 'i'-line "
@@ -114,9 +119,9 @@ readcs(struct transit *tr){
           /* Find the ID of the species:                                    */
           for(i=0; i<mol->nmol; i++)
             if(strcmp(mol->name[i], colname)==0)
-              st_cross.mol[j][k] = i;
+              cross->mol[j][k] = i;
           /* If the species is not in the atmosphere file:                  */
-          if(st_cross.mol[j][k] == -1) {
+          if(cross->mol[j][k] == -1) {
             tr_output(TOUT_ERROR,
               "Cross-section species '%s' from file '%s' does not match "
               "any in the atmsopheric file.\n", colname, file);
@@ -127,13 +132,13 @@ readcs(struct transit *tr){
 
         tr_output(TOUT_DEBUG, "  Cross-section species: ");
         for (k=0; k<nspec; k++)
-          tr_output(TOUT_DEBUG, "%s, ", mol->name[st_cross.mol[j][k]]);
+          tr_output(TOUT_DEBUG, "%s, ", mol->name[cross->mol[j][k]]);
         tr_output(TOUT_DEBUG, "\n");
         continue;
 
       case 't': /* Read the sampling temperatures array:                    */
         while(isblank(*++lp));
-        nt = st_cross.ntemp[j] = countfields(lp, ' ');  /* Number of temps. */
+        nt = cross->ntemp[j] = countfields(lp, ' ');   /* Number of temps.  */
         tr_output(TOUT_DEBUG, "  Number of temperature samples: %ld\n",
                                    nt);
         if(!nt) {
@@ -145,14 +150,14 @@ readcs(struct transit *tr){
         }
 
         /* Allocate and store the temperatures array:                       */
-        st_cross.temp[j] = (PREC_CS *)calloc(nt, sizeof(PREC_CS));
+        cross->temp[j] = (PREC_CS *)calloc(nt, sizeof(PREC_CS));
         n = 0;    /* Count temperatures per line                            */
         lpa = lp; /* Pointer in line                                        */
         tr_output(TOUT_DEBUG, "  Temperatures (K) = [");
         while(n < nt){
           while(isblank(*lpa++));
-          st_cross.temp[j][n] = strtod(--lpa, &lp);  /* Get value           */
-          tr_output(TOUT_DEBUG, "%d, ", (int)st_cross.temp[j][n]);
+          cross->temp[j][n] = strtod(--lpa, &lp);   /* Get value            */
+          tr_output(TOUT_DEBUG, "%d, ", (int)cross->temp[j][n]);
           if(lp==lpa) {
             tr_output(TOUT_ERROR,
               "Less fields (%i) than expected (%i) were read for "
@@ -172,8 +177,8 @@ readcs(struct transit *tr){
       break;
     }
     /* Set tmin and tmax:                                                   */
-    st_cross.tmin = fmax(st_cross.tmin, st_cross.temp[j][  0]);
-    st_cross.tmax = fmin(st_cross.tmax, st_cross.temp[j][n-1]);
+    cross->tmin = fmax(cross->tmin, cross->temp[j][  0]);
+    cross->tmax = fmin(cross->tmax, cross->temp[j][n-1]);
 
     /* Set an initial value for allocated wavenumber fields:                */
     wa = 32;
@@ -234,7 +239,7 @@ readcs(struct transit *tr){
 
     /* Re-allocate arrays to their final sizes:                             */
     if(n<wa){
-      st_cross.wn[j] = (PREC_CS  *)realloc(wn,   n*   sizeof(PREC_CS));
+      cross->wn[j] = (PREC_CS  *)realloc(wn,   n*   sizeof(PREC_CS));
       a              = (PREC_CS **)realloc(a,    n*   sizeof(PREC_CS *));
       a[0]           = (PREC_CS  *)realloc(a[0], n*nt*sizeof(PREC_CS));
       for(i=1; i<n; i++)
@@ -243,22 +248,22 @@ readcs(struct transit *tr){
     tr_output(TOUT_DEBUG, "  Number of wavenumber samples: %d\n", n);
     tr_output(TOUT_DEBUG, "  Wavenumber array (cm-1) = [%.1f, %.1f, "
       "%.1f, ..., %.1f, %.1f, %.1f]\n",
-      st_cross.wn[j][  0], st_cross.wn[j][  1],
-      st_cross.wn[j][  2], st_cross.wn[j][n-3],
-      st_cross.wn[j][n-2], st_cross.wn[j][n-1]);
+      cross->wn[j][  0], cross->wn[j][  1],
+      cross->wn[j][  2], cross->wn[j][n-3],
+      cross->wn[j][n-2], cross->wn[j][n-1]);
 
     /* Wavenumber boundaries check:                                         */
-    if ((st_cross.wn[j][  0] > tr->wns.v[          0]) ||
-        (st_cross.wn[j][n-1] < tr->wns.v[tr->wns.n-1]) ){
+    if ((cross->wn[j][  0] > tr->wns.v[          0]) ||
+        (cross->wn[j][n-1] < tr->wns.v[tr->wns.n-1]) ){
       tr_output(TOUT_ERROR,
         "The wavelength range [%.2f, %.2f] cm-1 of the cross-section "
         "file:\n  '%s',\ndoes not cover Transit's wavelength range "
-        "[%.2f, %.2f] cm-1.\n", file, st_cross.wn[j][0], st_cross.wn[j][n-1],
+        "[%.2f, %.2f] cm-1.\n", file, cross->wn[j][0], cross->wn[j][n-1],
         tr->wns.v[0], tr->wns.v[tr->wns.n-1]);
       exit(EXIT_FAILURE);
     }
-    st_cross.cs[j] = a;
-    st_cross.nwave[j] = n;
+    cross->cs[j] = a;
+    cross->nwave[j] = n;
     fclose(fp);
   }
   free(colname);
@@ -273,7 +278,7 @@ interpcs(struct transit *tr){
   struct molecules *mol=tr->ds.mol;
   struct cross     *cross=tr->ds.cross;
   prop_atm *atm = &tr->atm;
-  PREC_CS **e;  /* Temporary interpolated cia                               */
+  PREC_CS **e = cross->et;  /* Temporary interpolated cia                   */
   double *tmpw = malloc(tr->wns.n  * sizeof(double)); /* Temperatures array */
   double *tmpt = malloc(tr->rads.n * sizeof(double)); /* Wavenumber array   */
   double dens;  /* Density scaling factor                                   */
@@ -283,11 +288,8 @@ interpcs(struct transit *tr){
   /* Reset the cross-section opacity to zero:                               */
   memset(cross->e[0], 0, tr->wns.n*tr->rads.n*sizeof(double));
 
-  /* Allocate temporary array for opacity:                                  */
-  e    = (PREC_CS **)calloc(tr->wns.n,            sizeof(PREC_CS *));
-  e[0] = (PREC_CS  *)calloc(tr->wns.n*tr->rads.n, sizeof(PREC_CS));
-  for(i=1; i < tr->wns.n; i++)
-    e[i] = e[0] + i*tr->rads.n;
+  /* Reset the temporary array for opacity:                                 */
+  memset(e[0], 0, tr->wns.n*tr->rads.n*sizeof(PREC_CS));
 
   /* Get transit temperatures and wavenumber arrays:                        */
   for(i=0; i<tr->rads.n; i++){
@@ -329,8 +331,6 @@ interpcs(struct transit *tr){
       }
     }
   }
-  free(e[0]);
-  free(e);
   free(tmpw);
   free(tmpt);
 
@@ -445,6 +445,8 @@ freemem_cs(struct cross *cross,
   int i=0;
   free(cross->e[0]);
   free(cross->e);
+  free(cross->et[0]);
+  free(cross->et);
   for (i=0; i<cross->nfiles; i++){
     free(cross->cs[i][0]);
     free(cross->cs[i]);
@@ -12,9 +12,6 @@
                    implemented intensity grid and flux                     */
 
 
-/* Defines static variables                                                 */
-static PREC_RES *area_grid;
-
 /* #########################################################
     CALCULATES OPTICAL DEPTH AT VARIOUS POINTS ON THE PLANET
    ######################################################### */
@@ -171,8 +168,7 @@ eclipse_intens(struct transit *tr,  /* Transit structure                    */
 /* DEF */
 int
 emergent_intens(struct transit *tr){  /* Transit structure                  */
-  static struct outputray st_out;     /* Output structure                   */
-  tr->ds.out = &st_out;
+  tr->ds.out = &tr->st.intout;        /* Output structure                   */
 
   /* Initial variables:                                                     */
   long w;
@@ -241,8 +237,7 @@ emergent_intens(struct transit *tr){  /* Transit structure                  */
    Returns: zero on success                                                 */
 int
 flux(struct transit *tr){  /* Transit structure                             */
-  static struct outputray st_out;
-  tr->ds.out = &st_out;
+  tr->ds.out = &tr->st.out;
 
   /* Get angles and number of angles from transithint:                      */
   PREC_RES *angles = tr->angles;      /* Angles                             */
@@ -252,8 +247,9 @@ flux(struct transit *tr){  /* Transit structure                             */
   PREC_RES **intens_grid = tr->ds.intens->a;
 
   long int i, w;  /* for-loop indices                                       */
-  PREC_RES area,  /* Projected area                                         */
-           *out;  /* Output flux array (per wavenumber)                     */
+  PREC_RES area,       /* Projected area                                    */
+           *area_grid, /* Limits of the projected areas (radians)           */
+           *out;       /* Output flux array (per wavenumber)                */
 
   prop_samp *wn  = &tr->wns; /* Wavenumber sample                           */
   long int wnn = wn->n;      /* Number of wavenumbers                       */
@@ -268,8 +264,13 @@ flux(struct transit *tr){  /* Transit structure                             */
   for(i = 1; i < an; i++)
     area_grid[i] = (angles[i-1] + angles[i]) * DEGREES / 2.0;
 
-  /* Allocates array for the emergent flux:                                 */
-  out = st_out.o = (PREC_RES *)calloc(wnn, sizeof(PREC_RES));
+  /* Allocates array for the emergent flux (or reset the one kept from the
+     previous run):                                                         */
+  if (tr->ds.out->o == NULL)
+    tr->ds.out->o = (PREC_RES *)calloc(wnn, sizeof(PREC_RES));
+  else
+    memset(tr->ds.out->o, 0, wnn*sizeof(PREC_RES));
+  out = tr->ds.out->o;
 
   /* Add weighted Intensity to get the flux:                                */
   for(i = 0; i < an; i++){
@@ -279,7 +280,7 @@ flux(struct transit *tr){  /* Transit structure                             */
   }
 
   /* Free memory that is no longer needed                                   */
-  freemem_localeclipse();
+  free(area_grid);
 
   /* prints output                                                          */
   printflux(tr);
@@ -380,15 +381,6 @@ printflux(struct transit *tr){
 }
 
 
-/* \fcnfh
-   Frees eclipse pointer arrays. Data array should already be free          */
-void
-freemem_localeclipse(){
-  /* Free auxiliar variables:                                               */
-  free(area_grid);
-}
-
-
 /* \fcnfh
    Free intensity grid structure arrays
    Return 0 on success                                                      */
@@ -399,6 +391,7 @@ freemem_intensityGrid(struct grid *intens,   /* grid structure              */
   /* Free arrays:                                                           */
   free(intens->a[0]);
   free(intens->a);
+  intens->a = NULL;
 
   /* Update indicator and return:                                           */
   *pi &= ~(TRPI_GRID);
@@ -3,20 +3,19 @@
 
 #include <transit.h>
 
-/* FUNCTION: Wrapper to calculate a Voigt profile
-   Return: 1/2 of the number of points in the profile                       */
+/* FUNCTION: Number of points of the Voigt profile of the given widths
+   (see getprofile()), without evaluating it.
+   Return: number of points in the profile                                  */
 int
-getprofile(PREC_VOIGT **pr,  /* Pointer to 1D profile                       */
-           PREC_RES dwn,     /* wavenumber spacing                          */
-           PREC_VOIGT dop,   /* Doppler width                               */
-           PREC_VOIGT lor,   /* Lorentz width                               */
-           float ta,         /* times of alpha                              */
-           int nwave){       /* Maximum half-size of profile                */
+profilesize(PREC_RES dwn,     /* wavenumber spacing                         */
+            PREC_VOIGT dop,   /* Doppler width                              */
+            PREC_VOIGT lor,   /* Lorentz width                              */
+            float ta,         /* times of alpha                             */
+            int nwave){       /* Maximum half-size of profile               */
 
   PREC_VOIGTP bigalpha, /* Largest width (Doppler or Lorentz)               */
               wvgt;     /* Calculated half-width of profile                 */
-  int nvgt,             /* Number of points in profile                      */
-      j;                /* Auxiliary index                                  */
+  int nvgt;             /* Number of points in profile                      */
 
   /* Get the largest width (alpha Doppler or Lorentz):                      */
   bigalpha = dop;
@@ -33,6 +32,23 @@ getprofile(PREC_VOIGT **pr,  /* Pointer to 1D profile                       */
   /* Profile does not need to be larger than the wavenumber range:          */
   if (nvgt > 2*nwave)
     nvgt = 2*nwave + 1;
+  return nvgt;
+}
+
+
+/* FUNCTION: Wrapper to calculate a Voigt profile
+   Return: 1/2 of the number of points in the profile                       */
+int
+getprofile(PREC_VOIGT **pr,  /* Pointer to 1D profile                       */
+           PREC_RES dwn,     /* wavenumber spacing                          */
+           PREC_VOIGT dop,   /* Doppler width                               */
+           PREC_VOIGT lor,   /* Lorentz width                               */
+           float ta,         /* times of alpha                              */
+           int nwave,        /* Maximum half-size of profile                */
+           int flags){       /* voigtn() evaluation flags                   */
+
+  int nvgt = profilesize(dwn, dop, lor, ta, nwave), /* Number of points     */
+      j;                                            /* Auxiliary index      */
 
   /* Basic check that 'lor' or 'dop' are within sense:                      */
   if(nvgt < 0) {
@@ -48,7 +64,7 @@ getprofile(PREC_VOIGT **pr,  /* Pointer to 1D profile                       */
   /* Calculate voigt using a width that gives an integer number of 'dwn'
      spaced bins:                                                           */
   if((j=voigtn(nvgt, dwn*(long)(nvgt/2), lor, dop, pr, -1,
-               nvgt > _voigt_maxelements ? VOIGT_QUICK:0)) != 1) {
+               flags | (nvgt > _voigt_maxelements ? VOIGT_QUICK:0))) != 1) {
     tr_output(TOUT_ERROR, "voigtn2() returned error code %i.\n", j);
     exit(EXIT_FAILURE);
   }
@@ -57,6 +73,219 @@ getprofile(PREC_VOIGT **pr,  /* Pointer to 1D profile                       */
 }
 
 
+/* FUNCTION: Get the Voigt profile of the Doppler-width index i and the
+   Lorentz-width index j of the profile grid, evaluating it on its first
+   use.  The profile is symmetric, thus only the half from the line center
+   outwards is stored (the average of both halves of getprofile()).  The
+   profiles with a Doppler width much smaller than the Lorentz width are
+   that of the first Doppler width.  Safe to call from several threads,
+   each profile is evaluated once.
+   Return: pointer to the half profile [profsize+1]                         */
+PREC_VOIGT *
+voigtprofile(struct transit *tr,  /* transit struct                         */
+             int i,               /* Doppler-width index                    */
+             int j){              /* Lorentz-width index                    */
+  struct opacity *op = tr->ds.op;
+  PREC_VOIGT *pr, *full;
+  PREC_NREC n, ps, d;
+
+  if (i != 0 && op->aDop[i]*10.0 < op->aLor[j])
+    i = 0;
+  /* Stamp the profile with the current period of use (see
+     trimprofiles()), writing only once per period:                         */
+  n = i*op->nLor + j;
+  if (__atomic_load_n(op->profuse+n, __ATOMIC_RELAXED) != op->profclock)
+    __atomic_store_n(op->profuse+n, op->profclock, __ATOMIC_RELAXED);
+
+  pr = __atomic_load_n(&op->profile[i][j], __ATOMIC_ACQUIRE);
+  if (pr != NULL)
+    return pr;
+
+  #pragma omp critical (voigtprofile)
+  {
+    pr = op->profile[i][j];
+    if (pr == NULL){
+      ps = getprofile(&full, tr->wns.d/tr->owns.o, op->aDop[i], op->aLor[j],
+                      tr->timesalpha, tr->owns.n, tr->voigtflags);
+      pr = (PREC_VOIGT *)malloc((ps+1) * sizeof(PREC_VOIGT));
+      if (pr == NULL){
+        tr_output(TOUT_ERROR, "Allocation fail.\n");
+        exit(EXIT_FAILURE);
+      }
+      pr[0] = full[ps];
+      for (d=1; d<=ps; d++)
+        pr[d] = 0.5 * (full[ps-d] + full[ps+d]);
+      free(full);
+      op->profmem += (ps+1) * sizeof(PREC_VOIGT);
+      __atomic_store_n(&op->profile[i][j], pr, __ATOMIC_RELEASE);
+    }
+  }
+  return pr;
+}
+
+
+/* FUNCTION: Free the least recently used Voigt profiles until the
+   profiles fit in the memory budget (if any), and start a new period of
+   use.  Call it only where no other thread holds a profile.  The profiles
+   of a mapped profile cache take no memory of their own.                   */
+void
+trimprofiles(struct opacity *op){  /* Opacity struct                        */
+  PREC_NREC n, lru;
+  PREC_VOIGT **profile = op->profile[0];
+
+  while (op->vpcaddr == NULL &&
+         op->profbudget > 0 && op->profmem > op->profbudget){
+    lru = -1;
+    for (n=0; n < op->nDop*op->nLor; n++)
+      if (profile[n] != NULL &&
+          (lru < 0 || op->profuse[n] < op->profuse[lru]))
+        lru = n;
+    op->profmem -= (op->profsize[0][lru]+1) * sizeof(PREC_VOIGT);
+    free(profile[lru]);
+    profile[lru] = NULL;
+  }
+  op->profclock++;
+}
+
+
+/* FUNCTION: Index of the sample closest to the width w, out of n
+   log-uniform width samples a (a[k] = 10**(lmin + k*dl), see logspace()).
+   A log10() gives the interval of w, and comparisons to the samples
+   correct its rounding, thus the result equals that of
+   binsearchapprox(a, w, 0, n), except that widths beyond the last sample
+   take the last one.
+   Return: index of the closest sample                                      */
+static inline int
+widthindex(double *a,   /* Width samples                                    */
+           int n,       /* Number of samples                                */
+           double lmin, /* log10 of the first sample                        */
+           double dl,   /* log10 spacing of the samples                     */
+           double w){   /* Width                                            */
+  int k;
+
+  if (n < 2 || !(w > a[0]))
+    return 0;
+  if (w >= a[n-1])
+    return n-1;
+  /* Interval of w, a[k] <= w < a[k+1]:                                     */
+  k = (log10(w) - lmin)/dl;
+  if (k < 0)
+    k = 0;
+  if (k > n-2)
+    k = n-2;
+  if (a[k] > w)
+    k--;
+  else if (a[k+1] <= w)
+    k++;
+  /* Closest sample:                                                        */
+  if (fabs(a[k+1]-w) < fabs(a[k]-w))
+    return k+1;
+  return k;
+}
+
+
+/* Index of the closest Doppler and Lorentz-width samples of a width:       */
+static inline int
+dopindex(struct opacity *op, double w){
+  return widthindex(op->aDop, op->nDop, op->lDop, op->dlDop, w);
+}
+
+static inline int
+lorindex(struct opacity *op, double w){
+  return widthindex(op->aLor, op->nLor, op->lLor, op->dlLor, w);
+}
+
+
+/* FUNCTION: Compute the Doppler and Lorentz widths of each isotope, and
+   their Voigt-profile indices, at every (layer, temperature) cell of the
+   opacity grid.  Both opacity engines take them from these tables (see
+   computemolext() and gridmolext()), rather than recomputing them for
+   each cell.
+   Return: 0 on success                                                     */
+int
+gridwidths(struct transit *tr){ /* transit struct                           */
+  struct opacity   *op =tr->ds.op;
+  struct isotopes  *iso=tr->ds.iso;
+  struct molecules *mol=tr->ds.mol;
+
+  long Ntemp = op->Ntemp,
+       ncell = op->Nlayer*Ntemp,
+       c;
+  int niso = iso->n_i,  /* Number of isotopes in atmosphere                 */
+      nmol = mol->nmol, /* Number of species in atmosphere                  */
+      i, j, r, t;
+  double fdoppler, florentz, csdiameter, *alphal, *alphad;
+  PREC_ATM density;
+
+  alphal = op->alphal = (double *)calloc(ncell*niso, sizeof(double));
+  alphad = op->alphad = (double *)calloc(Ntemp*niso, sizeof(double));
+  op->idop = (int *)calloc(ncell*niso, sizeof(int));
+  op->ilor = (int *)calloc(ncell*niso, sizeof(int));
+  if (!alphal || !alphad || !op->idop || !op->ilor){
+    tr_output(TOUT_ERROR, "Allocation fail.\n");
+    return -1;
+  }
+
+  /* Doppler widths, they only depend on the temperature:                   */
+  for (t=0; t<Ntemp; t++){
+    fdoppler = sqrt(2*KB*op->temp[t]/AMU) * SQRTLN2 / LS;
+    for (i=0; i<niso; i++)
+      alphad[t*niso+i] = fdoppler / sqrt(iso->isof[i].m);
+  }
+
+  /* Lorentz widths and profile indices of each cell and isotope:           */
+  #pragma omp parallel for num_threads(tr->nthreads)                     \
+          private(r, t, i, j, florentz, csdiameter, density)
+  for (c=0; c<ncell; c++){
+    r = c / Ntemp;
+    t = c % Ntemp;
+    florentz = sqrt(2*KB*op->temp[t]/PI/AMU) / (AMU*LS);
+    for (i=0; i<niso; i++){
+      alphal[c*niso+i] = 0.0;
+      for (j=0; j<nmol; j++){
+        density = stateeqnford(tr->ds.at->mass, op->q[j*op->Nlayer+r],
+                               op->mm[r], mol->mass[j],
+                               op->press[r], op->temp[t]);
+        csdiameter = (mol->radius[j] + mol->radius[iso->imol[i]]);
+        alphal[c*niso+i] += density/mol->mass[j] * csdiameter * csdiameter *
+                            sqrt(1/iso->isof[i].m + 1/mol->mass[j]);
+      }
+      alphal[c*niso+i] *= florentz;
+      op->idop[c*niso+i] = dopindex(op, alphad[t*niso+i]*tr->wns.v[0]);
+      op->ilor[c*niso+i] = lorindex(op, alphal[c*niso+i]);
+    }
+  }
+  return 0;
+}
+
+
+/* FUNCTION: Largest profile half-width that a line may have in any cell
+   of the opacity grid, as computemolext() bounds it for a cell (see the
+   tables of gridwidths()).
+   Return: half-width (cm-1)                                                */
+double
+gridhalfwidth(struct transit *tr){ /* transit struct                        */
+  struct opacity *op=tr->ds.op;
+  long ncell = op->Nlayer*op->Ntemp,
+       c, n;
+  int niso = tr->ds.iso->n_i,
+      i, j;
+  PREC_RES odwn = tr->owns.d/tr->owns.o; /* Oversampling interval           */
+  double hwmax = 0.0;
+
+  for (c=0; c<ncell; c++)
+    for (i=0; i<niso; i++){
+      n = c*niso + i;
+      j = dopindex(op, op->alphad[(c % op->Ntemp)*niso + i] *
+                       tr->owns.v[tr->owns.n-1]);
+      hwmax = fmax(hwmax, (fmax(op->profsize[op->idop[n]][op->ilor[n]],
+                                op->profsize[j]          [op->ilor[n]]) +
+                           tr->owns.o) * odwn);
+    }
+  return hwmax;
+}
+
+
 /* FUNCTION:
    Saving extinction for a possible next run                                */
 void
@@ -145,9 +374,7 @@ restfile_extinct(char *filename,
 int
 extwn(struct transit *tr){
   struct transithint *th=tr->ds.th;
-  static struct extinction st_ex;
-  tr->ds.ex = &st_ex;
-  struct extinction *ex = &st_ex;
+  struct extinction *ex = tr->ds.ex = &tr->st.ex;
   int i;
 
   /* Check these routines have been called:                                 */
@@ -189,20 +416,27 @@ extwn(struct transit *tr){
   /* Get the extinction coefficient threshold:                              */
   ex->ethresh = th->ethresh;
 
-  /* Declare extinction-coefficient array:                                  */
-  ex->e        = (PREC_RES **)calloc(nrad,     sizeof(PREC_RES *));
-  if((ex->e[0] = (PREC_RES  *)calloc(nrad*nwn, sizeof(PREC_RES)))==NULL) {
-    tr_output(TOUT_ERROR, "Unable to allocate %li = %li*%li "
-      "for the extinction coefficient.\n", nrad*nwn, nrad, nwn);
-    exit(EXIT_FAILURE);
-  }
+  /* Declare extinction-coefficient array, or reset the one kept from the
+     previous run:                                                          */
+  if (ex->e == NULL){
+    ex->e        = (PREC_RES **)calloc(nrad,     sizeof(PREC_RES *));
+    if((ex->e[0] = (PREC_RES  *)calloc(nrad*nwn, sizeof(PREC_RES)))==NULL) {
+      tr_output(TOUT_ERROR, "Unable to allocate %li = %li*%li "
+        "for the extinction coefficient.\n", nrad*nwn, nrad, nwn);
+      exit(EXIT_FAILURE);
+    }
 
-  for(i=1; i<nrad; i++){
-    ex->e[i] = ex->e[0] + i*nwn;
-  }
+    for(i=1; i<nrad; i++){
+      ex->e[i] = ex->e[0] + i*nwn;
+    }
 
-  /* Has the extinction been computed at given radius boolean:              */
-  ex->computed = (_Bool *)calloc(nrad, sizeof(_Bool));
+    /* Has the extinction been computed at given radius boolean:            */
+    ex->computed = (_Bool *)calloc(nrad, sizeof(_Bool));
+  }
+  else{
+    memset(ex->e[0],     0, nrad*nwn*sizeof(PREC_RES));
+    memset(ex->computed, 0, nrad*sizeof(_Bool));
+  }
 
   /* Set progress indicator, and print and output extinction if one P,T
      was desired, otherwise return success:                                 */
@@ -221,6 +455,7 @@ freemem_extinction(struct extinction *ex, /* Extinciton struct       */
   free(ex->e[0]);
   free(ex->e);
   free(ex->computed);
+  ex->e = NULL;
 
   /* Update indicator and return: */
   *pi &= ~(TRPI_EXTWN);
@@ -275,42 +510,254 @@ restextinct(FILE *in,
 }
 
 
+/* Number of dynamic-sampling values of a computemolext() tile (that of a
+   species fits in the L2 cache):                                           */
+#define EXT_TILE 8192
+
+/* FUNCTION: Allocate the scratch buffers used by computemolext().
+   Each thread calling computemolext() concurrently needs its own set.
+   Return: 0 on success                                                     */
+int
+alloc_extwork(struct transit *tr,  /* transit struct                        */
+              struct extwork *ew,  /* Scratch buffers                       */
+              int permol){         /* Extinction per molecule flag          */
+  int niso = tr->ds.iso->n_i, /* Number of isotopes                         */
+      i;
+
+  /* Number of species in the output array:                                 */
+  ew->nmol = permol ? tr->ds.op->Nmol : 1;
+
+  ew->alphal = (PREC_VOIGTP *)calloc(niso, sizeof(PREC_VOIGTP));
+  ew->alphad = (PREC_VOIGTP *)calloc(niso, sizeof(PREC_VOIGTP));
+  ew->idop   = (int         *)calloc(niso, sizeof(int));
+  ew->ilor   = (int         *)calloc(niso, sizeof(int));
+  ew->ilev   = (int         *)calloc(niso, sizeof(int));
+  ew->lof    = (int         *)calloc(niso, sizeof(int));
+  ew->lpos   = (long        *)calloc(niso, sizeof(long));
+  ew->kmax   = (double      *)calloc(ew->nmol, sizeof(double));
+  ew->kmin   = (double      *)calloc(ew->nmol, sizeof(double));
+  /* Not an opacity-grid cell, unless the caller says so, and every species
+     over the whole output array:                                           */
+  ew->cell    = -1;
+  ew->k0      = 0;
+  ew->k1      = -1;
+  ew->molmask = NULL;
+
+  /* One set of tiles per thread of computemolext(), unless it is called
+     from a parallel region.  A tile holds the dynamic-sampling values of
+     up to EXT_TILE/scale output values (at least one), plus the edges of
+     the downsampling kernel (scale <= owns.o).  computemolext() enlarges
+     the tiles when it samples the lines at more than one level:            */
+  ew->nthr = 1;
+#ifdef _OPENMP
+  if (!omp_in_parallel())
+    ew->nthr = tr->nthreads;
+#endif
+  ew->ntile = EXT_TILE + 2*tr->owns.o + 1;
+  ew->ktmp    = (double **)malloc(ew->nthr*ew->nmol * sizeof(double *));
+  ew->ktmp[0] = (double  *)calloc(ew->nthr*ew->nmol*ew->ntile,
+                                  sizeof(double));
+  for (i=1; i < ew->nthr*ew->nmol; i++)
+    ew->ktmp[i] = ew->ktmp[0] + ew->ntile * i;
+
+  if (!ew->ktmp[0]){
+    tr_output(TOUT_ERROR, "Allocation fail.\n");
+    return -1;
+  }
+  /* Cursor over the line store:                                            */
+  return alloc_linecursor(tr, &ew->lc);
+}
+
+
+/* FUNCTION: Free the scratch buffers of computemolext().
+   Return: 0 on success                                                     */
+int
+freemem_extwork(struct extwork *ew){
+  free(ew->ktmp[0]);
+  free(ew->ktmp);
+  free(ew->alphal);
+  free(ew->alphad);
+  free(ew->idop);
+  free(ew->ilor);
+  free(ew->ilev);
+  free(ew->lof);
+  free(ew->lpos);
+  free(ew->kmax);
+  free(ew->kmin);
+  freemem_linecursor(&ew->lc);
+  return 0;
+}
+
+
+/* FUNCTION: Index range [*l0, *l1) of the lines of the isotope run r of
+   the line store with wavenumbers in [lo, hi].  The wavenumbers decrease
+   within a run.                                                            */
+static void
+linewindow(struct line_transition *lt, /* Line store                        */
+           int r,                      /* Run index                         */
+           double lo, double hi,       /* Wavenumber range (cm-1)           */
+           PREC_NREC *l0, PREC_NREC *l1){
+  PREC_NREC a, b, c;
+
+  /* First line with wn <= hi:                                              */
+  a = lt->rfirst[r];
+  b = lt->rfirst[r+1];
+  while (a < b){
+    c = (a+b)/2;
+    if (lt->wn[c] > hi)
+      a = c + 1;
+    else
+      b = c;
+  }
+  *l0 = a;
+  /* First line with wn < lo:                                               */
+  b = lt->rfirst[r+1];
+  while (a < b){
+    c = (a+b)/2;
+    if (lt->wn[c] >= lo)
+      a = c + 1;
+    else
+      b = c;
+  }
+  *l1 = a;
+}
+
+
+/* FUNCTION: Add a line of strength s, centered at the oversampled index
+   iown (closest dynamic-sampling index idwn, not larger), to the dynamic
+   samples [j0, j1), sampled every ofactor oversampled values, of the tile
+   k (k[0] holds the sample j0).  prof is the line's oversampled half
+   profile (see voigtprofile()), of half-size psize.                        */
+static inline void
+addline(double *k,         /* Dynamic-sampling extinction                   */
+        PREC_VOIGT *prof,  /* Oversampled profile                           */
+        PREC_NREC psize,   /* Profile half-size                             */
+        double s,          /* Line strength                                 */
+        long iown,         /* Oversampled index of the line center          */
+        long idwn,         /* Dynamic-sampling index of the line center     */
+        int ofactor,       /* Dynamic-sampling oversampling factor          */
+        long j0, long j1){ /* Dynamic-sampling index range                  */
+  /* Sub-sampling offset between center of line and dyn-sampled wn:         */
+  long subw = iown - idwn*ofactor;
+  /* Range that contributes to the opacity:                                 */
+  long minj = idwn - (psize - subw) / ofactor,
+       maxj = idwn + (psize + subw) / ofactor,
+       j, d;
+  if (minj < j0)
+    minj = j0;
+  if (maxj > j1)
+    maxj = j1;
+
+  /* Oversampled distance from the line center to the sample minj, the
+     samples below the center read the half profile backwards:              */
+  d = ofactor*minj - iown;
+  k -= j0;
+  for (j=minj; j<maxj && d<0; j++, d+=ofactor)
+    k[j] += s * prof[-d];
+  for (; j<maxj; j++, d+=ofactor)
+    k[j] += s * prof[d];
+}
+
+
+/* FUNCTION: Downsample into the output values [k0, k1) of out the tile of
+   dynamic-sampling values tile (tile[0] holds the value j0), as
+   downsample() does for the whole array of n values, and add them to out.  */
+static void
+downsampletile(double *tile,      /* Dynamic-sampling values                */
+               long j0,           /* Index of the first value of the tile   */
+               PREC_RES *out,     /* Output array                           */
+               long n,            /* Number of dynamic-sampling values      */
+               int scale,         /* Downsampling factor                    */
+               long k0, long k1){ /* Output index range                     */
+  long m = 1 + (n-1)/scale, /* Number of output values                      */
+       h = scale/2,         /* Downsampling-kernel half size                */
+       j, k;
+  int even = (scale % 2 == 0);
+  double sum;
+
+  for (k=k0; k<k1; k++){
+    sum = 0.0;
+    /* First and last points (averaged over half a kernel):                 */
+    if (k == 0){
+      for (j=0; j<h+1; j++)
+        sum += tile[j-j0];
+      if (even)
+        sum -= 0.5*tile[h-j0];
+      sum /= 0.5*(scale+1);
+    }
+    else if (k == m-1){
+      for (j=n-1-h; j<n; j++)
+        sum += tile[j-j0];
+      if (even)
+        sum -= 0.5*tile[n-h-j0];
+      sum /= 0.5*(scale+1);
+    }
+    else{
+      for (j=scale*k-h; j<scale*k+h+1; j++)
+        sum += tile[j-j0];
+      if (even)
+        sum -= 0.5*(tile[scale*k-h-j0] + tile[scale*k+h-j0]);
+      sum /= scale;
+    }
+    out[k] += sum;
+  }
+}
+
+
+/* FUNCTION: Set in [*j0, *j1) the range of the n dynamic-sampling values,
+   downsampled by the factor scale into nk output values, under the
+   downsampling kernels of the output values [k0, k1) (see downsample()).   */
+static inline void
+kernelrange(long k0, long k1, /* Output index range                         */
+            long nk,          /* Number of output values                    */
+            long n,           /* Number of dynamic-sampling values          */
+            int scale,        /* Downsampling factor                        */
+            long *j0, long *j1){
+  *j0 = (k0 == 0)  ? 0 : scale*k0 - scale/2;
+  *j1 = (k1 == nk) ? n : scale*(k1-1) + scale/2 + 1;
+}
+
+
 /* FUNCTION: Compute the molecular extinction.
    Store results in kiso.  If permol is true, calculate extinction per
-   molecule separately; else, collapse all extinction into kiso[0].         */
+   molecule separately; else, collapse all extinction into kiso[0].
+   ew holds the scratch buffers (see alloc_extwork()), it may be NULL, in
+   which case they are allocated for this call only.  ew may also restrict
+   the output to a wavenumber-index range and (per molecule) to some of the
+   species, leaving the rest of kiso untouched.                             */
 int
 computemolext(struct transit *tr, /* transit struct                         */
               PREC_RES **kiso,    /* Extinction coefficient array [mol][wn] */
               PREC_ATM temp,      /* Temperature                            */
               PREC_ATM *density,  /* Density per species                    */
               double *Z,          /* Partition Function per isotope         */
-              int permol){        /* Calculate the extinction per molecule  */
+              int permol,         /* Calculate the extinction per molecule  */
+              struct extwork *ew){ /* Scratch buffers                       */
 
   /* Transit structures:                                                    */
   struct opacity    *op =tr->ds.op;
   struct isotopes   *iso=tr->ds.iso;
   struct molecules  *mol=tr->ds.mol;
-  struct line_transition *lt=&(tr->ds.li->lt);
+  struct line_transition *lt;  /* Chunk of the line store                   */
 
-  PREC_NREC ln;
-  int i, m=0,
-      *idop, *ilor;
-  long j, maxj, minj, offset;
+  PREC_NREC ln, l0, l1, lend;
+  int i, r, l, m=0,
+      *idop, *ilor,
+      *ilev, *lof,
+      nlev=0;         /* Number of sampling levels                          */
+  long j,
+       *lpos,
+       ltile=0;       /* Length of a tile (all levels)                      */
 
   /* Voigt profile variables:                                               */
-  PREC_VOIGT ***profile=op->profile;  /* Voigt profile                      */
   PREC_NREC **profsize=op->profsize;  /* Voigt-profile half-size            */
-  double *aDop=op->aDop,          /* Doppler-width sample                   */
-         *aLor=op->aLor;          /* Lorentz-width sample                   */
-  int nDop=op->nDop,              /* Number of Doppler samples              */
-      nLor=op->nLor;              /* Number of Lorentz samples              */
 
-  PREC_NREC subw,
-            nlines=tr->ds.li->n_l; /* Number of line transitions            */
+  PREC_NREC nlines=tr->ds.li->n_l; /* Number of line transitions            */
   PREC_RES wavn, next_wn;
   double fdoppler, florentz, /* Doppler and Lorentz-broadening factors      */
          csdiameter;         /* Collision diameter                          */
-  double propto_k;
+  double propto_k,
+         smax, smin;         /* Line-strength extrema of an isotope run     */
   double *kmax, *kmin,       /* Maximum and minimum values of propto_k      */
          **ktmp;
 
@@ -321,68 +768,117 @@ computemolext(struct transit *tr, /* transit struct                         */
       Nmol;                   /* Number of species with line-transitions    */
 
   int iown, idwn;             /* Line-center indices                        */
+  int id;                     /* Doppler-width index of a line              */
 
   double maxwidth=0,   /* Maximum width between Lorentz and Doppler         */
          minwidth=1e5; /* Minimum width among isotopes in a Layer           */
 
-  int ofactor;  /* Dynamic oversampling factor                              */
-
-  long nadd  = 0, /* Number of co-added lines                               */
-       nskip = 0, /* Number of skipped lines                                */
-       neval = 0; /* Number of evaluated profiles                           */
+  int ofactor,  /* Dynamic oversampling factor                              */
+      minof=0;  /* Finest dynamic oversampling factor                       */
+  double hwmax=0;  /* Maximum profile half-width (cm-1)                     */
+
+  /* Number of threads computing the wavenumber tiles (one if the caller
+     already runs in parallel, e.g., calcopacity()), and number of tiles:   */
+  int nthr = 1,
+      ntiles, tile;
+  _Bool serial = 1;  /* Not called from a parallel region                   */
+#ifdef _OPENMP
+  serial = !omp_in_parallel();
+  if (serial)
+    nthr = tr->nthreads;
+#endif
+
+  long nadd   = 0, /* Number of co-added lines                              */
+       nskip  = 0, /* Number of skipped lines                               */
+       neval  = 0, /* Number of evaluated profiles                          */
+       nbin   = 0, /* Number of lines binned into super-lines               */
+       nsuper = 0; /* Number of evaluated super-line profiles               */
+  _Bool weak;      /* Line below the super-line threshold                   */
 
   /* Wavenumber array variables:                                            */
   PREC_RES  *wn = tr->wns.v;
   PREC_NREC onwn = tr->owns.n,
-            dnwn;
+            dnwn,
+            nk,    /* Number of output values                               */
+            kt,    /* Number of output values per tile                      */
+            kbeg, kend; /* Output index range to compute                    */
+  int scale;       /* Downsampling factor of the finest level               */
 
   /* Wavenumber sampling intervals:                                         */
   PREC_RES  dwn = tr->wns.d /tr->wns.o,   /* Output array                   */
-           odwn = tr->owns.d/tr->owns.o,  /* Oversampling array             */
-           ddwn;                          /* Dynamic sampling array         */
-
-  /* Allocate alpha Lorentz and Doppler arrays:                             */
-  alphal = (PREC_VOIGTP *)calloc(niso, sizeof(PREC_VOIGTP));
-  alphad = (PREC_VOIGTP *)calloc(niso, sizeof(PREC_VOIGTP));
-
-  /* Allocate width indices array:                                          */
-  idop = (int *)calloc(niso, sizeof(int));
-  ilor = (int *)calloc(niso, sizeof(int));
-
-  kmax = (double *)calloc(op->Nmol, sizeof(double));
-  kmin = (double *)calloc(op->Nmol, sizeof(double));
+           odwn = tr->owns.d/tr->owns.o;  /* Oversampling array             */
+
+  /* Use temporary scratch buffers if none were given:                      */
+  struct extwork tmpwork;
+  if (ew == NULL){
+    ew = &tmpwork;
+    if (alloc_extwork(tr, ew, permol) != 0)
+      return -1;
+  }
+  transitASSERT(ew->nmol != (permol ? op->Nmol : 1),
+                "Scratch buffers allocated for %i species instead of %li.\n",
+                ew->nmol, permol ? op->Nmol : 1);
 
   /* Number of species in output array:                                     */
-  if (permol)
-    Nmol = op->Nmol;
-  else
-    Nmol = 1;
-
-  /* Temporary extinction array:                                            */
-  ktmp    = (double **)malloc(Nmol           * sizeof(double *));
-  ktmp[0] = (double  *)calloc(Nmol*tr->owns.n, sizeof(double  ));
-  for (i=1; i<Nmol; i++)
-    ktmp[i] = ktmp[0] + tr->owns.n * i;
+  Nmol   = ew->nmol;
+  alphal = ew->alphal;
+  alphad = ew->alphad;
+  idop   = ew->idop;
+  ilor   = ew->ilor;
+  ilev   = ew->ilev;
+  lof    = ew->lof;
+  lpos   = ew->lpos;
+  kmax   = ew->kmax;
+  kmin   = ew->kmin;
+  ktmp   = ew->ktmp;
+
+  if (nthr > ew->nthr)
+    nthr = ew->nthr;
+
+  /* Free the Voigt profiles beyond the memory budget, unless other threads
+     may be using them:                                                     */
+  if (serial)
+    trimprofiles(op);
+
+  /* Reset the buffers left over from a previous call:                      */
+  memset(kmax,    0, Nmol*sizeof(double));
+  for (m=0; m < Nmol; m++)
+    kmin[m] = DBL_MAX;
+  m = 0;
 
   /* Constant factors for line widths:                                      */
   fdoppler = sqrt(2*KB*temp/AMU) * SQRTLN2 / LS;
   florentz = sqrt(2*KB*temp/PI/AMU) / (AMU*LS);
 
-  /* Calculate the isotope's widths for this layer:                         */
+  /* Calculate the isotope's widths for this layer, or take those of the
+     opacity-grid cell (see gridwidths()):                                  */
   for(i=0; i<niso; i++){
-    /* Lorentz profile width:                                               */
-    alphal[i] = 0.0;
-    for(j=0; j<nmol; j++){
-      /* Isotope's collision diameter:                                      */
-      csdiameter = (mol->radius[j] + mol->radius[iso->imol[i]]);
-      /* Line width:                                                        */
-      alphal[i] += density[j]/mol->mass[j] * csdiameter * csdiameter *
-                   sqrt(1/iso->isof[i].m + 1/mol->mass[j]);
+    if (ew->cell >= 0){
+      j = ew->cell*niso + i;
+      alphal[i] = op->alphal[j];
+      alphad[i] = op->alphad[(ew->cell % op->Ntemp)*niso + i];
+      idop[i]   = op->idop[j];
+      ilor[i]   = op->ilor[j];
     }
-    alphal[i] *= florentz;
+    else{
+      /* Lorentz profile width:                                             */
+      alphal[i] = 0.0;
+      for(j=0; j<nmol; j++){
+        /* Isotope's collision diameter:                                    */
+        csdiameter = (mol->radius[j] + mol->radius[iso->imol[i]]);
+        /* Line width:                                                      */
+        alphal[i] += density[j]/mol->mass[j] * csdiameter * csdiameter *
+                     sqrt(1/iso->isof[i].m + 1/mol->mass[j]);
+      }
+      alphal[i] *= florentz;
 
-    /* Doppler profile width (divided by central wavenumber):               */
-    alphad[i] = fdoppler / sqrt(iso->isof[i].m);
+      /* Doppler profile width (divided by central wavenumber):             */
+      alphad[i] = fdoppler / sqrt(iso->isof[i].m);
+
+      /* Closest aDop and aLor indices to alphad[i] and alphal[i]:          */
+      idop[i] = dopindex(op, alphad[i]*wn[0]);
+      ilor[i] = lorindex(op, alphal[i]);
+    }
 
     /* Print Lorentz and Doppler broadening widths:                         */
     if(i <= 0)
@@ -391,148 +887,289 @@ computemolext(struct transit *tr, /* transit struct                         */
 
     maxwidth = fmax(alphal[i], alphad[i]*wn[0]); /* Max between Dop and Lor */
     minwidth = fmin(minwidth, maxwidth);
-
-    /* Search for aDop and aLor indices for alphal[i] and alphad[i]:        */
-    idop[i] = binsearchapprox(aDop, alphad[i]*wn[0], 0, nDop);
-    ilor[i] = binsearchapprox(aLor, alphal[i],       0, nLor);
   }
 
   tr_output(TOUT_DEBUG, "Minimum width in layer: %.9f\n", minwidth);
-  /* Set oversampling resolution:                                           */
-  for (i=1; i < tr->ndivs; i++)
-    if (tr->odivs[i]*(dwn/tr->owns.o) >= 0.5 * minwidth){
-      break;
-    }
-  ofactor = tr->odivs[i-1];         /* Dynamic-sampling oversampling factor */
-  ddwn    = odwn * ofactor;         /* Dynamic-sampling grid interval       */
-  dnwn    = 1 + (onwn-1) / ofactor; /* Number of dynamic-sampling values    */
-  tr_output(TOUT_DEBUG, "Dynamic-sampling grid interval: %.9f  "
-               "(scale factor:%i)\n", ddwn, ofactor);
-  tr_output(TOUT_DEBUG, "Number of dynamic-sampling values:%li\n",
-                                dnwn);
-
-  /* Determine the maximum and minimum line-strength per isotope:           */
-  for(ln=0; ln<nlines; ln++){
-    /* Wavenumber of line transition:                                       */
-    wavn = 1.0 / (lt->wl[ln] * lt->wfct);
-    /* Isotope ID of line:                                                  */
-    i = lt->isoid[ln];
-    /* Species index in output array:                                       */
-    if (permol)
-      m = valueinarray(op->molID, mol->ID[iso->imol[i]], op->Nmol);
-
-    /* If it is beyond the lower limit, skip to next line transition:       */
-    if ((wavn < tr->wns.i) || (wavn > tr->owns.v[onwn-1]))
-      continue;
-
-    /* Calculate the extinction coefficient except the broadening factor:   */
-    propto_k = iso->isoratio[i]               *       /* Density            */
-            SIGCTE     * lt->gf[ln]           *       /* Constant * gf      */
-            exp(-EXPCTE*lt->efct*lt->elow[ln]/temp) * /* Level population   */
-            (1-exp(-EXPCTE*wavn/temp))        /       /* Induced emission   */
-            iso->isof[i].m                    /       /* Isotope mass       */
-            Z[i];                                     /* Partition function */
-    /* Maximum line strength among all transitions for each species:        */
-    if (kmax[m] == 0){
-      kmax[m] = kmin[m] = propto_k;
-    } else{
-      kmax[m] = fmax(kmax[m], propto_k);
-      kmin[m] = fmin(kmin[m], propto_k);
+  /* Set the oversampling resolution of each isotope from its own line
+     width, rather than from the narrowest one in the layer, so that broad
+     lines go on coarse grids.  The isotopes with the same dynamic-sampling
+     oversampling factor make up a sampling level:                          */
+  for (i=0; i<niso; i++){
+    maxwidth = fmax(alphal[i], alphad[i]*wn[0]);
+    for (j=1; j < tr->ndivs; j++)
+      if (tr->odivs[j]*(dwn/tr->owns.o) >= 0.5 * maxwidth)
+        break;
+    ofactor = tr->odivs[j-1];
+    for (l=0; l < nlev && lof[l] != ofactor; l++);
+    if (l == nlev){
+      lof[nlev++] = ofactor;
+      dnwn = 1 + (onwn-1) / ofactor;
+      tr_output(TOUT_DEBUG, "Dynamic-sampling grid interval: %.9f  "
+                 "(scale factor:%i)\n", odwn*ofactor, ofactor);
+      tr_output(TOUT_DEBUG, "Number of dynamic-sampling values:%li\n",
+                                  dnwn);
     }
+    ilev[i] = l;
+    if (minof == 0 || ofactor < minof)
+      minof = ofactor;
+  }
+  scale = tr->owns.o/minof;
+  nk    = 1 + (onwn-1) / minof / scale;
+  kbeg  = ew->k0;
+  kend  = (ew->k1 < 0) ? nk : ew->k1;
+  if (kend <= kbeg){
+    if (ew == &tmpwork)
+      freemem_extwork(ew);
+    return 0;
   }
 
-  /* Compute the spectra, proceed for every line:                           */
-  for(ln=0; ln<nlines; ln++){
-    wavn = 1.0/(lt->wl[ln]*lt->wfct);
-    i    = lt->isoid[ln];
-    if (permol)
-      m = valueinarray(op->molID, mol->ID[iso->imol[i]], op->Nmol);
-
-    if ((wavn < tr->wns.i) || (wavn > tr->owns.v[onwn-1]))
-      continue;
-
-    /* Extinction coefficient (factors depending on the line transition):   */
-    propto_k = lt->gf[ln]                              *
-               exp(-EXPCTE*lt->efct*lt->elow[ln]/temp) *
-               (1-exp(-EXPCTE*wavn/temp));
-
-    /* Index of closest oversampled wavenumber:                             */
-    iown = (wavn - tr->wns.i)/odwn;
-    if (fabs(wavn - tr->owns.v[iown+1]) < fabs(wavn - tr->owns.v[iown]))
-      iown++;
-
-    /* Check if the next line falls on the same sampling index:             */
-    while (ln != nlines-1 && lt->isoid[ln+1] == i){
-      next_wn = 1.0/(lt->wl[ln+1]*lt->wfct);
-      if (fabs(next_wn - tr->owns.v[iown]) < odwn){
-        nadd++;
-        ln++;
-        /* Add the contribution from this line into the opacity:            */
-        propto_k += lt->gf[ln]                                    *
-                    exp(-EXPCTE * lt->efct * lt->elow[ln] / temp) *
-                    (1-exp(-EXPCTE*next_wn/temp));
-      }
-      else
-        break;
+  /* Split the output range into tiles of up to EXT_TILE/scale values (at
+     least one), and at least one tile per thread:                          */
+  kt = EXT_TILE / scale;
+  if (kt < 1)
+    kt = 1;
+  ntiles = (kend - kbeg + kt - 1) / kt;
+  if (ntiles < nthr)
+    ntiles = nthr;
+  if (ntiles > kend - kbeg)
+    ntiles = kend - kbeg;
+
+  /* Offset of each level in a tile, and enlarge the tiles if needed:       */
+  kt = (kend - kbeg + ntiles - 1) / ntiles;
+  for (l=0; l < nlev; l++){
+    lpos[l] = ltile;
+    ltile  += tr->owns.o/lof[l] * kt + 1;
+  }
+  if (ltile > ew->ntile){
+    free(ew->ktmp[0]);
+    ew->ntile   = 0;
+    ew->ktmp[0] = (double *)calloc(ew->nthr*ew->nmol*ltile, sizeof(double));
+    if (!ew->ktmp[0]){
+      tr_output(TOUT_ERROR, "Allocation fail.\n");
+      if (ew == &tmpwork)
+        freemem_extwork(ew);
+      return -1;
     }
-    /* The rest of the factors:                                             */
-    propto_k *= SIGCTE*iso->isoratio[i] / (iso->isof[i].m * Z[i]);
+    ew->ntile = ltile;
+    for (j=1; j < ew->nthr*ew->nmol; j++)
+      ktmp[j] = ktmp[0] + ew->ntile * j;
+  }
 
-    /* If line is too weak, skip it:                                        */
-    if (propto_k < tr->ds.th->ethresh * kmax[m]){
-      nskip++;
-      continue;
-    }
-    /* Multiply by the species density:                                     */
-    if (permol == 0)
-      propto_k *= density[iso->imol[i]];
-
-    /* Index of closest (but not larger than) dynamic-sampling wavenumber:  */
-    idwn = (wavn - tr->wns.i)/ddwn;
-
-    // transitprint(1000, 2, "own[nown:%li]=%.3f  (wf=%.3f)\n",
-    //                       onwn, tr->owns.v[onwn-1], tr->wns.f);
-    // transitprint(1000, 2, "wavn=%.3f   own[%i]=%.3f\n",
-    //                       wavn, iown, tr->owns.v[iown]);
-
-    /* FINDME: de-hard code this threshold                                  */
-    /* Update Doppler width according to the current wavenumber:            */
-    if (alphad[i]*wavn/alphal[i] >= 1e-1){
-      /* Recalculate index for Doppler width:                               */
-      idop[i] = binsearchapprox(aDop, alphad[i]*wavn, 0, nDop);
+  /* Determine the maximum and minimum line-strength per species, over the
+     lines within the wavenumber range of each isotope run, one chunk of
+     the line store at a time:                                              */
+  for (lt=linefirst(&ew->lc); lt; lt=linenext(&ew->lc)){
+    for (r=0; r < lt->nrun; r++){
+      i = lt->riso[r];
+      /* Species index in output array:                                     */
+      if (permol)
+        m = valueinarray(op->molID, mol->ID[iso->imol[i]], op->Nmol);
+      if (ew->molmask && !ew->molmask[m])
+        continue;
+      linewindow(lt, r, tr->wns.i, tr->owns.v[onwn-1], &l0, &l1);
+      if (l0 == l1)
+        continue;
+
+      smax = 0.0;
+      smin = DBL_MAX;
+      #pragma omp parallel for simd num_threads(nthr) private(propto_k)   \
+              reduction(max:smax) reduction(min:smin)
+      for (ln=l0; ln<l1; ln++){
+        /* Line strength except for the partition function:                 */
+        propto_k = exp(lt->lgf[ln] + lt->elr[ln]/temp) * /* gf, level pop.  */
+                   (1-exp(-EXPCTE*lt->wn[ln]/temp));   /* Induced emission  */
+        smax = fmax(smax, propto_k);
+        smin = fmin(smin, propto_k);
+      }
+      /* Maximum line strength among all transitions for each species:      */
+      kmax[m] = fmax(kmax[m], smax/Z[i]);
+      kmin[m] = fmin(kmin[m], smin/Z[i]);
     }
+  }
+  /* Species without lines in range:                                        */
+  for (m=0; m < Nmol; m++)
+    if (kmax[m] == 0)
+      kmin[m] = 0;
+  m = 0;
+
+  /* Largest profile half-width (in cm-1) that a line may have in this
+     layer (the Doppler width grows with the line's wavenumber):            */
+  for (i=0; i<niso; i++){
+    j = dopindex(op, alphad[i]*tr->owns.v[onwn-1]);
+    hwmax = fmax(hwmax, (fmax(profsize[idop[i]][ilor[i]],
+                              profsize[j]        [ilor[i]]) + lof[ilev[i]]) *
+                        odwn);
+  }
 
-    /* Sub-sampling offset between center of line and dyn-sampled wn:       */
-    subw = iown - idwn*ofactor;
-    /* Offset between the profile and the wavenumber-array indices:         */
-    offset = ofactor*idwn - profsize[idop[i]][ilor[i]] + subw;
-    /* Range that contributes to the opacity:                               */
-    /* Set the lower and upper indices of the profile to be used:           */
-    minj = idwn - (profsize[idop[i]][ilor[i]] - subw) / ofactor;
-    maxj = idwn + (profsize[idop[i]][ilor[i]] + subw) / ofactor;
-    if (minj < 0)
-      minj = 0;
-    if (maxj > dnwn)
-      maxj = dnwn;
-
-    // tr_output(TOUT_DEBUG, "minj:%li  maxj:%li  subw:%li  offset:%li  "
-    //   "index1:%li\nf=np.array([",
-    //   minj, maxj, subw, offset, ofactor*minj - offset);
-
-    /* Add the contribution from this line to the opacity spectrum:         */
-    /* Adding in more complex but faster array indexing based on simpler
-     * pointer arrithmatic                                                  */
-    PREC_VOIGT * tmp_point = profile[idop[i]][ilor[i]];
-    int beg_j = ofactor*minj - offset;
-    for(j=minj; j<maxj; ++j){
-      ktmp[m][j] += propto_k * tmp_point[beg_j];
-      beg_j += ofactor;
+  /* Compute the spectra, one chunk of the line store at a time.  The
+     output array is split into ntiles disjoint tiles, distributed among
+     the threads.  For each tile, a thread adds the lines whose profile
+     reaches it into the dynamic-sampling values of their level under the
+     tile (plus the edges of the downsampling kernel), then downsamples
+     every level into kiso.
+     Thus, the dynamic-sampling values of a tile stay in cache, and the
+     scratch memory does not depend on the length of the spectrum:          */
+  for (j=0; j < Nmol; j++)
+    if (!ew->molmask || ew->molmask[j])
+      memset(kiso[j]+kbeg, 0, (kend-kbeg)*sizeof(PREC_RES));
+  for (lt=linefirst(&ew->lc); lt; lt=linenext(&ew->lc)){
+    #pragma omp parallel for schedule(dynamic, 1) num_threads(nthr)        \
+            private(ln, l0, l1, lend, r, i, wavn, next_wn, propto_k,       \
+                    iown, idwn, id, weak, j, l)                             \
+            firstprivate(m) reduction(+:nadd, nskip, neval, nbin, nsuper)
+    for (tile=0; tile < ntiles; tile++){
+      /* Output index range of the tile, and the dynamic-sampling index
+         range under its downsampling kernels (see downsample()):           */
+      long k0 = kbeg + (kend-kbeg) *  tile    / ntiles,
+           k1 = kbeg + (kend-kbeg) * (tile+1) / ntiles,
+           j0, j1;
+      /* Wavenumber range of the lines that contribute to the tile:         */
+      PREC_RES wnlo = tr->wns.i + (k0-0.5)*dwn - hwmax,
+               wnhi = tr->wns.i + (k1-0.5)*dwn + hwmax,
+               ddwn;
+      /* This thread's tile of each species, and the level of a run:        */
+      double **ktile = ktmp,
+             *k;
+      int of;
+      _Bool own,       /* Line center lies in this tile                     */
+            add = 0;   /* Some line of the chunk reaches the tile           */
+#ifdef _OPENMP
+      ktile += omp_get_thread_num() * Nmol;
+#endif
+      /* Super-line being binned: strength, dynamic-sampling index, Doppler
+         index, and ownership:                                              */
+      double sk = 0.0;
+      long sbin = -1;
+      int sid = -1;
+      _Bool sown = 0;
+
+      /* Proceed for every isotope run:                                     */
+      for (r=0; r < lt->nrun; r++){
+        i = lt->riso[r];
+        if (permol)
+          m = valueinarray(op->molID, mol->ID[iso->imol[i]], op->Nmol);
+        if (ew->molmask && !ew->molmask[m])
+          continue;
+        lend = lt->rfirst[r+1];
+        /* Dynamic sampling of the isotope's level:                         */
+        l    = ilev[i];
+        of   = lof[l];
+        ddwn = odwn * of;
+        k    = ktile[m] + lpos[l];
+        kernelrange(k0, k1, nk, 1 + (onwn-1)/of, tr->owns.o/of, &j0, &j1);
+        /* Lines in the wavenumber range whose profile reaches this tile:   */
+        linewindow(lt, r, fmax(tr->wns.i, wnlo),
+                   fmin(tr->owns.v[onwn-1], wnhi), &l0, &l1);
+        /* Clear the tile once some line reaches it:                        */
+        if (l0 < l1 && !add){
+          for (j=0; j < Nmol; j++)
+            memset(ktile[j], 0, ltile*sizeof(double));
+          add = 1;
+        }
+
+        for(ln=l0; ln<l1; ln++){
+          wavn = lt->wn[ln];
+
+          /* Extinction coefficient (factors depending on the transition):  */
+          propto_k = exp(lt->lgf[ln] + lt->elr[ln]/temp) *
+                     (1-exp(-EXPCTE*wavn/temp));
+
+          /* Index of closest oversampled wavenumber:                       */
+          iown = (wavn - tr->wns.i)/odwn;
+          if (fabs(wavn - tr->owns.v[iown+1]) < fabs(wavn - tr->owns.v[iown]))
+            iown++;
+
+          /* Index of closest (not larger) dynamic-sampling wavenumber:     */
+          idwn = (wavn - tr->wns.i)/ddwn;
+          /* Count the line statistics only in the tile of the line center: */
+          j   = (wavn - tr->wns.i)/dwn + 0.5;
+          own = (j >= k0) && (j < k1);
+
+          /* Check if the next line falls on the same sampling index:       */
+          while (ln+1 < lend){
+            next_wn = lt->wn[ln+1];
+            if (fabs(next_wn - tr->owns.v[iown]) < odwn){
+              if (own)
+                nadd++;
+              ln++;
+              /* Add the contribution from this line into the opacity:      */
+              propto_k += exp(lt->lgf[ln] + lt->elr[ln]/temp) *
+                          (1-exp(-EXPCTE*next_wn/temp));
+            }
+            else
+              break;
+          }
+          /* The partition function:                                        */
+          propto_k /= Z[i];
+
+          /* If line is too weak, skip it:                                  */
+          if (propto_k < tr->ds.th->ethresh * kmax[m]){
+            if (own)
+              nskip++;
+            continue;
+          }
+          weak = propto_k < tr->ds.th->sthresh * kmax[m];
+          /* Multiply by the species density:                               */
+          if (permol == 0)
+            propto_k *= density[iso->imol[i]];
+
+          /* FINDME: de-hard code this threshold                            */
+          /* Doppler-width index at the line's wavenumber, unless the Lorentz
+             width dominates, in which case take the layer's default index: */
+          id = idop[i];
+          if (alphad[i]*wavn/alphal[i] >= 1e-1)
+            id = dopindex(op, alphad[i]*wavn);
+
+          /* Bin a weak line into the super-line of its profile at the
+             closest dynamic-sampling wavenumber.  The lines of a run come
+             sorted, so a bin is complete once a weak line falls outside:   */
+          if (weak){
+            if (own)
+              nbin++;
+            idwn = (wavn - tr->wns.i)/ddwn + 0.5;
+            if (idwn == sbin && id == sid){
+              sk += propto_k;
+              continue;
+            }
+            if (sk > 0){
+              addline(k, voigtprofile(tr, sid, ilor[i]),
+                      profsize[sid][ilor[i]], sk, sbin*of, sbin, of, j0, j1);
+              if (sown)
+                nsuper++;
+            }
+            sk   = propto_k;
+            sbin = idwn;
+            sid  = id;
+            sown = own;
+            continue;
+          }
+
+          /* Add the contribution from this line to the opacity spectrum:   */
+          addline(k, voigtprofile(tr, id, ilor[i]), profsize[id][ilor[i]],
+                  propto_k, iown, idwn, of, j0, j1);
+          if (own)
+            neval++;
+        }
+        /* Add the last super-line of the run:                              */
+        if (sk > 0){
+          addline(k, voigtprofile(tr, sid, ilor[i]), profsize[sid][ilor[i]],
+                  sk, sbin*of, sbin, of, j0, j1);
+          if (sown)
+            nsuper++;
+          sk = 0.0;
+        }
+      }
+      /* Downsample every level of the tile into the output:                */
+      if (add)
+        for (j=0; j < Nmol; j++)
+          for (l=0; l < nlev && (!ew->molmask || ew->molmask[j]); l++){
+            of = lof[l];
+            kernelrange(k0, k1, nk, 1 + (onwn-1)/of, tr->owns.o/of, &j0, &j1);
+            downsampletile(ktile[j] + lpos[l], j0, kiso[j], 1 + (onwn-1)/of,
+                           tr->owns.o/of, k0, k1);
+          }
     }
-    neval++;
   }
-  /* Downsample ktmp to the final sampling size:                            */
-  for (m=0; m < Nmol; m++)
-    downsample(ktmp[m], kiso[m], dnwn, tr->owns.o/ofactor);
 
   tr_output(TOUT_DEBUG, "Number of co-added lines:     %8li  (%5.2f%%)\n",
     nadd,  nadd*100.0/nlines);
@@ -540,23 +1177,458 @@ computemolext(struct transit *tr, /* transit struct                         */
     nskip, nskip*100.0/nlines);
   tr_output(TOUT_DEBUG, "Number of evaluated profiles: %8li  (%5.2f%%)\n",
     neval, neval*100.0/nlines);
+  tr_output(TOUT_DEBUG, "Number of binned weak lines:  %8li  (%5.2f%%)\n",
+    nbin,  nbin*100.0/nlines);
+  tr_output(TOUT_DEBUG, "Number of super-line profiles:%8li\n", nsuper);
 
-  /* Free allocated memory:                                                 */
-  free(ktmp[0]);
-  free(ktmp);
-  free(alphal);
-  free(alphad);
-  free(idop);
-  free(ilor);
-  free(kmax);
-  free(kmin);
+  /* Free temporary scratch buffers:                                        */
+  if (ew == &tmpwork)
+    freemem_extwork(ew);
 
   return 0;
 }
 
 
+/* FUNCTION: Add the contribution of the dynamic-sampling values
+   s*prof[|ofactor*j - center|], for j in [minj, maxj), of the half
+   profile prof (see voigtprofile()) to the output
+   samples out[k], with k in [k0, k1), weighting them as downsample()
+   would for an array of n values downsampled by the factor scale into
+   nout values.                                                             */
+static void
+addprofile(PREC_RES *out,     /* Output samples [nout]                      */
+           PREC_VOIGT *prof,  /* Voigt profile                              */
+           double s,          /* Line strength                              */
+           long minj, long maxj, /* Dynamic-sampling index range            */
+           int ofactor,       /* Dynamic oversampling factor                */
+           long center,       /* Oversampled index of the line center       */
+           long n, long nout, /* Number of dynamic-sampling/output values   */
+           int scale,         /* Downsampling factor                        */
+           long k0, long k1){ /* Output index range                         */
+  int h = scale/2,            /* Downsampling-kernel half size              */
+      even = (scale % 2 == 0);
+  double wi = s/scale,           /* Weight of the interior samples          */
+         we = s/(0.5*(scale+1)); /* Weight of the first and last samples    */
+  long j, ja, jb, /* Kernel range of an output sample                       */
+       k, kend;
+  double sum;
+
+  /* Output samples reached by the profile:                                 */
+  k    = (minj - h)/scale;
+  kend = (maxj - 1 + h)/scale + 1;
+  if (k < k0)
+    k = k0;
+  if (kend > k1)
+    kend = k1;
+
+  for (; k<kend; k++){
+    ja = (k == 0)      ? 0   : scale*k - h;
+    jb = (k == nout-1) ? n-1 : scale*k + h;
+    sum = 0.0;
+    for (j=(ja > minj ? ja : minj); j <= jb && j < maxj; j++)
+      sum += prof[labs(ofactor*j - center)];
+    /* Half weight of the kernel boundaries (see downsample()):             */
+    if (even){
+      if (k == nout-1)
+        ja = n - h;
+      if (k > 0 && ja >= minj && ja < maxj)
+        sum -= 0.5 * prof[labs(ofactor*ja - center)];
+      if (k < nout-1 && jb >= minj && jb < maxj)
+        sum -= 0.5 * prof[labs(ofactor*jb - center)];
+    }
+    out[k] += sum * ((k == 0 || k == nout-1) ? we : wi);
+  }
+}
+
+
+/* FUNCTION: Add a line of strength s, centered at the oversampled index
+   iown (closest dynamic-sampling index idwn, not larger), with profile
+   prof of half-size ps, to the output samples [k0, k1) (see
+   addprofile()).                                                           */
+static void
+addgridline(PREC_RES *out,     /* Output samples [nout]                     */
+            PREC_VOIGT *prof,  /* Voigt profile                             */
+            long ps,           /* Profile half-size                         */
+            double s,          /* Line strength                             */
+            long iown,         /* Oversampled index of the line center      */
+            long idwn,         /* Dynamic-sampling index of the line center */
+            int ofactor,       /* Dynamic oversampling factor               */
+            long n, long nout, /* Number of dynamic-sampling/output values  */
+            int scale,         /* Downsampling factor                       */
+            long k0, long k1){ /* Output index range                        */
+  long subw   = iown - idwn*ofactor,
+       minj   = idwn - (ps - subw) / ofactor,
+       maxj   = idwn + (ps + subw) / ofactor;
+  if (minj < 0)
+    minj = 0;
+  if (maxj > n)
+    maxj = n;
+  addprofile(out, prof, s, minj, maxj, ofactor, iown, n, nout, scale,
+             k0, k1);
+}
+
+
+/* FUNCTION: Maximum line strength per temperature and species of the
+   opacity grid, over the lines within the wavenumber range (see
+   gridmolext()), evaluating each line for the whole temperature array at
+   once.
+   Return: the maxima [temp][mol], NULL on failure                          */
+double *
+gridlinemax(struct transit *tr){ /* transit struct                          */
+  struct opacity    *op =tr->ds.op;
+  struct isotopes   *iso=tr->ds.iso;
+  struct molecules  *mol=tr->ds.mol;
+  struct line_transition *lt;  /* Chunk of the line store                   */
+  struct linecursor lc;         /* Cursor over the line store               */
+  long Ntemp = op->Ntemp,
+       Nmol  = op->Nmol,
+       ln;
+  PREC_NREC l0, l1;             /* Line-index window of an isotope run      */
+  double *kmax;
+  int i, r, t, m;
+
+  if (alloc_linecursor(tr, &lc) != 0)
+    return NULL;
+  if ((kmax=(double *)calloc(Ntemp*Nmol, sizeof(double))) == NULL){
+    tr_output(TOUT_ERROR, "Allocation fail.\n");
+    freemem_linecursor(&lc);
+    return NULL;
+  }
+  for (lt=linefirst(&lc); lt; lt=linenext(&lc)){
+    for (r=0; r < lt->nrun; r++){
+      i = lt->riso[r];
+      m = valueinarray(op->molID, mol->ID[iso->imol[i]], Nmol);
+      linewindow(lt, r, tr->wns.i, tr->owns.v[tr->owns.n-1], &l0, &l1);
+      #pragma omp parallel num_threads(tr->nthreads) private(t)
+      {
+        double *smax = (double *)calloc(Ntemp, sizeof(double));
+        #pragma omp for schedule(static)
+        for (ln=l0; ln<l1; ln++){
+          #pragma omp simd
+          for (t=0; t<Ntemp; t++)
+            smax[t] = fmax(smax[t],
+                           exp(lt->lgf[ln] + lt->elr[ln]/op->temp[t]) *
+                           (1-exp(-EXPCTE*lt->wn[ln]/op->temp[t])));
+        }
+        #pragma omp critical
+        for (t=0; t<Ntemp; t++)
+          kmax[t*Nmol+m] = fmax(kmax[t*Nmol+m], smax[t]/op->ziso[i][t]);
+        free(smax);
+      }
+    }
+  }
+  freemem_linecursor(&lc);
+  return kmax;
+}
+
+
+/* FUNCTION: Compute the molecular extinction (per molecule) of the layers
+   [r0, r1) of the opacity grid, at every temperature, going through the
+   line list once, instead of once per cell as computemolext().  Each
+   co-added line is evaluated at all the cells while its data is in cache:
+   its strength for the whole temperature array at once, and its profile
+   for each layer and temperature, which is downsampled directly into the
+   grid.  The grid samples are split into wavenumber tiles, distributed
+   among the threads.  Up to the rounding order, the result equals that
+   of computemolext() for each cell.
+   Return: 0 on success                                                     */
+#define GRID_BLOCK 256
+int
+gridmolext(struct transit *tr,  /* transit struct                           */
+           double *kmax,        /* Line-strength maxima (gridlinemax())     */
+           long r0, long r1,    /* Layer range                              */
+           PREC_RES *grid){     /* Opacities [r1-r0][temp][mol][wn]         */
+  struct opacity    *op =tr->ds.op;
+  struct isotopes   *iso=tr->ds.iso;
+  struct molecules  *mol=tr->ds.mol;
+  struct line_transition *lt;  /* Chunk of the line store                   */
+  struct linecursor lc;         /* Cursor over the line store               */
+
+  long Nlayer = op->Nlayer, /* Opacity-grid dimension sizes                 */
+       Ntemp  = op->Ntemp,
+       Nmol   = op->Nmol,
+       Nwave  = op->Nwave,
+       ncell  = Nlayer*Ntemp;
+  int niso = iso->n_i;      /* Number of isotopes in atmosphere             */
+  PREC_NREC onwn = tr->owns.n;
+
+  PREC_NREC **profsize=op->profsize;  /* Voigt-profile half-size            */
+
+  PREC_RES dwn  = tr->wns.d /tr->wns.o,   /* Output sampling interval       */
+           odwn = tr->owns.d/tr->owns.o;  /* Oversampling interval          */
+
+  double *alphal=op->alphal, /* Lorentz width [cell][iso]                  */
+         *alphad=op->alphad; /* Doppler width (over wavenumber) [temp][iso] */
+  int *idop=op->idop, /* Profile indices per cell and isotope [cell][iso]   */
+      *ilor=op->ilor, /*   (see gridwidths())                               */
+      *ofactor,     /* Dynamic oversampling factor [cell][iso]              */
+      *imol;        /* Index of each isotope's species in the grid          */
+  PREC_NREC *l0, *l1, /* Line-index window of each isotope run              */
+            *gfirst,  /* First line of each co-added group                  */
+            *grun,    /* Index of the first group of each isotope run       */
+            ng=0;     /* Number of groups                                   */
+  double hwmax=0,     /* Maximum profile half-width (cm-1)                  */
+         width;
+  long c, j, ln, nadd=0, nskip=0, neval=0, nbin=0, nsuper=0;
+  int i, r, t, m, ntiles=1, tile, rn;
+#ifdef _OPENMP
+  ntiles = 8*tr->nthreads;
+#endif
+  if (ntiles > Nwave)
+    ntiles = Nwave;
+
+  /* On failure, the allocated buffers (and the cursor) are freed at the
+     end like on success:                                                   */
+  ofactor = (int    *)calloc(ncell*niso, sizeof(int));
+  imol    = (int    *)calloc(niso,       sizeof(int));
+  rn      = alloc_linecursor(tr, &lc);
+  l0      = (PREC_NREC *)calloc(lc.maxrun,    sizeof(PREC_NREC));
+  l1      = (PREC_NREC *)calloc(lc.maxrun,    sizeof(PREC_NREC));
+  grun    = (PREC_NREC *)calloc(lc.maxrun+1,  sizeof(PREC_NREC));
+  gfirst  = (PREC_NREC *)malloc((lc.maxline+1) * sizeof(PREC_NREC));
+  if (!ofactor || !imol || !l0 || !l1 || !grun || !gfirst){
+    tr_output(TOUT_ERROR, "Allocation fail.\n");
+    rn = -1;
+  }
+  if (rn != 0)
+    ncell = 0;  /* Skip the computation                                     */
+  for (i=0; rn == 0 && i<niso; i++)
+    imol[i] = valueinarray(op->molID, mol->ID[iso->imol[i]], Nmol);
+
+  /* Oversampling factor of each cell and isotope (as in computemolext()),
+     and the largest profile half width:                                    */
+  #pragma omp parallel for num_threads(tr->nthreads)                     \
+          private(t, i, j, m, width) reduction(max:hwmax)
+  for (c=0; c<ncell; c++){
+    t = c % Ntemp;
+    for (i=0; i<niso; i++){
+      width = fmax(alphal[c*niso+i], alphad[t*niso+i]*tr->wns.v[0]);
+      for (m=1; m < tr->ndivs; m++)
+        if (tr->odivs[m]*(dwn/tr->owns.o) >= 0.5 * width)
+          break;
+      ofactor[c*niso+i] = tr->odivs[m-1];
+
+      j = dopindex(op, alphad[t*niso+i]*tr->owns.v[onwn-1]);
+      hwmax = fmax(hwmax, (fmax(profsize[idop[c*niso+i]][ilor[c*niso+i]],
+                                profsize[j]             [ilor[c*niso+i]])
+                           + ofactor[c*niso+i]) * odwn);
+    }
+  }
+  /* Plus the half width of the downsampling kernel:                        */
+  hwmax += dwn;
+
+  /* Compute the grid, the line store going one chunk at a time:            */
+  for (lt = rn ? NULL : linefirst(&lc); lt && rn == 0; lt=linenext(&lc)){
+    /* Split each isotope run into contiguous groups of lines co-added into
+       the same oversampled wavenumber (as in computemolext()):             */
+    ng = 0;
+    for (r=0; r < lt->nrun; r++){
+      linewindow(lt, r, tr->wns.i, tr->owns.v[onwn-1], l0+r, l1+r);
+      grun[r] = ng;
+      for (ln=l0[r]; ln<l1[r]; ln++){
+        long iown = (lt->wn[ln] - tr->wns.i)/odwn;
+        if (fabs(lt->wn[ln] - tr->owns.v[iown+1]) <
+            fabs(lt->wn[ln] - tr->owns.v[iown]))
+          iown++;
+        gfirst[ng++] = ln;
+        while (ln+1 < lt->rfirst[r+1] &&
+               fabs(lt->wn[ln+1] - tr->owns.v[iown]) < odwn){
+          nadd++;
+          ln++;
+        }
+      }
+      /* The last group may extend beyond the window:                       */
+      l1[r] = ln;
+    }
+    grun[lt->nrun] = ng;
+
+    /* Compute the grid.  Each thread goes through the line groups whose
+       profiles reach its tile, and adds to the grid only inside the tile.
+       The groups go in blocks of GRID_BLOCK, so that the line data of a block
+       stays in cache while going through the cells, and the profiles of a
+       cell stay in cache while going through the block:                    */
+    #pragma omp parallel for schedule(dynamic, 1) num_threads(tr->nthreads)\
+            private(r, i, m, t, c, ln)                                     \
+            reduction(+:nskip, neval, nbin, nsuper)
+    for (tile=0; tile < ntiles; tile++){
+      long k0 = Nwave *  tile    / ntiles,
+           k1 = Nwave * (tile+1) / ntiles,
+           g, g0, g1, gb, a, b, q, nb;
+      PREC_RES wnlo = tr->wns.i + k0*dwn     - hwmax,
+               wnhi = tr->wns.i + (k1-1)*dwn + hwmax;
+      /* Per-group data of a block: strength and Doppler-profile index per
+         temperature, wavenumber, oversampling index, and ownership:        */
+      double  *s    = (double  *)calloc(GRID_BLOCK*Ntemp, sizeof(double));
+      int     *id   = (int     *)calloc(GRID_BLOCK*Ntemp, sizeof(int));
+      double  *wavn = (double  *)calloc(GRID_BLOCK,       sizeof(double));
+      long    *iown = (long    *)calloc(GRID_BLOCK,       sizeof(long));
+      _Bool   *own  = (_Bool   *)calloc(GRID_BLOCK,       sizeof(_Bool));
+      _Bool ok = s && id && wavn && iown && own;
+      if (!ok){
+        #pragma omp atomic write
+        rn = -1;
+      }
+
+      for (r=0; ok && r < lt->nrun; r++){
+        i = lt->riso[r];
+        m = imol[i];
+        /* Groups of the run with wn in [wnlo, wnhi] (wn decreases):        */
+        a = grun[r];
+        b = grun[r+1];
+        while (a < b){
+          g = (a+b)/2;
+          if (lt->wn[gfirst[g]] > wnhi) a = g + 1;
+          else                          b = g;
+        }
+        g0 = a;
+        b = grun[r+1];
+        while (a < b){
+          g = (a+b)/2;
+          if (lt->wn[gfirst[g]] >= wnlo) a = g + 1;
+          else                           b = g;
+        }
+        g1 = a;
+
+        for (gb=g0; gb<g1; gb+=GRID_BLOCK){
+          nb = (g1-gb < GRID_BLOCK) ? g1-gb : GRID_BLOCK;
+          for (q=0; q<nb; q++){
+            double *sq = s + q*Ntemp;
+            g = gb + q;
+            PREC_NREC lend = (g+1 < grun[r+1]) ? gfirst[g+1] : l1[r];
+            wavn[q] = lt->wn[gfirst[g]];
+          /* Count the line statistics only in the tile of the line center: */
+            a = (wavn[q] - tr->wns.i)/dwn + 0.5;
+            own[q] = (a >= k0) && (a < k1);
+            iown[q] = (wavn[q] - tr->wns.i)/odwn;
+            if (fabs(wavn[q] - tr->owns.v[iown[q]+1]) <
+                fabs(wavn[q] - tr->owns.v[iown[q]]))
+              iown[q]++;
+
+            /* Strength of the co-added lines at every temperature:         */
+            memset(sq, 0, Ntemp*sizeof(double));
+            for (ln=gfirst[g]; ln<lend; ln++){
+              #pragma omp simd
+              for (t=0; t<Ntemp; t++)
+                sq[t] += exp(lt->lgf[ln] + lt->elr[ln]/op->temp[t]) *
+                         (1-exp(-EXPCTE*lt->wn[ln]/op->temp[t]));
+            }
+            for (t=0; t<Ntemp; t++){
+              sq[t] /= op->ziso[i][t];
+              /* If line is too weak, skip it:                              */
+              if (sq[t] < tr->ds.th->ethresh * kmax[t*Nmol+m]){
+                sq[t] = 0.0;
+                if (own[q])
+                  nskip += r1 - r0;
+              }
+            }
+            /* Doppler-width index at the line's wavenumber, for the whole
+               temperature array at once:                                   */
+            for (t=0; t<Ntemp; t++)
+              id[q*Ntemp+t] = dopindex(op, alphad[t*niso+i]*wavn[q]);
+          }
+
+          for (c=r0*Ntemp; c<r1*Ntemp; c++){
+            long idwn, ci = c*niso + i;
+            int of    = ofactor[ci],
+                scale = tr->owns.o/of,
+                d;
+            long n = 1 + (onwn-1) / of;
+            PREC_RES *out = grid + ((c - r0*Ntemp)*Nmol + m)*Nwave;
+            /* Super-line being binned (as in computemolext()):             */
+            double sk = 0.0;
+            long sbin = -1;
+            int sd = -1;
+            _Bool sown = 0;
+            t = c % Ntemp;
+
+            for (q=0; q<nb; q++){
+              if (s[q*Ntemp+t] == 0.0)
+                continue;
+              d = idop[ci];
+              /* FINDME: de-hard code this threshold                        */
+              if (alphad[t*niso+i]*wavn[q]/alphal[ci] >= 1e-1)
+                d = id[q*Ntemp+t];
+              /* Bin a weak line into a super-line:                         */
+              if (s[q*Ntemp+t] < tr->ds.th->sthresh * kmax[t*Nmol+m]){
+                if (own[q])
+                  nbin++;
+                idwn = (wavn[q] - tr->wns.i)/(odwn*of) + 0.5;
+                if (idwn == sbin && d == sd){
+                  sk += s[q*Ntemp+t];
+                  continue;
+                }
+                if (sk > 0){
+                  addgridline(out, voigtprofile(tr, sd, ilor[ci]),
+                              profsize[sd][ilor[ci]], sk, sbin*of, sbin, of,
+                              n, Nwave, scale, k0, k1);
+                  if (sown)
+                    nsuper++;
+                }
+                sk   = s[q*Ntemp+t];
+                sbin = idwn;
+                sd   = d;
+                sown = own[q];
+                continue;
+              }
+              idwn = (wavn[q] - tr->wns.i)/(odwn*of);
+              addgridline(out, voigtprofile(tr, d, ilor[ci]),
+                          profsize[d][ilor[ci]], s[q*Ntemp+t], iown[q], idwn,
+                          of, n, Nwave, scale, k0, k1);
+              if (own[q])
+                neval++;
+            }
+            /* Add the last super-line of the block:                        */
+            if (sk > 0){
+              addgridline(out, voigtprofile(tr, sd, ilor[ci]),
+                          profsize[sd][ilor[ci]], sk, sbin*of, sbin, of, n,
+                          Nwave, scale, k0, k1);
+              if (sown)
+                nsuper++;
+            }
+          }
+        }
+      }
+      free(s);
+      free(id);
+      free(wavn);
+      free(iown);
+      free(own);
+    }
+    /* Free the Voigt profiles beyond the memory budget between chunks:     */
+    trimprofiles(op);
+    if (rn != 0)
+      tr_output(TOUT_ERROR, "Allocation fail.\n");
+  }
+
+  tr_output(TOUT_DEBUG, "Number of co-added lines:     %8li  (%5.2f%%)\n",
+    nadd,  nadd*100.0/tr->ds.li->n_l);
+  tr_output(TOUT_DEBUG, "Number of skipped profiles:   %8li\n", nskip);
+  tr_output(TOUT_DEBUG, "Number of evaluated profiles: %8li\n", neval);
+  tr_output(TOUT_DEBUG, "Number of binned weak lines:  %8li\n", nbin);
+  tr_output(TOUT_DEBUG, "Number of super-line profiles:%8li\n", nsuper);
+
+  free(ofactor);
+  free(imol);
+  free(l0);
+  free(l1);
+  free(grun);
+  free(gfirst);
+  freemem_linecursor(&lc);
+  return rn;
+}
+
+
 /* Obtain the molecular extinction by interpolating the opacity grid at
-   the specified atmospheric layer:                                         */
+   the specified atmospheric layer: linearly in temperature, and linearly
+   in log(pressure) between the grid pressures that bracket the layer
+   pressure (a layer at a grid pressure takes that grid row alone).  The
+   grid rows are contiguous in wavenumber, so the interpolation and the
+   density-weighted sum over molecules run as one streaming pass over
+   blocks of INTERP_BLOCK wavenumbers (short enough for kiso to stay in
+   the L1 cache while every molecule is added).  Encoded grids (see
+   encodefile()) are decoded in the same pass, so only the encoded values
+   stream from memory:                                                      */
+#define INTERP_BLOCK 1024
 int
 interpolmolext(struct transit *tr, /* transit struct                        */
                PREC_NREC r,        /* Radius index                          */
@@ -569,11 +1641,19 @@ interpolmolext(struct transit *tr, /* transit struct                        */
   PREC_RES *gtemp;
   int       *gmol;
   int itemp, imol,
-      i, m;   /* for-loop indices                                           */
-  double ext; /* Interpolated extinction coefficient                        */
-
-  /* Layer temperature:                                                     */
+      i, m, n, np;   /* for-loop indices, number of grid pressures          */
+  long i0, i1,  /* Wavenumber block boundaries                              */
+       b0, b1,  /* 16-bit block boundaries                                  */
+       row0, row1, /* Grid rows at the two bracketing temperatures          */
+       ip,         /* Index of the (first) bracketing grid pressure         */
+       nqblk = (op->Nwave + OPA_QBLOCK - 1) / OPA_QBLOCK;
+  double dtemp, /* Grid-temperature spacing                                 */
+         fp,    /* Layer position between the grid pressures                */
+         wp[2]; /* Weight of each bracketing grid pressure                  */
+
+  /* Layer temperature and pressure:                                        */
   PREC_ATM temp = tr->atm.t[r] * tr->atm.tfct;
+  double press  = tr->atm.p[r] * tr->atm.pfct;
   /* Gridded temperatures:                                                  */
   gtemp = op->temp;
   Ntemp = op->Ntemp;
@@ -590,21 +1670,86 @@ interpolmolext(struct transit *tr, /* transit struct                        */
     itemp--;
   tr_output(TOUT_DEBUG, "Temperature: T[%i]=%.0f < %.2f < T[%.i]=%.0f\n",
     itemp, gtemp[itemp], temp, itemp+1, gtemp[itemp+1]);
+  dtemp = gtemp[itemp+1] - gtemp[itemp];
+
+  /* Bracket the layer pressure (clamped to the grid's pressure range, see
+     checkpressrange()):                                                    */
+  if (press < fmin(op->press[0], op->press[op->Nlayer-1]) ||
+      press > fmax(op->press[0], op->press[op->Nlayer-1]))
+    tr_output(TOUT_DEBUG, "Layer pressure (%.3e bar) out of the opacity "
+                         "grid's range.  Using the closest grid pressure.\n",
+                         press/1e6);
+  ip = pressbracket(op->press, op->Nlayer, press, &fp);
+  np = fp > 0 ? 2 : 1;
+  wp[0] = 1.0 - fp;
+  wp[1] = fp;
+
+  /* Interpolation weights times the species density, and grid rows at the
+     two bracketing temperatures, for each bracketing pressure and
+     molecule:                                                              */
+  double    w0[2*Nmol], w1[2*Nmol];
+  long      r0[2*Nmol], r1[2*Nmol];
+  for (n=0; n < np*Nmol; n++){
+    m     = n % Nmol;
+    imol  = valueinarray(mol->ID, gmol[m], mol->nmol);
+    w0[n] = mol->molec[imol].d[r] * (gtemp[itemp+1] - temp) / dtemp;
+    w1[n] = mol->molec[imol].d[r] * (temp - gtemp[itemp])   / dtemp;
+    if (np == 2){
+      w0[n] *= wp[n/Nmol];
+      w1[n] *= wp[n/Nmol];
+    }
+    r0[n] = ((ip+n/Nmol)*Ntemp + itemp  )*Nmol + m;
+    r1[n] = ((ip+n/Nmol)*Ntemp + itemp+1)*Nmol + m;
+  }
 
-  for (i=0; i < Nwave; i++){
-    /* Add contribution from each molecule:                                 */
-    for (m=0; m < Nmol; m++){
-      /* Linear interpolation of the extinction coefficient:                */
-      ext = (op->o[r][itemp  ][m][i] * (gtemp[itemp+1]-temp) +
-             op->o[r][itemp+1][m][i] * (temp - gtemp[itemp]) ) /
-                                                 (gtemp[itemp+1]-gtemp[itemp]);
-      imol = valueinarray(mol->ID, gmol[m], mol->nmol);
-      kiso[r][i] += mol->molec[imol].d[r] * ext;
+  /* Add contribution from each molecule:                                   */
+  PREC_RES *restrict k = kiso[r];
+  for (i0=0; i0 < Nwave; i0 += INTERP_BLOCK){
+    i1 = i0 + INTERP_BLOCK < Nwave ? i0 + INTERP_BLOCK : Nwave;
+    for (n=0; n < np*Nmol; n++){
+      const double a = w0[n],
+                   b = w1[n];
+      row0 = r0[n];
+      row1 = r1[n];
+      if (op->format == OPA_DOUBLE){
+        const PREC_RES *restrict lo = op->o[0][0][row0],
+                       *restrict hi = op->o[0][0][row1];
+        #pragma omp simd
+        for (i=i0; i < i1; i++)
+          k[i] += a*lo[i] + b*hi[i];
+      }
+      else if (op->format == OPA_FLOAT){
+        const float *restrict lo = op->lgrid + row0*Nwave,
+                    *restrict hi = op->lgrid + row1*Nwave;
+        #pragma omp simd
+        for (i=i0; i < i1; i++)
+          k[i] += a*exp(LN10*lo[i]) + b*exp(LN10*hi[i]);
+      }
+      else{
+        const unsigned short *restrict lo = op->qgrid + row0*Nwave,
+                             *restrict hi = op->qgrid + row1*Nwave;
+        /* The blocks of OPA_QBLOCK values within this wavenumber block:    */
+        for (b0=i0; b0 < i1; b0=b1){
+          const float *p0 = op->qpar + 2*(row0*nqblk + b0/OPA_QBLOCK),
+                      *p1 = op->qpar + 2*(row1*nqblk + b0/OPA_QBLOCK);
+          const double off0 = p0[0], step0 = p0[1],
+                       off1 = p1[0], step1 = p1[1];
+          b1 = (b0/OPA_QBLOCK + 1) * OPA_QBLOCK;
+          if (b1 > i1)
+            b1 = i1;
+          #pragma omp simd
+          for (i=b0; i < b1; i++)
+            k[i] += (lo[i] ? a*exp(LN10*(off0 + (lo[i]-1)*step0)) : 0.0) +
+                    (hi[i] ? b*exp(LN10*(off1 + (hi[i]-1)*step1)) : 0.0);
+        }
+      }
     }
   }
 
   return 0;
 }
+#undef INTERP_BLOCK
+
 
 /* \fcnfh
    Compute scatering contribution to extinction
@@ -9,10 +9,9 @@
 int
 setgeomhint(struct transit *tr){
   /* Declare geometry structure and set values to 0: */
-  static struct geometry st_sg;
-  memset(&st_sg, 0, sizeof(struct geometry));
+  struct geometry *sg = tr->ds.sg = &tr->st.sg;
+  memset(sg, 0, sizeof(struct geometry));
 
-  struct geometry *sg = tr->ds.sg = &st_sg;
   struct geometry *hg = &tr->ds.th->sg;
 
   /* Copy hint transpplanet into transit: */
@@ -28,7 +28,6 @@ void saveidxref(FILE *out, PREC_NREC nrad, struct idxref *ir)
    Return: 0 on success                                              */
 int
 idxrefrac(struct transit *tr){
-  static struct idxref st_idx;
   long r;            /* Radius index */
   PREC_ATM rho;      /* Density      */
   PREC_ATM nustp=0;  /* FINDME: Explain my name */
@@ -38,16 +37,17 @@ idxrefrac(struct transit *tr){
   transitcheckcalled(tr->pi, "idxrefrac", 1, "makeradsample", TRPI_MAKERAD);
 
   /* Get struct objects: */
-  tr->ds.ir     = &st_idx;
+  tr->ds.ir     = &tr->st.ir;
   prop_atm *atm = &tr->atm;
 
-  /* Allocate space and initialize: */
-  st_idx.n = (PREC_RES *)calloc(tr->rads.n, sizeof(PREC_RES));
+  /* Allocate space (unless kept from the previous run) and initialize: */
+  if (tr->ds.ir->n == NULL)
+    tr->ds.ir->n = (PREC_RES *)calloc(tr->rads.n, sizeof(PREC_RES));
 
   /* Calculate density at each radius: */
   for(r=0; r<tr->rads.n; r++){
     rho = stateeqnford(1, 1.0, atm->mm[r], 0, atm->p[r], atm->t[r]);
-    st_idx.n[r] = 1 + rho*nustp/(LO*AMU*atm->mm[r]);
+    tr->ds.ir->n[r] = 1 + rho*nustp/(LO*AMU*atm->mm[r]);
   }
 
   /* Set progress indicator and return success: */
@@ -65,6 +65,7 @@ freemem_idexrefrac(struct idxref *ir, /* Index of refraction structure */
                    long *pi){
   /* Free arrays: */
   free(ir->n);
+  ir->n = NULL;
 
   /* Update progress indicator and return: */
   *pi &= ~(TRPI_IDXREFRAC|TRPI_TAU);
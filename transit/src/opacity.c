@@ -1,18 +1,32 @@
 // Copyright (C) 2015-2016 University of Central Florida. All rights reserved.
 // Transit is under an open-source, reproducible-research license (see LICENSE).
 
+#define _GNU_SOURCE   /* F_OFD_SETLK (see shmlock())                        */
 #include <transit.h>
 
+/* Systems without open-file-description locks take process-wide locks:    */
+#ifndef F_OFD_SETLK
+#define F_OFD_SETLK  F_SETLK
+#define F_OFD_SETLKW F_SETLKW
+#endif
+
+static int extendopacity(struct transit *tr);
+static void checkpressrange(struct transit *tr);
+
+/* Temporary file of the merged grid while extendopacity() writes it:       */
+static char *opatmp = NULL;
+
+
 /* FUNCTION:  Calculate the opacity due to molecular transitions.
    Return: 0 on success                                                     */
 int
 opacity(struct transit *tr){
   struct transithint *th = tr->ds.th; /* transithint struct                 */
-  static struct opacity op;           /* The opacity struct                 */
+  struct opacity *op = &tr->st.op;    /* The opacity struct                 */
 
   /* Set the opacity struct's mem to 0:                                     */
-  memset(&op, 0, sizeof(struct opacity));
-  tr->ds.op = &op;
+  memset(op, 0, sizeof(struct opacity));
+  tr->ds.op = op;
 
   /* Check that the radius array has been sampled:                          */
   transitcheckcalled(tr->pi, "opacity", 1, "makeradsample", TRPI_MAKERAD);
@@ -40,7 +54,7 @@ opacity(struct transit *tr){
   if (file_exists == -1) {
 
     /* Open file for writing:                                               */
-    tr->fp_opa = fopen(tr->f_opa, "wb");
+    tr->fp_opa = fopen(tr->f_opa, "w+b");
 
     /* Immediately return if the file could not be opened:                  */
     if (tr->fp_opa == NULL){
@@ -56,7 +70,8 @@ opacity(struct transit *tr){
     /* Calculate the grid of opacities:                                     */
     tr_output(TOUT_INFO, "Calculating new grid of opacities: '%s'.\n",
                                tr->f_opa);
-    calcopacity(tr, tr->fp_opa);
+    calcopacity(tr, tr->fp_opa, NULL);
+    checkpressrange(tr);
 
     /* Free the line-transition memory:                                     */
     freemem_linetransition(&tr->ds.li->lt, &tr->pi);
@@ -86,135 +101,811 @@ opacity(struct transit *tr){
     return 0;
   }
 
+  /* Extend the existing grid:                                             */
+  if (tr->opaextend){
+    extendopacity(tr);
+    checkpressrange(tr);
+    return 0;
+  }
+
   /* Should attempt to use shared memory:                                   */
   if (tr->opashare) {
 
-    /* Get ID or create shared opacityhint struct:                          */
-    key_t hintkey = ftok(tr->f_opa, 'a');
-    op.hintID = shmget(hintkey, sizeof(struct opacityhint), 0644 | IPC_CREAT);
-
-    /* If reserving the hint segment was unsuccessful, give up:             */
-    if (op.hintID == -1) {
-
-      tr_output(TOUT_WARN, "Could not get hint shared memory ID.\n");
+    /* Attach to the shared grid (loading it if this is the first process
+       to get there):                                                       */
+    tr_output(TOUT_INFO, "Sharing opacity file: '%s'.\n", tr->f_opa);
+    if (shareopacity(tr, tr->fp_opa) != 0) {
+      tr_output(TOUT_WARN, "Could not share the opacity grid.\n");
 
       /* Read the grid of opacities from file:                              */
       tr_output(TOUT_INFO, "Reading opacity file: '%s'.\n", tr->f_opa);
       readopacity(tr, tr->fp_opa);
-
-      /* Set progress indicator and return success:                         */
-      tr->pi |= TRPI_OPACITY;
-      return 0;
     }
+  }
+
+  /* Should not attempt to use shared memory:                               */
+  else {
+
+    /* Read the grid of opacities from file:                                */
+    tr_output(TOUT_INFO, "Reading opacity file: '%s'.\n", tr->f_opa);
+    readopacity(tr, tr->fp_opa);
+  }
+  checkpressrange(tr);
 
-    /* Attach to the hint shared memory segment:                            */
-    op.hint = shmat(op.hintID, (void *) 0, 0);
+  /* Set progress indicator and return success:                           */
+  tr->pi |= TRPI_OPACITY;
+  return 0;
+}
 
-    /* If attaching was unsuccessful, give up.                              */
-    if (op.hint == (struct opacityhint *) -1) {
 
-      tr_output(TOUT_WARN, "Could not attach to hint shared memory.\n");
+/* FUNCTION: Remove the partial merged grid of extendopacity() when the
+   program exits before the grid is complete.                               */
+static void
+rmopatmp(void){
+  if (opatmp != NULL)
+    unlink(opatmp);
+}
 
-      /* Read the grid of opacities from file:                              */
-      tr_output(TOUT_INFO, "Reading opacity file: '%s'.\n", tr->f_opa);
-      readopacity(tr, tr->fp_opa);
 
-      /* Set progress indicator and return success:                         */
-      tr->pi |= TRPI_OPACITY;
-      return 0;
+/* FUNCTION: Compute the molecules, temperatures, and wavenumbers of this
+   run that the opacity file lacks, and replace the file with the merged
+   grid (see calcopacity()).  The new file is written under a temporary
+   name and then renamed, so that the existing file stays intact until the
+   merged grid is complete.  The temporary file is removed if any error
+   exits the program before then.
+   Return: 0 on success                                                     */
+static int
+extendopacity(struct transit *tr){ /* transit struct                        */
+  struct opacity *op = tr->ds.op,  /* The opacity struct                    */
+                 old;              /* The grid of the file                  */
+  char *tmp = (char *)calloc(strlen(tr->f_opa)+32, sizeof(char));
+  static int rmreg = 0;
+  int fd;
+  FILE *fp = NULL;
+
+  /* Read (map) the existing grid:                                          */
+  memset(&old, 0, sizeof(struct opacity));
+  tr->ds.op = &old;
+  tr_output(TOUT_INFO, "Reading opacity file to extend: '%s'.\n",
+                       tr->f_opa);
+  readopacity(tr, tr->fp_opa);
+  fclose(tr->fp_opa);
+  tr->ds.op = op;
+
+  sprintf(tmp, "%s.XXXXXX", tr->f_opa);
+  if ((fd=mkstemp(tmp)) < 0 || fchmod(fd, 0644) != 0 ||
+      (fp=fdopen(fd, "w+b")) == NULL){
+    tr_output(TOUT_ERROR, "Opacity filename '%s' cannot be opened for "
+      "writing.\n", tmp);
+    if (fd >= 0){
+      close(fd);
+      unlink(tmp);
     }
+    exit(EXIT_FAILURE);
+  }
+  opatmp = tmp;
+  if (!rmreg)
+    rmreg = (atexit(rmopatmp) == 0);
+
+  /* Calculate Voigt profiles:                                              */
+  tr_output(TOUT_INFO, "Calculating grid of Voigt profiles.\n");
+  calcprofiles(tr);
+
+  /* Calculate the missing opacities, and write the merged grid:            */
+  tr_output(TOUT_INFO, "Extending grid of opacities: '%s'.\n", tr->f_opa);
+  calcopacity(tr, fp, &old);
+  if (rename(tmp, tr->f_opa) != 0){
+    tr_output(TOUT_ERROR, "Could not replace the opacity file '%s' (%s).\n",
+              tr->f_opa, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+  opatmp = NULL;
+  tr->fp_opa = fp;
+
+  /* Free the existing grid (its arrays, unless they were mapped):          */
+  if (old.mapaddr == NULL){
+    free(old.molID);
+    free(old.temp);
+    free(old.press);
+    free(old.wns);
+  }
+  freemem_opacity(&old, &tr->pi);
+  free(tmp);
 
-    /* If no process has claimed to be the master, claim it:                */
-    if (op.hint->master_PID == 0)
-      op.hint->master_PID = getpid();
+  /* Free the line-transition memory:                                       */
+  freemem_linetransition(&tr->ds.li->lt, &tr->pi);
+  tr->pi |= TRPI_READDATA;
+  tr->pi |= TRPI_READINFO;
 
-    /* Wait a few cycles in case multiple processes claimed it at once:     */
-    int i;
-    for (i = 0; i < 10; i++);
+  /* Set progress indicator and return success:                             */
+  tr->pi |= TRPI_OPACITY;
+  return 0;
+}
 
-    /* Check again to see if this process claimed the memory:               */
-    if (op.hint->master_PID == getpid()) {
 
-      /* Share the grid of opacities from file:                             */
-      tr_output(TOUT_INFO, "Sharing opacity file: '%s'.\n", tr->f_opa);
+/* FUNCTION: Allocate a zeroed opacity grid of size bytes, aligned like the
+   grid of a mapped opacity file.
+   Return: pointer to the grid, NULL on failure                             */
+static void *
+allocgrid(size_t size){  /* Size in bytes                                   */
+  void *grid;
+  if (posix_memalign(&grid, OPA_ALIGN, size) != 0)
+    return NULL;
+  return memset(grid, 0, size);
+}
 
-      if (shareopacity(tr, tr->fp_opa) || mountopacity(tr)) {
 
-        tr_output(TOUT_WARN, "Shared memory sh/mt error. Aborting.\n");
-        op.hint->status |= TSHM_ERROR;
+/* FUNCTION: Size in bytes of the opacity grid of op in the given
+   encoding (see encodefile()).                                             */
+static size_t
+opagridsize(struct opacity *op, /* Opacity struct with the grid dimensions  */
+            int format){        /* Grid encoding                            */
+  size_t nrow  = (size_t)op->Nlayer * op->Ntemp * op->Nmol,
+         nqblk = (op->Nwave + OPA_QBLOCK - 1) / OPA_QBLOCK;
+
+  if (format == OPA_FLOAT)
+    return nrow * op->Nwave * sizeof(float);
+  if (format == OPA_INT16)
+    return nrow * (2*nqblk*sizeof(float) +
+                   op->Nwave*sizeof(unsigned short));
+  return nrow * op->Nwave * sizeof(PREC_RES);
+}
 
-        /* Read the grid of opacities from file:                            */
-        tr_output(TOUT_INFO, "Reading opacity file: '%s'.\n",
-                                    tr->f_opa);
-        readopacity(tr, tr->fp_opa);
-      }
 
-      /* Assuming that all processes have attached to the two shared
-         memory segments, mark them for destruction as soon as all of the
-         processes have detached.                                           */
-      struct shmid_ds buf1, buf2;
-      shmctl(op.hintID, IPC_STAT, &buf1);
+/* FUNCTION: Encode the Nwave opacities row of a grid row as log10 of the
+   opacity: as floats into codes (OPA_FLOAT), or as 16-bit codes into
+   codes plus the offset and step of each block of OPA_QBLOCK values into
+   par (OPA_INT16), see encodefile().
+   Return: the largest relative error of the encoded values                 */
+static double
+encoderow(PREC_RES *row,  /* Opacities [Nwave]                              */
+          long Nwave,     /* Number of wavenumbers                          */
+          int format,     /* OPA_FLOAT or OPA_INT16                         */
+          void *codes,    /* Encoded values [Nwave]                         */
+          float *par){    /* Block offsets and steps [2*nqblk] (OPA_INT16)  */
+  long nqblk = (Nwave + OPA_QBLOCK - 1) / OPA_QBLOCK,
+       b, i, i0, i1;
+  double err = 0.0;
+
+  if (format == OPA_FLOAT){
+    float *lrow = (float *)codes;
+    for (i=0; i < Nwave; i++){
+      lrow[i] = log10(row[i]);
+      if (row[i] != 0)
+        err = fmax(err, fabs(exp(LN10*lrow[i]) - row[i]) / fabs(row[i]));
+    }
+    return err;
+  }
 
-      do {
-        shmctl(op.mainID, IPC_STAT, &buf2);
+  unsigned short *qrow = (unsigned short *)codes;
+  for (b=0; b < nqblk; b++){
+    double lmin = HUGE_VAL, lmax = -HUGE_VAL, v;
+    float off, step;
+    long q;
+    i0 = b*OPA_QBLOCK;
+    i1 = (b+1 < nqblk) ? (b+1)*OPA_QBLOCK : Nwave;
+    /* Range of log10(opacity) in the block:                                */
+    for (i=i0; i < i1; i++)
+      if (row[i] > 0){
+        lmin = fmin(lmin, log10(row[i]));
+        lmax = fmax(lmax, log10(row[i]));
+      }
+    off  = lmin < HUGE_VAL ? lmin : 0.0;
+    step = lmin < HUGE_VAL ? (lmax - lmin) / 65533.0 : 0.0;
+    par[2*b  ] = off;
+    par[2*b+1] = step;
+
+    for (i=i0; i < i1; i++){
+      q = 0;
+      if (row[i] > 0){
+        q = 1;
+        if (step > 0)
+          q += lround((log10(row[i]) - off) / step);
+        if (q < 1)
+          q = 1;
+        if (q > 65535)
+          q = 65535;
       }
-      while (buf2.shm_nattch != buf1.shm_nattch);
+      qrow[i] = q;
+      v = q ? exp(LN10*(off + (q-1)*(double)step)) : 0.0;
+      if (row[i] != 0)
+        err = fmax(err, fabs(v - row[i]) / fabs(row[i]));
+    }
+  }
+  return err;
+}
 
-      tr_output(TOUT_DEBUG, "Marking shared memory for removal.\n");
-      shmctl(op.hintID, IPC_RMID, &buf1);
-      shmctl(op.mainID, IPC_RMID, &buf2);
 
-      /* Set progress indicator and return success:                         */
-      tr->pi |= TRPI_OPACITY;
-      return 0;
+/* FUNCTION: Point the grid arrays of op into a contiguous opacity grid in
+   the encoding op->format (see encodefile()).
+   Return: 0 on success, -1 on allocation failure                           */
+static int
+mountgrid(struct opacity *op, /* Opacity struct                             */
+          char *grid){        /* Contiguous opacity grid                    */
+  long nrow  = op->Nlayer * op->Ntemp * op->Nmol,
+       nqblk = (op->Nwave + OPA_QBLOCK - 1) / OPA_QBLOCK;
+
+  if (op->format == OPA_FLOAT){
+    op->lgrid = (float *)grid;
+    return 0;
+  }
+  if (op->format == OPA_INT16){
+    op->qpar  = (float *)grid;
+    op->qgrid = (unsigned short *)(op->qpar + 2*nrow*nqblk);
+    return 0;
+  }
+  return indexopacity(op, (PREC_RES *)grid);
+}
+
+
+/* FUNCTION: Decode the values [i0, i1) of the row row ([layer][temp][mol]
+   index) of the opacity grid of op, in any encoding, into out[i0, i1).     */
+static void
+decoderow(struct opacity *op, /* Opacity struct                             */
+          long row,           /* Grid row                                   */
+          long i0, long i1,   /* Wavenumber-index range                     */
+          PREC_RES *out){     /* Decoded opacities [Nwave]                  */
+  long nqblk = (op->Nwave + OPA_QBLOCK - 1) / OPA_QBLOCK,
+       Nwave = op->Nwave,
+       i;
+
+  if (op->format == OPA_DOUBLE)
+    memcpy(out+i0, op->o[0][0][row]+i0, (i1-i0)*sizeof(PREC_RES));
+  else if (op->format == OPA_FLOAT)
+    for (i=i0; i < i1; i++)
+      out[i] = exp(LN10*op->lgrid[row*Nwave + i]);
+  else
+    for (i=i0; i < i1; i++){
+      unsigned short q = op->qgrid[row*Nwave + i];
+      const float *par = op->qpar + 2*(row*nqblk + i/OPA_QBLOCK);
+      out[i] = q ? exp(LN10*(par[0] + (q-1)*par[1])) : 0.0;
     }
+}
 
-    else {
 
-      while ((op.hint->status & TSHM_WRITTEN) == 0) {
+/* FUNCTION: Set the temperatures of the opacity grid op: the n sampled
+   temperatures temp, merged with those of the grid old being extended
+   (if not NULL).  Set in told the index in old of each temperature, -1
+   for those that old lacks.
+   Return: number of temperatures                                           */
+static long
+mergetemps(struct opacity *op,  /* Opacity struct                           */
+           PREC_RES *temp,      /* Sampled temperatures (ascending)         */
+           long n,              /* Number of sampled temperatures           */
+           struct opacity *old, /* Grid being extended, or NULL             */
+           long **told){        /* Index of each temperature in old         */
+  long nold = old ? old->Ntemp : 0,
+       i=0, j=0, k=0;
+
+  op->temp = (PREC_RES *)calloc(n+nold, sizeof(PREC_RES));
+  *told    = (long     *)calloc(n+nold, sizeof(long));
+  while (i < n || j < nold){
+    /* Same temperature in both arrays:                                     */
+    if (i < n && j < nold && fabs(temp[i] - old->temp[j]) < 1e-6){
+      i++;
+      (*told)[k] = j;
+      op->temp[k++] = old->temp[j++];
+    }
+    else if (j == nold || (i < n && temp[i] < old->temp[j])){
+      (*told)[k] = -1;
+      op->temp[k++] = temp[i++];
+    }
+    else{
+      (*told)[k] = j;
+      op->temp[k++] = old->temp[j++];
+    }
+  }
+  return k;
+}
 
-        /* If there's an error with the shared memory, abort.               */
-        if (op.hint->status & TSHM_ERROR) {
 
-          tr_output(TOUT_WARN, "Shared memory error. Aborting.\n");
+/* FUNCTION: Compute the opacities of the cell kiso of an extended grid
+   (see calcopacity()) at a temperature that the extended grid holds:
+   those of the molecules flagged in newmol, and those of the other
+   molecules beyond the wavenumber-index range [w0, w1) kept from the
+   grid.
+   Return: 0 on success                                                     */
+static int
+extendcell(struct transit *tr,  /* transit struct                           */
+           struct extwork *ew,  /* Scratch buffers, for the cell            */
+           PREC_RES **kiso,     /* Cell opacities [mol][wn]                 */
+           PREC_ATM temp,       /* Temperature                              */
+           PREC_ATM *density,   /* Density per species                      */
+           double *Z,           /* Partition function per isotope           */
+           _Bool *newmol,       /* New-molecule flags [Nmol]                */
+           long w0, long w1){   /* Wavenumber range kept from the grid      */
+  long Nmol = tr->ds.op->Nmol,
+       m;
+  _Bool oldmol[Nmol], anynew=0;
+  int rn = 0;
+
+  for (m=0; m < Nmol; m++){
+    oldmol[m] = !newmol[m];
+    anynew   |=  newmol[m];
+  }
+  if (anynew){
+    ew->molmask = newmol;
+    rn = computemolext(tr, kiso, temp, density, Z, 1, ew);
+  }
+  ew->molmask = oldmol;
+  if (rn == 0 && w0 > 0){
+    ew->k1 = w0;
+    rn = computemolext(tr, kiso, temp, density, Z, 1, ew);
+  }
+  if (rn == 0 && w1 < tr->wns.n){
+    ew->k0 = w1;
+    ew->k1 = -1;
+    rn = computemolext(tr, kiso, temp, density, Z, 1, ew);
+  }
+  ew->k0 = 0;
+  ew->k1 = -1;
+  ew->molmask = NULL;
+  return rn;
+}
 
-          /* Read the grid of opacities from file:                          */
-          tr_output(TOUT_INFO, "Reading opacity file: '%s'.\n", tr->f_opa);
-          readopacity(tr, tr->fp_opa);
 
-          /* Set progress indicator and return success:                     */
-          tr->pi |= TRPI_OPACITY;
-          return 0;
-        }
-      }
+/* FUNCTION: Write zeros to fp until it reaches the byte offset off.        */
+static void
+opapad(FILE *fp,    /* Opacity file                                         */
+       long off){   /* Target offset                                        */
+  long pos = ftell(fp);
+  while (pos++ < off)
+    fputc(0, fp);
+}
+
+
+/* FUNCTION: Write the n bytes of buf at the byte offset off of the file
+   descriptor fd.  Threads may write disjoint parts of a file at once.
+   Return: 0 on success, -1 on failure                                      */
+static int
+pwriteall(int fd,          /* File descriptor                               */
+          const void *buf, /* Data                                          */
+          size_t n,        /* Number of bytes                               */
+          off_t off){      /* Byte offset in the file                       */
+  ssize_t w;
+  while (n > 0){
+    if ((w=pwrite(fd, buf, n, off)) < 0){
+      if (errno == EINTR)
+        continue;
+      return -1;
     }
+    buf  = (const char *)buf + w;
+    n   -= w;
+    off += w;
+  }
+  return 0;
+}
 
-    /* If there's an error attaching or mounting the memory, abort.     */
-    if (attachopacity(tr) || mountopacity(tr)) {
 
-      tr_output(TOUT_WARN, "Shared memory att/mt error. Aborting.\n");
+/* FUNCTION: Write the header and the molID, temp, press, and wns arrays of
+   the opacity grid of op at the start of fp, padded up to the grid (see
+   opaoffsets()).                                                           */
+static void
+writeopahead(struct opacity *op, /* Opacity struct                          */
+             FILE *fp){          /* Opacity file                            */
+  struct opahead head = {OPA_MAGIC, OPA_VERSION, op->Nmol, op->Ntemp,
+                         op->Nlayer, op->Nwave};
+  long off[5];  /* Byte offsets of molID, temp, press, wns, and grid        */
+
+  opaoffsets(op, off);
+  head.grid   = off[4];
+  head.format = op->format;
+  rewind(fp);
+  fwrite(&head, sizeof(struct opahead), 1, fp);
+  fwrite(op->molID, sizeof(int),      op->Nmol,   fp);
+  opapad(fp, off[1]);
+  fwrite(op->temp,  sizeof(PREC_RES), op->Ntemp,  fp);
+  fwrite(op->press, sizeof(PREC_RES), op->Nlayer, fp);
+  fwrite(op->wns,   sizeof(PREC_RES), op->Nwave,  fp);
+  opapad(fp, off[4]);
+}
 
-      /* Read the grid of opacities from file:                          */
-      tr_output(TOUT_INFO, "Reading opacity file: '%s'.\n", tr->f_opa);
-      readopacity(tr, tr->fp_opa);
+
+/* FUNCTION: Encode the double opacity grid of op, written to the opacity
+   file fd at the byte offset goff, as log10 of the opacity.  OPA_FLOAT
+   stores it as floats.  OPA_INT16 splits each [layer][temp][mol] row
+   into blocks of OPA_QBLOCK wavenumbers, each one with a (float) offset
+   and step, the smallest log10(opacity) of the block and its range over
+   65533: code 0 stands for a zero opacity and code q > 0 for
+   log10(opacity) = offset + (q-1)*step.  The offsets and steps of every
+   block come first, then the codes (see mountgrid()).  interpolmolext()
+   decodes the values as it interpolates them.
+   If the encoding meets the tolerance tol, replace the grid with it.  The
+   rows are encoded one at a time from a read-only mapping of the file
+   into the space past the double grid, then moved down to goff, thus the
+   memory use does not depend on the grid size.
+   Return: 0 if the file holds the encoded grid, 1 if it keeps the double
+           grid (the encoding exceeds tol), -1 on failure, and in maxerr
+           the largest relative error of the encoded values                 */
+static int
+encodefile(struct opacity *op, /* Opacity struct (grid dimensions)          */
+           int fd,             /* Opacity file, with the double grid        */
+           long goff,          /* Byte offset of the grid                   */
+           int format,         /* OPA_FLOAT or OPA_INT16                    */
+           double tol,         /* Largest relative error allowed            */
+           int nthreads,       /* Number of threads                         */
+           double *maxerr){    /* Largest relative error                    */
+  long nrow  = op->Nlayer * op->Ntemp * op->Nmol,
+       nqblk = (op->Nwave + OPA_QBLOCK - 1) / OPA_QBLOCK,
+       Nwave = op->Nwave,
+       r;
+  size_t dsize = opagridsize(op, OPA_DOUBLE),
+         esize = opagridsize(op, format),
+         csize = (format == OPA_FLOAT) ? sizeof(float) :
+                                         sizeof(unsigned short),
+         n;
+  off_t eoff = (goff + dsize + OPA_ALIGN - 1) / OPA_ALIGN * OPA_ALIGN,
+        pos;
+  double err = 0.0;
+  int fail = 0;
+  char *map, *buf;
+
+  map = mmap(NULL, goff + dsize, PROT_READ, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED)
+    return -1;
+
+  #pragma omp parallel num_threads(nthreads) reduction(max:err)           \
+                       reduction(||:fail)
+  {
+    char  *codes = (char  *)malloc(Nwave*sizeof(float));
+    float *par   = (float *)malloc(2*nqblk*sizeof(float));
+    int w;
+    #pragma omp for schedule(static)
+    for (r=0; r < nrow; r++){
+      err = fmax(err, encoderow((PREC_RES *)(map + goff) + r*Nwave, Nwave,
+                                format, codes, par));
+      if (format == OPA_FLOAT)
+        w = pwriteall(fd, codes, Nwave*csize, eoff + r*Nwave*csize);
+      else
+        w = pwriteall(fd, par, 2*nqblk*sizeof(float),
+                      eoff + 2*r*nqblk*sizeof(float))                   ||
+            pwriteall(fd, codes, Nwave*csize,
+                      eoff + 2*nrow*nqblk*sizeof(float) + r*Nwave*csize);
+      fail = fail || w != 0;
     }
+    free(codes);
+    free(par);
   }
+  munmap(map, goff + dsize);
+  *maxerr = err;
+  if (!fail && err > tol)
+    return ftruncate(fd, goff + dsize) == 0 ? 1 : -1;
+
+  /* Move the encoded grid down to goff (it starts past the double grid,
+     thus the copy never overwrites what it has yet to read):               */
+  buf = (char *)malloc(1 << 20);
+  for (pos=0; !fail && pos < (off_t)esize; pos += n){
+    n = esize - pos < (1 << 20) ? esize - pos : (1 << 20);
+    fail = pread(fd, buf, n, eoff + pos) != (ssize_t)n ||
+           pwriteall(fd, buf, n, goff + pos) != 0;
+  }
+  free(buf);
+  if (fail || ftruncate(fd, goff + esize) != 0)
+    return -1;
+  return 0;
+}
 
-  /* Should not attempt to use shared memory:                               */
-  else {
 
-    /* Read the grid of opacities from file:                                */
-    tr_output(TOUT_INFO, "Reading opacity file: '%s'.\n", tr->f_opa);
-    readopacity(tr, tr->fp_opa);
+/* FUNCTION: Write the Voigt-profile cache file name, evaluating every
+   profile of the grid one at a time (see profilecache()), so that
+   writing it holds at most one more profile in memory.  The file is
+   written under a unique temporary name and then renamed, so that other
+   processes never see a partial file.
+   Return: 0 on success                                                     */
+static int
+writeprofcache(struct transit *tr,      /* transit struct                   */
+               struct vprofhead *head,  /* Cache-file header                */
+               char *name){             /* Cache file name                  */
+  struct opacity *op=tr->ds.op;     /* Opacity struct                       */
+  long n, ntot = op->nDop*op->nLor,
+       *off = (long *)calloc(ntot, sizeof(long));
+  char *tmp = (char *)calloc(strlen(name)+32, sizeof(char));
+  int i, j, fd, rn = 0;
+  _Bool evaluated;
+  FILE *fp = NULL;
+
+  sprintf(tmp, "%s.XXXXXX", name);
+  if ((fd=mkstemp(tmp)) < 0 || fchmod(fd, 0644) != 0 ||
+      (fp=fdopen(fd, "wb")) == NULL){
+    tr_output(TOUT_WARN, "Voigt-profile cache '%s' cannot be opened for "
+      "writing.\n", tmp);
+    if (fd >= 0){
+      close(fd);
+      unlink(tmp);
+    }
+    free(off);
+    free(tmp);
+    return -1;
+  }
+  tr_output(TOUT_INFO, "Writing Voigt-profile cache: '%s'.\n", name);
+
+  /* Offset of each profile:                                                */
+  head->size = 0;
+  for (n=0; n<ntot; n++){
+    i = n / op->nLor;
+    j = n % op->nLor;
+    if (i != 0 && op->aDop[i]*10.0 < op->aLor[j])
+      off[n] = -1;
+    else{
+      off[n] = head->size;
+      head->size += op->profsize[i][j] + 1;
+    }
   }
+  fwrite(head, sizeof(struct vprofhead), 1, fp);
+  fwrite(off, sizeof(long), ntot, fp);
+  /* Stream the profiles into the file, one at a time (the cache replaces
+     those evaluated here, thus they take no memory of the budget):         */
+  for (n=0; n<ntot; n++)
+    if (off[n] >= 0){
+      i = n / op->nLor;
+      j = n % op->nLor;
+      evaluated = op->profile[i][j] == NULL;
+      fwrite(voigtprofile(tr, i, j), sizeof(PREC_VOIGT),
+             op->profsize[i][j]+1, fp);
+      if (evaluated){
+        op->profmem -= (op->profsize[i][j]+1) * sizeof(PREC_VOIGT);
+        free(op->profile[i][j]);
+        op->profile[i][j] = NULL;
+      }
+    }
 
-  /* Set progress indicator and return success:                           */
-  tr->pi |= TRPI_OPACITY;
+  rn = ferror(fp);
+  if (fclose(fp) != 0 || rn || rename(tmp, name) != 0){
+    tr_output(TOUT_WARN, "Could not write the Voigt-profile cache '%s'.\n",
+                         name);
+    unlink(tmp);
+    rn = -1;
+  }
+  free(off);
+  free(tmp);
+  return rn;
+}
+
+
+/* FUNCTION: Map the Voigt-profile cache file name, and check that it
+   matches the header head.
+   Return: address of the mapping (of *size bytes), NULL on failure         */
+static void *
+mapprofcache(char *name,              /* Cache file name                    */
+             struct vprofhead *head,  /* Expected header                    */
+             size_t *size){           /* Mapping size                       */
+  long ntot = head->nDop*head->nLor;
+  struct vprofhead *fhead;
+  struct stat st;
+  void *addr = MAP_FAILED;
+  int fd;
+
+  if ((fd=open(name, O_RDONLY)) < 0)
+    return NULL;
+  if (fstat(fd, &st) == 0 &&
+      st.st_size >= (off_t)(sizeof(struct vprofhead) + ntot*sizeof(long)))
+    addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED)
+    return NULL;
+
+  fhead = (struct vprofhead *)addr;
+  if (memcmp(fhead, head, (char *)&head->size - (char *)head) != 0 ||
+      st.st_size != (off_t)(sizeof(struct vprofhead) + ntot*sizeof(long) +
+                            fhead->size*sizeof(PREC_VOIGT))){
+    tr_output(TOUT_WARN, "Invalid Voigt-profile cache '%s'.\n", name);
+    munmap(addr, st.st_size);
+    return NULL;
+  }
+  *size = st.st_size;
+  return addr;
+}
+
+
+/* FUNCTION: Point the grid of Voigt profiles into the profile cache file
+   of the current sampling parameters, under the directory th->f_voigt.
+   The file is mapped read-only, thus the processes that use it share its
+   pages through the page cache.  If the file does not exist (or is
+   invalid), evaluate the profiles and write it first, holding an
+   exclusive lock on name.lock, so that the processes that miss the cache
+   at once wait for the first one to write it instead of each writing it.
+   Return: 0 on success, nonzero if the cache is unusable (the profiles
+           are then evaluated on demand)                                    */
+static int
+profilecache(struct transit *tr){
+  struct transithint *th = tr->ds.th; /* transithint struct                 */
+  struct opacity *op=tr->ds.op;     /* Opacity struct                       */
+  struct vprofhead head;
+  unsigned long long key = 14695981039346656037ULL; /* FNV-1a hash          */
+  unsigned char *b;
+  long n, ntot = op->nDop*op->nLor, *off;
+  PREC_VOIGT *data;
+  char *name, *lock;
+  size_t size;
+  void *addr;
+  int lfd;
+
+  /* Parameters that determine the profiles, and their hash:                */
+  memset(&head, 0, sizeof(struct vprofhead));
+  head.magic      = VPC_MAGIC;
+  head.version    = VPC_VERSION;
+  head.dwn        = tr->wns.d/tr->owns.o;
+  head.dmin       = th->dmin;
+  head.dmax       = th->dmax;
+  head.lmin       = th->lmin;
+  head.lmax       = th->lmax;
+  head.timesalpha = tr->timesalpha;
+  head.nwave      = tr->owns.n;
+  head.nDop       = op->nDop;
+  head.nLor       = op->nLor;
+  head.flags      = tr->voigtflags;
+  for (b=(unsigned char *)&head.dwn; b < (unsigned char *)&head.size; b++){
+    key ^= *b;
+    key *= 1099511628211ULL;
+  }
+  name = (char *)calloc(strlen(th->f_voigt)+32, sizeof(char));
+  sprintf(name, "%s/voigt-%016llx.vpc", th->f_voigt, key);
+
+  /* Map the cache.  On a miss, take the lock and look again (another
+     process may have written the cache meanwhile), else write it:          */
+  if ((addr=mapprofcache(name, &head, &size)) == NULL){
+    lock = (char *)calloc(strlen(name)+8, sizeof(char));
+    sprintf(lock, "%s.lock", name);
+    if ((lfd=open(lock, O_RDWR | O_CREAT, 0644)) < 0)
+      tr_output(TOUT_WARN, "Could not open the Voigt-profile cache lock "
+                           "'%s' (%s).\n", lock, strerror(errno));
+    else
+      while (flock(lfd, LOCK_EX) != 0 && errno == EINTR);
+    if ((addr=mapprofcache(name, &head, &size)) != NULL)
+      tr_output(TOUT_INFO, "Reading Voigt-profile cache: '%s'.\n", name);
+    else if (writeprofcache(tr, &head, name) == 0)
+      addr = mapprofcache(name, &head, &size);
+    /* Closing the lock file releases the lock:                             */
+    if (lfd >= 0)
+      close(lfd);
+    free(lock);
+    if (addr == NULL){
+      tr_output(TOUT_WARN, "Evaluating the Voigt profiles without cache.\n");
+      free(name);
+      return -1;
+    }
+  }
+  else
+    tr_output(TOUT_INFO, "Reading Voigt-profile cache: '%s'.\n", name);
+  free(name);
+
+  /* Point the profiles into the mapping (freeing those evaluated while
+     writing it):                                                           */
+  op->vpcaddr = addr;
+  op->vpcsize = size;
+  off  = (long *)((struct vprofhead *)addr + 1);
+  data = (PREC_VOIGT *)(off + ntot);
+  for (n=0; n<ntot; n++){
+    free(op->profile[0][n]);
+    op->profile[0][n] = (off[n] >= 0) ? data + off[n] : NULL;
+  }
+  op->profmem = 0;
   return 0;
 }
 
 
-/*  FUNCTION:  Calculate a grid of Voigt profiles.                          */
+/* FUNCTION: Bracket the pressure p between two consecutive samples of
+   the monotonic (increasing or decreasing) pressure array press.
+   Pressures beyond the array take its closest end.
+   Return: index j of the first sample of the bracket, and in frac the
+   position of p between press[j] and press[j+1] in log(pressure)           */
+long
+pressbracket(PREC_RES *press, /* Pressure samples                           */
+             long n,          /* Number of samples                          */
+             double p,        /* Pressure                                   */
+             double *frac){   /* Fractional position in log(pressure)       */
+  long lo=0, hi=n-1, mid;
+  double sign = press[n-1] < press[0] ? -1.0 : 1.0;
+
+  *frac = 0.0;
+  if (n < 2 || sign*(p - press[0]) <= 0)
+    return 0;
+  if (sign*(p - press[n-1]) >= 0)
+    return n-1;
+  /* sign*press[lo] <= sign*p < sign*press[hi]:                             */
+  while (hi-lo > 1){
+    mid = (lo+hi)/2;
+    if (sign*(press[mid] - p) > 0)
+      hi = mid;
+    else
+      lo = mid;
+  }
+  *frac = log(p/press[lo]) / log(press[hi]/press[lo]);
+  return lo;
+}
+
+
+/* FUNCTION: Warn if the atmospheric pressures extend beyond the pressures
+   of the opacity grid, where interpolmolext() takes the closest grid
+   pressure.                                                                */
+static void
+checkpressrange(struct transit *tr){ /* transit struct                      */
+  struct opacity *op = tr->ds.op;    /* Opacity struct                      */
+  double plo = fmin(op->press[0], op->press[op->Nlayer-1]),
+         phi = fmax(op->press[0], op->press[op->Nlayer-1]),
+         amin = HUGE_VAL, amax = 0.0, p;
+  long r, nout = 0;
+
+  for (r=0; r < tr->rads.n; r++){
+    p = tr->atm.p[r] * tr->atm.pfct;
+    amin = fmin(amin, p);
+    amax = fmax(amax, p);
+    if (p < plo || p > phi)
+      nout++;
+  }
+  if (nout > 0)
+    tr_output(TOUT_WARN, "%li atmospheric layers (pressures %.3e to %.3e "
+      "bar) lie out of the opacity grid's pressure range (%.3e to %.3e "
+      "bar).  They use the closest grid pressure.\n", nout, amin/1e6,
+      amax/1e6, plo/1e6, phi/1e6);
+}
+
+
+/* FUNCTION: Set the pressure samples of the opacity grid, and the
+   composition (species abundances and mean molecular mass) at each one.
+   Without a pressure sampling (pnum hint of zero), the grid takes the
+   atmospheric layers.  Else, it takes pnum log-uniform pressures from plow
+   to phigh, with the composition interpolated in log(pressure) from the
+   atmospheric layers (constant beyond them).  The composition only sets
+   the pressure broadening of the lines, thus such a grid serves any
+   atmosphere of a similar broadening composition, whatever its layers.
+   Return: number of pressure samples                                       */
+static long
+gridpressures(struct transit *tr){ /* transit struct                        */
+  struct transithint *th = tr->ds.th;
+  struct opacity *op = tr->ds.op;
+  struct molecules *mol = tr->ds.mol;
+  long nrad = tr->rads.n, /* Number of atmospheric layers                   */
+       n, r, i, j;
+  double frac, *patm;
+
+  n = op->Nlayer = th->pnum > 0 ? th->pnum : nrad;
+  op->press = (PREC_RES *)calloc(n, sizeof(PREC_RES));
+  op->mm    = (double   *)calloc(n, sizeof(double));
+  op->q     = (double   *)calloc(n*mol->nmol, sizeof(double));
+  patm      = (double   *)calloc(nrad, sizeof(double));
+  if (!op->press || !op->mm || !op->q || !patm){
+    tr_output(TOUT_ERROR, "Allocation fail.\n");
+    exit(EXIT_FAILURE);
+  }
+  /* Atmospheric pressures in CGS units:                                    */
+  for (i=0; i<nrad; i++)
+    patm[i] = tr->atm.p[i]*tr->atm.pfct;
+
+  /* The atmospheric layers:                                                */
+  if (th->pnum == 0){
+    for (r=0; r<n; r++){
+      op->press[r] = patm[r];
+      op->mm[r]    = tr->atm.mm[r];
+      for (j=0; j < mol->nmol; j++)
+        op->q[j*n+r] = mol->molec[j].q[r];
+    }
+    free(patm);
+    return n;
+  }
+
+  /* Log-uniform pressures (bar to CGS units), and their composition:       */
+  for (r=0; r<n; r++){
+    op->press[r] = 1e6 * pow(10, log10(th->plow) +
+                     r*(log10(th->phigh) - log10(th->plow))/(n-1.0));
+    i = pressbracket(patm, nrad, op->press[r], &frac);
+    op->mm[r] = tr->atm.mm[i];
+    if (frac > 0)
+      op->mm[r] += frac*(tr->atm.mm[i+1] - tr->atm.mm[i]);
+    for (j=0; j < mol->nmol; j++){
+      op->q[j*n+r] = mol->molec[j].q[i];
+      if (frac > 0)
+        op->q[j*n+r] += frac*(mol->molec[j].q[i+1] - mol->molec[j].q[i]);
+    }
+  }
+  free(patm);
+  return n;
+}
+
+
+/*  FUNCTION:  Set up a grid of Voigt profiles.  Only the profile sizes
+    are computed here, voigtprofile() evaluates each profile on its first
+    use, unless they come from a profile cache (see profilecache()).        */
 int
 calcprofiles(struct transit *tr){
   struct transithint *th = tr->ds.th; /* transithint struct                 */
@@ -222,10 +913,7 @@ calcprofiles(struct transit *tr){
   int i, j;                         /* for-loop indices                     */
   int nDop, nLor;                   /* Number of Doppler and Lorentz-widths */
   double Lmin, Lmax, Dmin, Dmax;    /* Minimum and maximum widths           */
-  PREC_VOIGT ***profile;            /* Grid of Voigt profiles               */
   float timesalpha=tr->timesalpha;  /* Voigt wings width                    */
-  struct timeval tv;  /* Time-keeping variables                             */
-  double t0=0.0;
 
   /* Make logscale grid for the profile widths:                             */
   /* FINDME: Add check that these numbers make sense                        */
@@ -237,6 +925,12 @@ calcprofiles(struct transit *tr){
   Lmax = th->lmax;
   op->aDop = logspace(Dmin, Dmax, nDop);
   op->aLor = logspace(Lmin, Lmax, nLor);
+  /* The log-spacing of the samples, to find the closest sample of a width
+     without a search (see widthindex()):                                   */
+  op->lDop  = log10(Dmin);
+  op->dlDop = (log10(Dmax) - op->lDop)/(nDop-1.0);
+  op->lLor  = log10(Lmin);
+  op->dlLor = (log10(Lmax) - op->lLor)/(nLor-1.0);
 
   /* Allocate array for the profile half-size:                              */
   op->profsize    = (PREC_NREC **)calloc(nDop,      sizeof(PREC_NREC *));
@@ -244,43 +938,47 @@ calcprofiles(struct transit *tr){
   for (i=1; i<nDop; i++)
     op->profsize[i] = op->profsize[0] + i*nLor;
 
-  /* Allocate grid of Voigt profiles:                                       */
+  /* Allocate grid of Voigt profiles (evaluated when first used), and the
+     memory budget:                                                         */
   op->profile    = (PREC_VOIGT ***)calloc(nDop,      sizeof(PREC_VOIGT **));
   op->profile[0] = (PREC_VOIGT  **)calloc(nDop*nLor, sizeof(PREC_VOIGT *));
   for (i=1; i<nDop; i++){
     op->profile[i] = op->profile[0] + i*nLor;
   }
-  profile = op->profile;
+  op->profuse    = (long *)calloc(nDop*nLor, sizeof(long));
+  op->profbudget = th->voigtmem * 1024 * 1024;
   tr_output(TOUT_RESULT, "Number of Voigt profiles: %d.\n", nDop*nLor);
 
-  t0 = timestart(tv, "Begin Voigt profiles calculation.");
-  /* Evaluate the profiles for the array of widths:                         */
+  /* Size of the profiles for the array of widths:                          */
   for   (i=0; i<nDop; i++){
     for (j=0; j<nLor; j++){
-      /* Skip calculation if Doppler width << Lorentz width:                */
-      /* Set size and pointer to previous profile:                          */
-      if (op->aDop[i]*10.0 < op->aLor[j]  &&  i != 0){
+      /* If Doppler width << Lorentz width, take the previous profile:      */
+      if (op->aDop[i]*10.0 < op->aLor[j]  &&  i != 0)
         op->profsize[i][j] = op->profsize[i-1][j];
-        profile[i][j] = profile[i-1][j];
-      }
-      else{ /* Calculate a new profile for given widths:                    */
-        op->profsize[i][j] = getprofile(&profile[i][j],
-                             tr->wns.d/tr->owns.o, op->aDop[i], op->aLor[j],
-                             timesalpha, tr->owns.n);
-      }
+      else
+        op->profsize[i][j] = profilesize(tr->wns.d/tr->owns.o, op->aDop[i],
+                                op->aLor[j], timesalpha, tr->owns.n) / 2;
       tr_output(TOUT_DEBUG, "Profile[%2d][%2d] size = %4li  (D=%.3g, "
         "L=%.3g).\n", i, j, 2*op->profsize[i][j]+1, op->aDop[i], op->aLor[j]);
     }
   }
-  t0 = timecheck(verblevel, 0, 0, "End Voigt-profile calculation.", tv, t0);
+
+  /* Use the profile cache, if requested:                                   */
+  if (th->f_voigt != NULL)
+    profilecache(tr);
   return 0;
 }
 
 /* FUNCTION:  Calculate opacities for the grid of wavenumber, radius,
-   and temperature arrays for each molecule.                                */
+   and temperature arrays for each molecule.  If old is not NULL, extend
+   its grid: the new grid holds the molecules, temperatures, and
+   wavenumbers of both, and only the cells that old lacks are computed
+   (old must have the same pressures, and wavenumbers within those of
+   the run).                                                                */
 int
 calcopacity(struct transit *tr,
-            FILE *fp){
+            FILE *fp,
+            struct opacity *old){  /* Grid to extend, or NULL              */
   struct opacity *op=tr->ds.op;     /* Opacity struct                       */
   struct isotopes  *iso=tr->ds.iso; /* Isotopes struct                      */
   struct molecules *mol=tr->ds.mol; /* Molecules struct                     */
@@ -290,29 +988,28 @@ calcopacity(struct transit *tr,
       rn, iso1db;
   double *z;
   int k;
-
-  PREC_ATM *density = (PREC_ATM *)calloc(mol->nmol, sizeof(PREC_ATM));
-  double   *Z       = (double   *)calloc(iso->n_i,  sizeof(double));
+  _Bool *newmol;   /* Molecules that old lacks                              */
+  long *told,      /* Index of the grid's temperatures in old               */
+       w0=0, w1=0, /* Wavenumber-index range of old in the grid             */
+       k0=0, k1=0; /* Range of old's values kept in the grid                */
 
   /* Make temperature array from hinted values:                             */
   maketempsample(tr);
-  Ntemp = op->Ntemp = tr->temp.n;
-  op->temp = (PREC_RES *)calloc(Ntemp, sizeof(PREC_RES));
-  for (i=0; i<Ntemp; i++)
-    op->temp[i] = tr->temp.v[i];
   /* Temperature boundaries check:                                          */
-  if (op->temp[0] < li->tmin) {
+  if (tr->temp.v[0] < li->tmin) {
     tr_output(TOUT_ERROR, "The opacity file attempted to sample a "
       "temperature (%.1f K) below the lowest allowed "
-      "TLI temperature (%.1f K).\n", op->temp[0], li->tmin);
+      "TLI temperature (%.1f K).\n", tr->temp.v[0], li->tmin);
     exit(EXIT_FAILURE);
   }
-  if (op->temp[Ntemp-1] > li->tmax) {
+  if (tr->temp.v[tr->temp.n-1] > li->tmax) {
     tr_output(TOUT_ERROR, "The opacity file attempted to sample a "
       "temperature (%.1f K) beyond the highest allowed "
-      "TLI temperature (%.1f K).\n", op->temp[Ntemp-1], li->tmax);
+      "TLI temperature (%.1f K).\n", tr->temp.v[tr->temp.n-1], li->tmax);
     exit(EXIT_FAILURE);
   }
+  /* Merged with the temperatures of the grid to extend:                    */
+  Ntemp = op->Ntemp = mergetemps(op, tr->temp.v, tr->temp.n, old, &told);
   tr_output(TOUT_RESULT, "There are %li temperature samples.\n", Ntemp);
 
   /* Evaluate the partition at these temperatures:                          */
@@ -338,27 +1035,47 @@ calcopacity(struct transit *tr,
     }
   }
 
-  /* Get pressure array from transit (save in CGS units):                   */
-  Nlayer = op->Nlayer = tr->rads.n;
-  op->press = (PREC_RES *)calloc(Nlayer, sizeof(PREC_RES));
-  for (i=0; i<Nlayer; i++)
-    op->press[i] = tr->atm.p[i]*tr->atm.pfct;
-  tr_output(TOUT_RESULT, "There are %li radius samples.\n", Nlayer);
+  /* Pressure array (in CGS units) and composition of the grid:            */
+  Nlayer = gridpressures(tr);
+  tr_output(TOUT_RESULT, "There are %li pressure samples.\n", Nlayer);
+  if (old != NULL){
+    for (r=0; r < Nlayer && r < old->Nlayer; r++)
+      if (fabs(op->press[r] - old->press[r]) > 1e-6*old->press[r])
+        break;
+    if (r < Nlayer && r < old->Nlayer){
+      tr_output(TOUT_ERROR, "The pressure %d of the opacity file to extend "
+        "(%.6e bar) does not match that of this run (%.6e bar).\n", r,
+        1e-6*old->press[r], 1e-6*op->press[r]);
+      exit(EXIT_FAILURE);
+    }
+    if (Nlayer != old->Nlayer){
+      tr_output(TOUT_ERROR, "The number of pressures of the opacity file to "
+        "extend (%li) does not match that of this run (%li).\n",
+        old->Nlayer, Nlayer);
+      exit(EXIT_FAILURE);
+    }
+  }
 
-  /* Make molecules array from transit:                                     */
-  Nmol = op->Nmol = tr->ds.iso->nmol;
-  op->molID = (int *)calloc(Nmol, sizeof(int));
-  tr_output(TOUT_RESULT, "There are %li molecules with line "
-    "transitions.\n", Nmol);
-  for (i=0, j=0; i<iso->n_i; i++){
+  /* Make molecules array from transit (after those of the grid to
+     extend):                                                               */
+  Nmol = tr->ds.iso->nmol + (old ? old->Nmol : 0);
+  op->molID = (int   *)calloc(Nmol, sizeof(int));
+  newmol    = (_Bool *)calloc(Nmol, sizeof(_Bool));
+  for (j=0; old != NULL && j < old->Nmol; j++)
+    op->molID[j] = old->molID[j];
+  for (i=0; i<iso->n_i; i++){
     /* If this molecule is not yet in molID array, add it's universal ID:   */
     if (valueinarray(op->molID, mol->ID[iso->imol[i]], j) < 0){
       op->molID[j++] = mol->ID[iso->imol[i]];
       tr_output(TOUT_DEBUG, "Isotope's (%d) molecule ID: %d (%s) "
         "added at position %d.\n", i, op->molID[j-1],
         mol->name[iso->imol[i]], j-1);
+      newmol[j-1] = (old != NULL);
     }
   }
+  Nmol = op->Nmol = j;
+  tr_output(TOUT_RESULT, "There are %li molecules with line "
+    "transitions.\n", Nmol);
 
   /* Get wavenumber array from transit:                                     */
   Nwave = op->Nwave = tr->wns.n;
@@ -367,95 +1084,440 @@ calcopacity(struct transit *tr,
     op->wns[i] = tr->wns.v[i];
   tr_output(TOUT_RESULT, "There are %li wavenumber samples.\n", Nwave);
 
-  /* Allocate opacity array:                                                */
+  /* The wavenumbers of the grid to extend, within those of this run:       */
+  if (old != NULL){
+    double dwn = op->wns[1] - op->wns[0];
+    w0 = lround((old->wns[0] - op->wns[0]) / dwn);
+    w1 = w0 + old->Nwave;
+    for (i=0; w0 >= 0 && w1 <= Nwave && i < old->Nwave; i++)
+      if (fabs(old->wns[i] - op->wns[w0+i]) > 1e-6*dwn)
+        break;
+    if (w0 < 0 || w1 > Nwave || i != old->Nwave){
+      tr_output(TOUT_ERROR, "The wavenumbers of the opacity file to extend "
+        "(%.4f--%.4f cm-1) are not a subset of those of this run "
+        "(%.4f--%.4f cm-1, every %.4f cm-1).\n", old->wns[0],
+        old->wns[old->Nwave-1], op->wns[0], op->wns[Nwave-1], dwn);
+      exit(EXIT_FAILURE);
+    }
+    /* The grid's molecules need their line transitions to extend their
+       temperatures or wavenumbers:                                         */
+    for (t=0; t < Ntemp && told[t] >= 0; t++);
+    for (j=0; (t < Ntemp || w0 > 0 || w1 < Nwave) && j < old->Nmol; j++){
+      for (i=0; i < iso->n_i && mol->ID[iso->imol[i]] != old->molID[j]; i++);
+      if (i == iso->n_i){
+        tr_output(TOUT_ERROR, "The line transitions of the molecule %d of "
+          "the opacity file are needed to extend its temperatures or "
+          "wavenumbers.\n", old->molID[j]);
+        exit(EXIT_FAILURE);
+      }
+    }
+    for (t=0, r=0; t < Ntemp; t++)
+      r += told[t] < 0;
+    tr_output(TOUT_INFO, "Extending the opacity grid with %li molecules, "
+      "%d temperatures, and %li wavenumbers.\n", Nmol - old->Nmol, r,
+      Nwave - old->Nwave);
+  }
+
   if (fp != NULL){
-    op->o      = (PREC_RES ****)       calloc(Nlayer, sizeof(PREC_RES ***));
-    for (r=0; r<Nlayer; r++){
-      op->o[r] = (PREC_RES  ***)       calloc(Ntemp,  sizeof(PREC_RES **));
-      for (t=0; t<Ntemp; t++){
-        op->o[r][t] = (PREC_RES **)    calloc(Nmol,   sizeof(PREC_RES *));
-        for (i=0; i<Nmol; i++){
-          op->o[r][t][i] = (PREC_RES *)calloc(Nwave,  sizeof(PREC_RES));
+    int fd = fileno(fp);
+    long off[5];       /* Byte offsets of molID, temp, press, wns, and grid */
+    size_t gsize = opagridsize(op, OPA_DOUBLE);
+    char *map;
+
+    /* Save the header and arrays, padded so that the grid starts at a
+       multiple of OPA_ALIGN bytes, and make room for the grid (the header
+       is rewritten once the grid is encoded):                              */
+    op->format = OPA_DOUBLE;
+    opaoffsets(op, off);
+    writeopahead(op, fp);
+    if (fflush(fp) != 0 || ftruncate(fd, off[4] + gsize) != 0){
+      tr_output(TOUT_ERROR, "Could not write the opacity file '%s'.\n",
+                tr->f_opa);
+      exit(EXIT_FAILURE);
+    }
+
+    /* Broadening widths and profile indices of every cell:                 */
+    if (gridwidths(tr) != 0)
+      exit(EXIT_FAILURE);
+
+    /* The values of the grid to extend within a profile half-width of a
+       new wavenumber range miss the lines of that range, recompute them:   */
+    if (old != NULL){
+      long nseam = ceil(gridhalfwidth(tr)/(op->wns[1] - op->wns[0])) + 1;
+      k0 = (w0 > 0)     ? (w0 + nseam < w1 ? w0 + nseam : w1) : w0;
+      k1 = (w1 < Nwave) ? (w1 - nseam > k0 ? w1 - nseam : k0) : w1;
+      if (w0 > 0 || w1 < Nwave)
+        tr_output(TOUT_INFO, "Recomputing the %li wavenumbers of the grid "
+          "next to each new wavenumber range.\n", nseam);
+    }
+
+    /* Number of cells, and of cells per block of the cell engine:          */
+    long ncell = Nlayer*Ntemp,
+         cblk  = ncell;
+    if (op->profbudget > 0)
+      cblk = Ntemp * ((tr->nthreads + Ntemp - 1) / Ntemp);
+
+    /* Compute extinction line by line, for all the cells of a block of
+       layers at once (the block takes up to OPA_LINEMEM bytes; the line
+       list is read once per block), and write each block of the grid (an
+       extended grid takes the cell engine, which computes only the missing
+       slabs of each cell):                                                 */
+    if (tr->gridengine == OPA_LINE && old == NULL){
+      long rsize = Ntemp*Nmol*Nwave, /* Grid values per layer               */
+           lblk  = OPA_LINEMEM / (rsize*(long)sizeof(PREC_RES));
+      double *kmax;
+      PREC_RES *grid;
+      if (lblk < 1)
+        lblk = 1;
+      if (lblk > Nlayer)
+        lblk = Nlayer;
+      if ((grid=(PREC_RES *)allocgrid(lblk*rsize*sizeof(PREC_RES))) == NULL){
+        tr_output(TOUT_ERROR, "Allocation fail.\n");
+        exit(EXIT_FAILURE);
+      }
+      if ((kmax=gridlinemax(tr)) == NULL)
+        exit(EXIT_FAILURE);
+      for (r=0; r < Nlayer; r+=lblk){
+        long r1 = (r + lblk < Nlayer) ? r + lblk : Nlayer;
+        memset(grid, 0, (r1-r)*rsize*sizeof(PREC_RES));
+        if ((rn=gridmolext(tr, kmax, r, r1, grid)) != 0){
+          tr_output(TOUT_ERROR, "gridmolext() returned error code %i.\n",
+                    rn);
+          exit(EXIT_FAILURE);
+        }
+        if (pwriteall(fd, grid, (r1-r)*rsize*sizeof(PREC_RES),
+                      off[4] + r*rsize*sizeof(PREC_RES)) != 0){
+          tr_output(TOUT_ERROR, "Could not write the opacity file '%s'.\n",
+                    tr->f_opa);
+          exit(EXIT_FAILURE);
         }
       }
+      free(kmax);
+      free(grid);
     }
+    /* Else, compute extinction per cell.  Each (layer, temperature) cell is
+       independent of the others, so distribute the cells among the threads.
+       Every thread works on its own density, partition-function, scratch,
+       and cell arrays, thus the grid is identical to that of a serial run.
+       Each thread writes its cell to the file as soon as it is computed,
+       thus the memory does not grow with the grid.  With a Voigt-profile
+       memory budget, the cells go in blocks of whole layers (enough for
+       every thread), and the profiles beyond the budget are freed between
+       blocks, where no thread holds a profile:                             */
+    else
+    #pragma omp parallel num_threads(tr->nthreads) private(j, r, t, rn)
+    {
+      PREC_ATM *density = (PREC_ATM *)calloc(mol->nmol, sizeof(PREC_ATM));
+      double   *Z       = (double   *)calloc(iso->n_i,  sizeof(double));
+      PREC_RES *slab    = (PREC_RES *)calloc(Nmol*Nwave, sizeof(PREC_RES));
+      PREC_RES *kiso[Nmol]; /* Cell opacities [mol][wn]                     */
+      struct extwork ew;    /* Scratch buffers for computemolext()          */
+      long c, c0, c1;       /* Cell index, and cell range of a block        */
+
+      if (alloc_extwork(tr, &ew, 1) != 0 || slab == NULL)
+        exit(EXIT_FAILURE);
+      for (j=0; j < Nmol; j++)
+        kiso[j] = slab + j*Nwave;
+
+      for (c0=0; c0 < ncell; c0=c1){
+        c1 = (c0 + cblk < ncell) ? c0 + cblk : ncell;
+        #pragma omp for schedule(dynamic, 1)
+        for (c=c0; c < c1; c++){
+          r = c / Ntemp;  /* Layer index                                    */
+          t = c % Ntemp;  /* Temperature index                              */
+          if (t == 0)
+            tr_output(TOUT_DEBUG, "\nOpacity Grid at layer %03d/%03ld.\n",
+              r+1, Nlayer);
+          /* Get density and partition-function arrays:                     */
+          for (j=0; j < mol->nmol; j++)
+            density[j] = stateeqnford(tr->ds.at->mass, op->q[j*Nlayer+r],
+                                      op->mm[r], mol->mass[j],
+                                      op->press[r], op->temp[t]);
+          for (j=0; j < iso->n_i; j++)
+            Z[j] = op->ziso[j][t];
+          memset(slab, 0, Nmol*Nwave*sizeof(PREC_RES));
+          ew.cell = c;
+          if (old == NULL || told[t] < 0)
+            rn = computemolext(tr, kiso, op->temp[t], density, Z, 1, &ew);
+          else
+            rn = extendcell(tr, &ew, kiso, op->temp[t], density, Z, newmol,
+                            k0, k1);
+          if (rn != 0) {
+            tr_output(TOUT_ERROR, "extinction() returned error code %i.\n",
+                      rn);
+            exit(EXIT_FAILURE);
+          }
+          /* Copy the cell of the grid to extend:                           */
+          if (old != NULL && told[t] >= 0)
+            for (j=0; j < old->Nmol; j++)
+              decoderow(old, (r*old->Ntemp + told[t])*old->Nmol + j, k0-w0,
+                        k1-w0, kiso[j] + w0);
+          if (pwriteall(fd, slab, Nmol*Nwave*sizeof(PREC_RES),
+                        off[4] + c*Nmol*Nwave*sizeof(PREC_RES)) != 0){
+            tr_output(TOUT_ERROR, "Could not write the opacity file '%s'.\n",
+                      tr->f_opa);
+            exit(EXIT_FAILURE);
+          }
+        }
+        /* Every thread is past the block, free the Voigt profiles beyond
+           the memory budget:                                               */
+        #pragma omp single
+        trimprofiles(op);
+      }
 
-    if (!op->o[0][0][0])
-      tr_output(TOUT_ERROR, "Allocation fail.\n");
-
-    /* Compute extinction:                                                  */
-    for (r=0;   r<Nlayer; r++){  /* For each layer:                         */
-      tr_output(TOUT_DEBUG, "\nOpacity Grid at layer %03d/%03ld.\n",
-        r+1, Nlayer);
-      for (t=0; t<Ntemp;  t++){  /* For each temperature:                   */
-        /* Get density and partition-function arrays:                       */
-        for (j=0; j < mol->nmol; j++)
-          density[j] = stateeqnford(tr->ds.at->mass, mol->molec[j].q[r],
-                       tr->atm.mm[r], mol->mass[j], op->press[r], op->temp[t]);
-        for (j=0; j < iso->n_i; j++)
-          Z[j] = op->ziso[j][t];
-        if((rn=computemolext(tr, op->o[r][t], op->temp[t], density, Z, 1))
-          != 0) {
-          tr_output(TOUT_ERROR, "extinction() returned error code %i.\n", rn);
+      freemem_extwork(&ew);
+      free(density);
+      free(Z);
+      free(slab);
+    }
+    /* Free the composition and width tables, and the Voigt profiles
+       beyond the memory budget:                                            */
+    free(op->mm);
+    free(op->q);
+    op->mm = op->q = NULL;
+    free(op->alphal);
+    free(op->alphad);
+    free(op->idop);
+    free(op->ilor);
+    op->alphal = op->alphad = NULL;
+    op->idop   = op->ilor   = NULL;
+    trimprofiles(op);
+
+    /* Encode the grid in the file as compactly as the tolerance allows:
+       16-bit steps, else floats, else doubles:                             */
+    if (tr->ds.th->opatol > 0){
+      double err;  /* Largest relative error of the encoding                */
+      for (k=OPA_INT16; k > OPA_DOUBLE; k--){
+        if ((rn=encodefile(op, fd, off[4], k, tr->ds.th->opatol,
+                            tr->nthreads, &err)) < 0){
+          tr_output(TOUT_ERROR, "Could not encode the opacity file '%s'.\n",
+                    tr->f_opa);
           exit(EXIT_FAILURE);
         }
+        tr_output(TOUT_INFO, "Largest relative error of the %s opacity "
+          "grid: %.3e.\n", k == OPA_INT16 ? "16-bit" : "float", err);
+        if (rn == 0)
+          break;
       }
+      op->format = k;
+      if (k == OPA_DOUBLE)
+        tr_output(TOUT_WARN, "No opacity-grid encoding meets the tolerance "
+          "(%.3e), storing doubles.\n", tr->ds.th->opatol);
+      writeopahead(op, fp);
+      fflush(fp);
     }
 
-    /* Save dimension sizes:                                                */
-    fwrite(&Nmol,   sizeof(long), 1, fp);
-    fwrite(&Ntemp,  sizeof(long), 1, fp);
-    fwrite(&Nlayer, sizeof(long), 1, fp);
-    fwrite(&Nwave,  sizeof(long), 1, fp);
+    /* Map the grid of the file (read it if that fails), so that this run
+       interpolates the same values as those reading the file:              */
+    gsize = opagridsize(op, op->format);
+    map = mmap(NULL, off[4] + gsize, PROT_READ, MAP_SHARED, fd, 0);
+    if (map != MAP_FAILED){
+      op->mapaddr = map;
+      op->mapsize = off[4] + gsize;
+      rn = mountgrid(op, map + off[4]);
+    }
+    else if ((map=allocgrid(gsize)) != NULL &&
+             pread(fd, map, gsize, off[4]) == (ssize_t)gsize)
+      rn = mountgrid(op, map);
+    else
+      rn = -1;
+    if (rn != 0 || fclose(fp) != 0){
+      tr_output(TOUT_ERROR, "Could not write the opacity file '%s'.\n",
+                tr->f_opa);
+      exit(EXIT_FAILURE);
+    }
+  }
+  free(newmol);
+  free(told);
+  tr_output(TOUT_RESULT, "Done.\n");
+  return 0;
+}
+
+
+/* FUNCTION: Compute the byte offsets of the molID, temp, press, and wns
+   arrays and of the grid in an opacity file written by calcopacity().
+   The double arrays start at a multiple of eight bytes, and the grid at a
+   multiple of OPA_ALIGN bytes.
+   Return: 0 on success                                                     */
+int
+opaoffsets(struct opacity *op, /* Opacity struct with the grid dimensions   */
+           long *off){         /* Output offsets [5]                        */
+  off[0] = sizeof(struct opahead);
+  off[1] = off[0] + (sizeof(int)*op->Nmol + 7) / 8 * 8;
+  off[2] = off[1] + sizeof(PREC_RES)*op->Ntemp;
+  off[3] = off[2] + sizeof(PREC_RES)*op->Nlayer;
+  off[4] = off[3] + sizeof(PREC_RES)*op->Nwave;
+  off[4] = (off[4] + OPA_ALIGN - 1) / OPA_ALIGN * OPA_ALIGN;
+  return 0;
+}
 
-    /* Save arrays:                                                         */
-    fwrite(&op->molID[0], sizeof(int),      Nmol,   fp);
-    fwrite(&op->temp[0],  sizeof(PREC_RES), Ntemp,  fp);
-    fwrite(&op->press[0], sizeof(PREC_RES), Nlayer, fp);
-    fwrite(&op->wns[0],   sizeof(PREC_RES), Nwave,  fp);
 
-    /* Save opacity:                                                        */
-    for (r=0; r<Nlayer; r++)
-      for (t=0; t<Ntemp; t++)
-        for (i=0; i<Nmol; i++)
-          fwrite(op->o[r][t][i], sizeof(PREC_RES), Nwave, fp);
+/* FUNCTION: Read the opacity-file dimensions and grid encoding into op,
+   and the byte offsets of its arrays into off (see opaoffsets()).  Files
+   without the opahead header (written before OPA_VERSION 1) have packed
+   arrays of doubles right after the four dimension sizes.
+   Return: 1 for an aligned file, 0 for a legacy file, -1 on error          */
+int
+readopahead(struct opacity *op, /* Opacity struct                           */
+            FILE *fp,           /* Opacity file                             */
+            long *off){         /* Output offsets [5]                       */
+  struct opahead head;
+
+  rewind(fp);
+  if (fread(&head, sizeof(long), 1, fp) != 1)
+    return -1;
+
+  /* Legacy layout:                                                         */
+  if (head.magic != OPA_MAGIC){
+    op->Nmol   = head.magic;
+    op->format = OPA_DOUBLE;
+    if (fread(&op->Ntemp,  sizeof(long), 1, fp) != 1 ||
+        fread(&op->Nlayer, sizeof(long), 1, fp) != 1 ||
+        fread(&op->Nwave,  sizeof(long), 1, fp) != 1)
+      return -1;
+    off[0] = 4 * sizeof(long);
+    off[1] = off[0] + sizeof(int)*op->Nmol;
+    off[2] = off[1] + sizeof(PREC_RES)*op->Ntemp;
+    off[3] = off[2] + sizeof(PREC_RES)*op->Nlayer;
+    off[4] = off[3] + sizeof(PREC_RES)*op->Nwave;
+    return op->Nmol > 0 ? 0 : -1;
+  }
 
-    fclose(fp);
+  if (fread(&head.version, sizeof(struct opahead) - sizeof(long), 1, fp) != 1)
+    return -1;
+  /* Version 1 files hold doubles (the format field was zero):              */
+  if ((head.version != 1 && head.version != OPA_VERSION) ||
+      head.format < OPA_DOUBLE || head.format > OPA_INT16){
+    tr_output(TOUT_WARN, "Unsupported opacity-file version %li (grid "
+              "encoding %li).\n", head.version, head.format);
+    return -1;
+  }
+  op->Nmol   = head.Nmol;
+  op->Ntemp  = head.Ntemp;
+  op->Nlayer = head.Nlayer;
+  op->Nwave  = head.Nwave;
+  op->format = head.format;
+  opaoffsets(op, off);
+  if (off[4] != head.grid)
+    return -1;
+  return 1;
+}
+
+
+/* FUNCTION: Point the op->o index arrays into a contiguous opacity grid
+   ordered as [layer][temp][mol][wave].
+   Return: 0 on success, -1 on allocation failure                           */
+int
+indexopacity(struct opacity *op, /* Opacity struct                          */
+             PREC_RES *grid){    /* Contiguous opacity grid                 */
+  long r, t, i;  /* for-loop indices                                        */
+  long Nlayer=op->Nlayer, Ntemp=op->Ntemp, Nmol=op->Nmol, Nwave=op->Nwave;
+
+  op->o = (PREC_RES ****)calloc(Nlayer, sizeof(PREC_RES ***));
+  if (!op->o)
+    return -1;
+  op->o[0]    = (PREC_RES ***)calloc(Nlayer*Ntemp,      sizeof(PREC_RES **));
+  if (!op->o[0])
+    return -1;
+  op->o[0][0] = (PREC_RES  **)calloc(Nlayer*Ntemp*Nmol, sizeof(PREC_RES *));
+  if (!op->o[0][0])
+    return -1;
+
+  for     (r=0; r < Nlayer; r++){
+    op->o[r] = op->o[0] + r*Ntemp;
+    for   (t=0; t < Ntemp; t++){
+      op->o[r][t] = op->o[0][0] + (r*Ntemp + t)*Nmol;
+      for (i=0; i < Nmol; i++)
+        op->o[r][t][i] = grid + ((r*Ntemp + t)*Nmol + i)*Nwave;
+    }
   }
-  tr_output(TOUT_RESULT, "Done.\n");
   return 0;
 }
 
 
 /* FUNCTION: Read the opacity file and store values in the transit
-   structure.                                                               */
+   structure.  Aligned files are memory mapped read-only, so the grid is
+   paged in on demand and shared through the page cache by every process
+   that maps the same file.  Legacy files (or a failed mapping) are read
+   into a single contiguous buffer.                                         */
 int
 readopacity(struct transit *tr,  /* transit struct                          */
             FILE *fp){           /* Pointer to file to read                 */
   struct opacity *op=tr->ds.op;  /* opacity struct                          */
-  int i, t, r;  /* for-loop indices                                         */
+  int i, rn;    /* for-loop index, return code                              */
+  long off[5];  /* Byte offsets of molID, temp, press, wns, and grid        */
+  int aligned;  /* Opacity-file layout                                      */
+  size_t gsize; /* Size of the grid in bytes                               */
+  void *grid;
+  struct stat st;
 
   /* Read file dimension sizes:                                             */
-  fread(&op->Nmol,   sizeof(long), 1, fp);
-  fread(&op->Ntemp,  sizeof(long), 1, fp);
-  fread(&op->Nlayer, sizeof(long), 1, fp);
-  fread(&op->Nwave,  sizeof(long), 1, fp);
+  if ((aligned=readopahead(op, fp, off)) < 0){
+    tr_output(TOUT_ERROR, "Invalid opacity file '%s'.\n", tr->f_opa);
+    exit(EXIT_FAILURE);
+  }
   tr_output(TOUT_INFO, "Opacity grid size: Nmolecules    = %5li\n"
     "                   Ntemperatures = %5li\n"
     "                   Nlayers       = %5li\n"
     "                   Nwavenumbers  = %5li\n",
     op->Nmol, op->Ntemp, op->Nlayer, op->Nwave);
-  tr_output(TOUT_DEBUG, "ftell = %li\n", ftell(fp));
-
-  /* Allocate and read arrays:                                              */
-  op->molID = (int      *)calloc(op->Nmol,   sizeof(int));
-  op->temp  = (PREC_RES *)calloc(op->Ntemp,  sizeof(PREC_RES));
-  op->press = (PREC_RES *)calloc(op->Nlayer, sizeof(PREC_RES));
-  op->wns   = (PREC_RES *)calloc(op->Nwave,  sizeof(PREC_RES));
-  fread(op->molID, sizeof(int),      op->Nmol,   fp);
-  fread(op->temp,  sizeof(PREC_RES), op->Ntemp,  fp);
-  fread(op->press, sizeof(PREC_RES), op->Nlayer, fp);
-  fread(op->wns,   sizeof(PREC_RES), op->Nwave,  fp);
+  gsize = opagridsize(op, op->format);
+
+  if (fstat(fileno(fp), &st) != 0 ||
+      st.st_size < off[4] + (off_t)gsize){
+    tr_output(TOUT_ERROR, "Opacity file '%s' is truncated.\n", tr->f_opa);
+    exit(EXIT_FAILURE);
+  }
+
+  /* Map the file:                                                          */
+  if (aligned){
+    op->mapsize = off[4] + gsize;
+    op->mapaddr = mmap(NULL, op->mapsize, PROT_READ, MAP_SHARED,
+                       fileno(fp), 0);
+    if (op->mapaddr == MAP_FAILED){
+      tr_output(TOUT_WARN, "Could not map the opacity file (%s), reading "
+                           "it instead.\n", strerror(errno));
+      op->mapaddr = NULL;
+      op->mapsize = 0;
+    }
+  }
+  else
+    tr_output(TOUT_INFO, "Legacy opacity-file layout, reading it into "
+                         "memory.\n");
+
+  /* Point the arrays into the mapping:                                     */
+  if (op->mapaddr)
+    rn = mountopacity(op, op->mapaddr, off);
+  else{
+    /* Allocate and read arrays:                                            */
+    op->molID = (int      *)calloc(op->Nmol,   sizeof(int));
+    op->temp  = (PREC_RES *)calloc(op->Ntemp,  sizeof(PREC_RES));
+    op->press = (PREC_RES *)calloc(op->Nlayer, sizeof(PREC_RES));
+    op->wns   = (PREC_RES *)calloc(op->Nwave,  sizeof(PREC_RES));
+    grid      = allocgrid(gsize);
+    if (!grid){
+      tr_output(TOUT_ERROR, "Allocation fail.\n");
+      exit(EXIT_FAILURE);
+    }
+    fseek(fp, off[0], SEEK_SET);
+    fread(op->molID, sizeof(int),      op->Nmol,   fp);
+    fseek(fp, off[1], SEEK_SET);
+    fread(op->temp,  sizeof(PREC_RES), op->Ntemp,  fp);
+    fread(op->press, sizeof(PREC_RES), op->Nlayer, fp);
+    fread(op->wns,   sizeof(PREC_RES), op->Nwave,  fp);
+
+    /* Read the opacity grid:                                               */
+    fseek(fp, off[4], SEEK_SET);
+    if (fread(grid, gsize, 1, fp) != 1){
+      tr_output(TOUT_ERROR, "Could not read the opacity grid.\n");
+      exit(EXIT_FAILURE);
+    }
+    rn = mountgrid(op, grid);
+  }
+  if (rn != 0){
+    tr_output(TOUT_ERROR, "Allocation fail.\n");
+    exit(EXIT_FAILURE);
+  }
 
   /* DEBUGGING: Print temperature array                                     */
   tr_output(TOUT_DEBUG, "Molecule IDs = [");
@@ -481,150 +1543,208 @@ readopacity(struct transit *tr,  /* transit struct                          */
     tr_output(TOUT_DEBUG, "%7.2f, ", op->wns[i]);
   tr_output(TOUT_DEBUG, "\b\b]\n\n");
 
-  /* Allocate and read the opacity grid:                                    */
-  op->o      = (PREC_RES ****)       calloc(op->Nlayer, sizeof(PREC_RES ***));
-  for     (r=0; r < op->Nlayer; r++){
-    op->o[r] = (PREC_RES  ***)       calloc(op->Ntemp,  sizeof(PREC_RES **));
-    for   (t=0; t < op->Ntemp; t++){
-      op->o[r][t] = (PREC_RES **)    calloc(op->Nmol,   sizeof(PREC_RES *));
-      for (i=0; i < op->Nmol; i++){
-        op->o[r][t][i] = (PREC_RES *)calloc(op->Nwave,  sizeof(PREC_RES));
-      }
-    }
-  }
+  return 0;
+}
 
-  /* Read the opacity grid:                                                 */
-  for     (r=0; r < op->Nlayer; r++)
-    for   (t=0; t < op->Ntemp;  t++)
-      for (i=0; i < op->Nmol;   i++)
-        fread(op->o[r][t][i], sizeof(PREC_RES), op->Nwave, fp);
 
+/* FUNCTION: Set (type F_RDLCK or F_WRLCK) or release (F_UNLCK) the lock
+   on one byte (TSHM_SETUP or TSHM_ALIVE) of the shared-memory object fd.
+   The locks are open-file-description locks (where available): they
+   belong to the object opened by each context, so that the contexts of a
+   process lock each other out as separate processes do (process-wide
+   fcntl() locks would let a context release or override the locks of
+   another one).  The kernel drops the locks when the object is closed,
+   or the process exits or crashes.
+   Return: 0 on success, -1 on failure (or if busy and wait is 0)           */
+static int
+shmlock(int fd,     /* Shared-memory object                                 */
+        int byte,   /* Locked byte                                          */
+        int type,   /* Lock type                                            */
+        int wait){  /* Sleep until the lock is available                    */
+  struct flock fl;
+
+  memset(&fl, 0, sizeof(struct flock));
+  fl.l_type   = type;
+  fl.l_whence = SEEK_SET;
+  fl.l_start  = byte;
+  fl.l_len    = 1;
+  while (fcntl(fd, wait ? F_OFD_SETLKW : F_OFD_SETLK, &fl) == -1)
+    if (errno != EINTR || !wait)
+      return -1;
   return 0;
 }
 
 
-/* FUNCTION: Read the opacity file and store values in shared memory.       */
+/* FUNCTION: Attach to the opacity grid in POSIX shared memory, loading it
+   from fp if this is the first process to get there.
+
+   The segment is named after the opacity file's device, inode,
+   modification time, and size, so a rewritten file never attaches to a
+   stale grid.  The first byte of the segment is write-locked while a
+   context creates, loads, or removes it, so the others sleep in the
+   kernel until the grid is ready.  Every attached context (of this or
+   another process) holds a read lock on the second byte; a loader that
+   died leaves the segment without TSHM_WRITTEN, and the next process
+   loads it again.
+   Return: 0 on success, 1 on failure                                       */
 int
 shareopacity(struct transit *tr, /* transit struct                          */
             FILE *fp){           /* Pointer to file to read                 */
   struct opacity *op=tr->ds.op;  /* opacity struct                          */
-  struct opacityhint *oh=op->hint;  /* opacity hint struct                  */
+  struct opacityhint *oh;        /* opacity hint struct                     */
+  long off[5],   /* Byte offsets of the arrays in the file                  */
+       aoff[5];  /* Byte offsets of the arrays in the shared image          */
+  size_t gsize;  /* Size of the grid in bytes                              */
+  int fd;        /* Shared-memory object                                    */
+  char *image;   /* Image of an aligned opacity file in the segment         */
+  struct stat st;
 
   /* Read file dimension sizes:                                             */
-  fread(&op->Nmol,   sizeof(long), 1, fp);
-  fread(&op->Ntemp,  sizeof(long), 1, fp);
-  fread(&op->Nlayer, sizeof(long), 1, fp);
-  fread(&op->Nwave,  sizeof(long), 1, fp);
+  if (fstat(fileno(fp), &st) != 0 || readopahead(op, fp, off) < 0){
+    tr_output(TOUT_WARN, "Invalid opacity file '%s'.\n", tr->f_opa);
+    return 1;
+  }
   tr_output(TOUT_INFO, "Opacity grid size: Nmolecules    = %5li\n"
     "                   Ntemperatures = %5li\n"
     "                   Nlayers       = %5li\n"
     "                   Nwavenumbers  = %5li\n",
     op->Nmol, op->Ntemp, op->Nlayer, op->Nwave);
-  tr_output(TOUT_DEBUG, "ftell = %li\n", ftell(fp));
-
-  /* Copy dimensional data into the shared hint struct:                     */
-  oh->Nwave = op->Nwave;
-  oh->Ntemp = op->Ntemp;
-  oh->Nlayer = op->Nlayer;
-  oh->Nmol = op->Nmol;
-
-  /* If creating and attaching the main segment fails, return:              */
-  if (attachopacity(tr))
+  gsize = opagridsize(op, op->format);
+  opaoffsets(op, aoff);
+  op->mapsize = OPA_ALIGN + aoff[4] + gsize;
+
+  snprintf(op->shmname, sizeof(op->shmname), "/transit-opa-%lx-%lx-%lx-%lx",
+           (unsigned long)st.st_dev,   (unsigned long)st.st_ino,
+           (unsigned long)st.st_mtime, (unsigned long)st.st_size);
+
+  /* Open the segment and take the setup lock.  Retry if a detaching
+     process removed it in between:                                         */
+  while (1){
+    fd = shm_open(op->shmname, O_RDWR | O_CREAT, 0644);
+    if (fd == -1 || shmlock(fd, TSHM_SETUP, F_WRLCK, 1) != 0){
+      tr_output(TOUT_WARN, "Could not open shared memory '%s' (%s).\n",
+                op->shmname, strerror(errno));
+      if (fd != -1)
+        close(fd);
+      op->shmname[0] = '\0';
+      return 1;
+    }
+    if (fstat(fd, &st) == 0 && st.st_nlink > 0)
+      break;
+    close(fd);
+  }
+  /* From here on, detachopacity() releases the locks, closes fd, and
+     removes the segment if no other context is attached:                   */
+  op->shmfd = fd;
+
+  /* Size a new segment:                                                    */
+  if (st.st_size != (off_t)op->mapsize &&
+      (st.st_size != 0 || ftruncate(fd, op->mapsize) != 0)){
+    tr_output(TOUT_WARN, "Could not size shared memory '%s'.\n",
+              op->shmname);
+    detachopacity(op);
     return 1;
+  }
 
-  /* Read arrays:                                                           */
-  char *p = op->mainaddr;
-  fread(p, sizeof(int),      op->Nmol,   fp);
-  p += sizeof(int) * op->Nmol;
-  fread(p,  sizeof(PREC_RES), op->Ntemp,  fp);
-  p += sizeof(PREC_RES) * op->Ntemp;
-  fread(p, sizeof(PREC_RES), op->Nlayer, fp);
-  p += sizeof(PREC_RES) * op->Nlayer;
-  fread(p,   sizeof(PREC_RES), op->Nwave,  fp);
-  p += sizeof(PREC_RES) * op->Nwave;
-
-  /* Read opacity grid:                                                     */
-  fread(p, sizeof(PREC_RES),
-        op->Nmol * op->Ntemp * op->Nlayer * op->Nwave, fp);
-
-  oh->status |= TSHM_WRITTEN;
-  return 0;
-}
-
-
-/* FUNCTION: Locate (or create) and attach to the main shared memory.
-   Return: 0 on success, 1 on failure                                       */
-int
-attachopacity(struct transit *tr){ /* transit struct                        */
-  struct opacity *op=tr->ds.op;   /* opacity struct                         */
-  struct opacityhint *oh=op->hint;  /* opacity hint struct                  */
-
-  op->Nwave = oh->Nwave;
-  op->Ntemp = oh->Ntemp;
-  op->Nlayer = oh->Nlayer;
-  op->Nmol = oh->Nmol;
-
-  int main_shm_size  /* Size of the main shared memory, starting with: grid */
-    = sizeof(PREC_RES) * op->Nmol * op->Ntemp * op->Nlayer * op->Nwave
-    + sizeof(int) * op->Nmol          /* op->molID  */
-    + sizeof(PREC_RES) * op->Ntemp    /* op->temp   */
-    + sizeof(PREC_RES) * op->Nlayer   /* op->press  */
-    + sizeof(PREC_RES) * op->Nwave;   /* op->wns    */
-
-  /* Allocate or locate the main shared memory:                             */
-  key_t mainkey = ftok(tr->f_opa, 'b');
-  op->mainID = shmget(mainkey, main_shm_size, 0644 | IPC_CREAT);
-
-  /* If allocation failed, abort:                                           */
-  if (op->mainID == -1) {
-    tr_output(TOUT_WARN, "Failed to allocate main shared memory.\n");
+  op->mapaddr = mmap(NULL, op->mapsize, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     fd, 0);
+  if (op->mapaddr == MAP_FAILED){
+    tr_output(TOUT_WARN, "Could not map shared memory '%s' (%s).\n",
+              op->shmname, strerror(errno));
+    op->mapaddr = NULL;
+    detachopacity(op);
     return 1;
   }
-
-  /* Attach to the main shared memory:                                      */
-  op->mainaddr = shmat(op->mainID, (void *) 0, 0);
-
-  if (op->mainaddr == (void *) -1) {
-    tr_output(TOUT_WARN, "Failed to attach to main shared memory.\n");
+  oh = op->hint = (struct opacityhint *)op->mapaddr;
+  image = (char *)op->mapaddr + OPA_ALIGN;
+
+  /* First process to get here (or the previous loader died), load it:      */
+  if ((oh->status & TSHM_WRITTEN) == 0){
+    struct opahead head = {OPA_MAGIC, OPA_VERSION, op->Nmol, op->Ntemp,
+                           op->Nlayer, op->Nwave, aoff[4], op->format};
+    tr_output(TOUT_INFO, "Loading the opacity grid into shared memory "
+                         "'%s'.\n", op->shmname);
+    memcpy(image, &head, sizeof(struct opahead));
+    fseek(fp, off[0], SEEK_SET);
+    fread(image+aoff[0], sizeof(int),      op->Nmol,   fp);
+    fseek(fp, off[1], SEEK_SET);
+    fread(image+aoff[1], sizeof(PREC_RES), op->Ntemp,  fp);
+    fread(image+aoff[2], sizeof(PREC_RES), op->Nlayer, fp);
+    fread(image+aoff[3], sizeof(PREC_RES), op->Nwave,  fp);
+    fseek(fp, off[4], SEEK_SET);
+    if (fread(image+aoff[4], gsize, 1, fp) != 1){
+      tr_output(TOUT_WARN, "Could not read the opacity grid.\n");
+      detachopacity(op);
+      return 1;
+    }
+    oh->Nwave  = op->Nwave;
+    oh->Ntemp  = op->Ntemp;
+    oh->Nlayer = op->Nlayer;
+    oh->Nmol   = op->Nmol;
+    oh->status = TSHM_WRITTEN;
+  }
+  else
+    tr_output(TOUT_INFO, "Attached to shared memory '%s'.\n", op->shmname);
+
+  /* Register as attached, and let the next process in:                     */
+  shmlock(fd, TSHM_ALIVE, F_RDLCK, 1);
+  shmlock(fd, TSHM_SETUP, F_UNLCK, 0);
+  mprotect(op->mapaddr, op->mapsize, PROT_READ);
+
+  if (oh->Nmol   != op->Nmol   || oh->Ntemp != op->Ntemp ||
+      oh->Nlayer != op->Nlayer || oh->Nwave != op->Nwave){
+    tr_output(TOUT_WARN, "Shared memory '%s' does not match the opacity "
+                         "file.\n", op->shmname);
+    detachopacity(op);
     return 1;
   }
 
-  oh->num_attached++;
-  return 0;
+  return mountopacity(op, image, aoff);
 }
 
 
-/* FUNCTION: Create pointers to the opacity values in shared memory.
+/* FUNCTION: Point the opacity arrays into base, an image of an aligned
+   opacity file (a mapped file or a shared-memory segment), given the
+   byte offsets off from opaoffsets().
    Return: 0 on success                                                     */
 int
-mountopacity(struct transit *tr){ /* transit struct                         */
-  struct opacity *op=tr->ds.op;   /* opacity struct                         */
-  int i, t, r;  /* for-loop indices                                         */
-
-  char *p = op->mainaddr;
-  op->molID = (int *) p;
-  p += sizeof(int) * op->Nmol;
-  op->temp = (PREC_RES *) p;
-  p += sizeof(PREC_RES) * op->Ntemp;
-  op->press = (PREC_RES *) p;
-  p += sizeof(PREC_RES) * op->Nlayer;
-  op->wns = (PREC_RES *) p;
-  p += sizeof(PREC_RES) * op->Nwave;
-
-  op->o      = (PREC_RES ****)       calloc(op->Nlayer, sizeof(PREC_RES ***));
-  for     (r=0; r < op->Nlayer; r++){
-    op->o[r] = (PREC_RES  ***)       calloc(op->Ntemp,  sizeof(PREC_RES **));
-    for   (t=0; t < op->Ntemp; t++){
-      op->o[r][t] = (PREC_RES **)    calloc(op->Nmol,   sizeof(PREC_RES *));
-      for (i=0; i < op->Nmol; i++){
-        op->o[r][t][i] = (PREC_RES *) p /* Map the 4D structure to 1D.      */
-                                      + r * op->Ntemp * op->Nmol * op->Nwave
-                                      + t * op->Nmol * op->Nwave
-                                      + i * op->Nwave;
-      }
-    }
+mountopacity(struct opacity *op, /* Opacity struct                          */
+             char *base,         /* Image of the opacity file               */
+             long *off){         /* Offsets of the arrays in base           */
+  op->molID = (int      *)(base + off[0]);
+  op->temp  = (PREC_RES *)(base + off[1]);
+  op->press = (PREC_RES *)(base + off[2]);
+  op->wns   = (PREC_RES *)(base + off[3]);
+
+  /* Map the 4D structure to 1D:                                            */
+  return mountgrid(op, base + off[4]);
+}
+
+
+/* FUNCTION: Detach from the shared-memory opacity grid.  The last context
+   to detach removes the segment.
+   Return: 0 on success                                                     */
+int
+detachopacity(struct opacity *op){ /* Opacity struct                        */
+  if (op->shmname[0] == '\0')
+    return 0;
+
+  shmlock(op->shmfd, TSHM_SETUP, F_WRLCK, 1);
+  if (op->mapaddr != NULL)
+    munmap(op->mapaddr, op->mapsize);
+  op->mapaddr = NULL;
+  op->hint    = NULL;
+
+  /* Remove the segment if no other context holds the attached lock:        */
+  shmlock(op->shmfd, TSHM_ALIVE, F_UNLCK, 0);
+  if (shmlock(op->shmfd, TSHM_ALIVE, F_WRLCK, 0) == 0){
+    tr_output(TOUT_DEBUG, "Removing shared memory '%s'.\n", op->shmname);
+    shm_unlink(op->shmname);
   }
 
+  /* Closing the object releases the locks:                                 */
+  close(op->shmfd);
+  op->shmname[0] = '\0';
   return 0;
 }
 
@@ -634,18 +1754,42 @@ mountopacity(struct transit *tr){ /* transit struct                         */
 int
 freemem_opacity(struct opacity *op, /* Opacity structure                    */
                 long *pi){          /* transit progress flag                */
+  long i;
+
   /* Free arrays:                                                           */
-  free(op->o[0][0][0]); /* The opacity                                      */
-  free(op->o[0][0]);
-  free(op->o[0]);
-  free(op->o);
+  if (op->shmname[0] != '\0') /* The opacity, in shared memory              */
+    detachopacity(op);
+  else if (op->mapaddr != NULL){ /* The opacity, mapped from file           */
+    munmap(op->mapaddr, op->mapsize);
+    op->mapaddr = NULL;
+  }
+  else if (op->format == OPA_FLOAT)
+    free(op->lgrid);           /* The opacity, allocated and encoded        */
+  else if (op->format == OPA_INT16)
+    free(op->qpar);
+  else if (op->o != NULL)
+    free(op->o[0][0][0]);      /* The opacity, allocated                    */
+  if (op->o != NULL){
+    free(op->o[0][0]);
+    free(op->o[0]);
+    free(op->o);
+  }
 
-  free(op->profile[0][0]); /* The Voigt profiles                            */
-  free(op->profile[0]);
-  free(op->profile);
+  if (op->profile != NULL){
+    if (op->vpcaddr != NULL)   /* The Voigt profiles, mapped from cache     */
+      munmap(op->vpcaddr, op->vpcsize);
+    else
+      for (i=0; i < op->nDop*op->nLor; i++)
+        free(op->profile[0][i]); /* The Voigt profiles                      */
+    free(op->profile[0]);
+    free(op->profile);
+    free(op->profuse);
+  }
 
-  free(op->profsize[0]);  /* The Voigt-profile half-size                    */
-  free(op->profsize);
+  if (op->profsize != NULL){
+    free(op->profsize[0]);  /* The Voigt-profile half-size                  */
+    free(op->profsize);
+  }
 
   /* Update progress indicator and return:                                  */
   *pi &= ~(TRPI_OPACITY | TRPI_TAU);
@@ -3,7 +3,6 @@
 
 #include <readatm.h>
 #define ROUNDTHRESH 1e-5
-static double zerorad=0;
 
 char *atmfilename;
 
@@ -26,19 +25,19 @@ getatm(struct transit *tr){
       nrad,                           /* Number of radius samples           */
       i;                              /* for-loop index                     */
   struct transithint *th = tr->ds.th; /* Get transithint                    */
-  static struct atm_data at;          /* transit's atm_data structure       */
-  static struct molecules mol;        /* transit's molecules struct         */
-  prop_samp *rads = &at.rads;         /* Radius sample                      */
+  struct atm_data *at = &tr->st.at;   /* transit's atm_data structure       */
+  struct molecules *mol = &tr->st.mol; /* transit's molecules struct        */
+  prop_samp *rads = &at->rads;        /* Radius sample                      */
 
   /* Set atm_data and molecules struct's mem to 0:                          */
-  memset(&at,  0, sizeof(struct atm_data));
-  memset(&mol, 0, sizeof(struct molecules));
-  tr->ds.at  = &at;
-  tr->ds.mol = &mol;
+  memset(at,  0, sizeof(struct atm_data));
+  memset(mol, 0, sizeof(struct molecules));
+  tr->ds.at  = at;
+  tr->ds.mol = mol;
 
   FILE *fp = NULL;        /* Pointer to atmospheric file                    */
 
-  at.mass     = th->mass;  /* bool: abundance by mass (1) or by number (0)  */
+  at->mass    = th->mass;  /* bool: abundance by mass (1) or by number (0)  */
   tr->allowrq = th->allowrq;
 
   /* Check if atmospheric file was specified:                               */
@@ -63,41 +62,41 @@ getatm(struct transit *tr){
   }
 
   /* Initialize atmosphere temperature-pressure arrays:                     */
-  at.atm.tfct = 1;  /* Default temperature units are cgs                    */
-  at.atm.pfct = 1;  /* Default pressure    units are cgs                    */
+  at->atm.tfct = 1; /* Default temperature units are cgs                    */
+  at->atm.pfct = 1; /* Default pressure    units are cgs                    */
   rads->v  = (PREC_ATM *)calloc(nrad, sizeof(PREC_ATM));
-  at.atm.t = (PREC_ATM *)calloc(nrad, sizeof(PREC_ATM));
-  at.atm.p = (PREC_ATM *)calloc(nrad, sizeof(PREC_ATM));
+  at->atm.t = (PREC_ATM *)calloc(nrad, sizeof(PREC_ATM));
+  at->atm.p = (PREC_ATM *)calloc(nrad, sizeof(PREC_ATM));
   rads->v[0] = 1.0;
 
   /* Read keyword-variables from file:                                      */
-  if((i=getmnfromfile(fp, &at, tr))<1){
+  if((i=getmnfromfile(fp, at, tr))<1){
     tr_output(TOUT_ERROR, "getmnfromfile() returned error code %i\n", i);
     exit(EXIT_FAILURE);
   }
-  nmol = at.n_aiso; /* Number of molecules in atmospheric file              */
+  nmol = at->n_aiso; /* Number of molecules in atmospheric file             */
 
   /* Allocate mass and radius array of the molecules:                       */
-  mol.nmol   = nmol;
-  mol.ID     = (int       *)calloc(nmol, sizeof(int));
-  mol.mass   = (PREC_ZREC *)calloc(nmol, sizeof(PREC_ZREC));
-  mol.radius = (PREC_ZREC *)calloc(nmol, sizeof(PREC_ZREC));
-  mol.molec  = (prop_mol  *)calloc(nmol, sizeof(prop_mol));
+  mol->nmol   = nmol;
+  mol->ID     = (int       *)calloc(nmol, sizeof(int));
+  mol->mass   = (PREC_ZREC *)calloc(nmol, sizeof(PREC_ZREC));
+  mol->radius = (PREC_ZREC *)calloc(nmol, sizeof(PREC_ZREC));
+  mol->molec  = (prop_mol  *)calloc(nmol, sizeof(prop_mol));
 
   /* Get (pseudo-fixed) molecular data values from 'molecules.dat' file:    */
-  getmoldata(&at, &mol, tr->f_molfile);
+  getmoldata(at, mol, tr->f_molfile);
 
   /* Allocate arrays for the mean molecular mass, density, and abundance:   */
-  at.molec        = (prop_mol *)calloc(nmol, sizeof(prop_mol));
-  at.mm           = (double   *)calloc(nrad, sizeof(double));
+  at->molec        = (prop_mol *)calloc(nmol, sizeof(prop_mol));
+  at->mm           = (double   *)calloc(nrad, sizeof(double));
   for(i=0; i<nmol; i++){
-    at.molec[i].d = (PREC_ATM *)calloc(nrad, sizeof(PREC_ATM));
-    at.molec[i].q = (PREC_ATM *)calloc(nrad, sizeof(PREC_ATM));
-    at.molec[i].n = nrad;
+    at->molec[i].d = (PREC_ATM *)calloc(nrad, sizeof(PREC_ATM));
+    at->molec[i].q = (PREC_ATM *)calloc(nrad, sizeof(PREC_ATM));
+    at->molec[i].n = nrad;
   }
 
   /* Read isotopic abundances:                                              */
-  nrad = readatmfile(fp, tr, &at, rads, nrad);
+  nrad = readatmfile(fp, tr, at, rads, nrad);
   tr_output(TOUT_INFO, "Done.\n\n");
   fclose(fp);
 
@@ -350,7 +349,7 @@ getmnfromfile(FILE *fp,                /* Pointer to atmospheric file       */
 
     /* Zero radius value:                                                   */
     case 'z':
-      zerorad = atof(line+1);
+      at->zerorad = atof(line+1);
       continue;
 
     /* Radius, temperature, or pressure units factor:                       */
@@ -495,7 +494,7 @@ readatmfile(FILE *fp,                /* Atmospheric file                    */
       break;
 
     /* Read and store radius, pressure, and temperature from file:          */
-    rads->v[r] = strtod(lp, &lp2) + zerorad;  /* Radius                     */
+    rads->v[r] = strtod(lp, &lp2) + at->zerorad; /* Radius                  */
     checkposvalue(rads->v[r], 1, lines);      /* Check value is positive    */
     if(lp==lp2)
       invalidfield(line, lines, 1, "radius");
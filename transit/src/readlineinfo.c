@@ -5,21 +5,73 @@
 
 #define TLI_WAV_UNITS 1e-4 /* TLI wavelength (microns, as of v4) */
 #define TLI_E_UNITS   1    /* TLI Elow units (cm-1, as of v4)    */
+#define TLI_NCUT      32   /* Temperatures sampled by blockcut   */
 
 static double tli_to_microns = TLI_WAV_UNITS/1e-4;
 
 
+/* FUNCTION: Return the i-th value of a mapped TLI column (which need not
+   be aligned):                                                             */
+static inline PREC_LNDATA
+tlivalue(const char *col,  /* Column in the mapping                         */
+         PREC_NREC i){     /* Index                                         */
+  PREC_LNDATA v;
+  memcpy(&v, col + i*sizeof(PREC_LNDATA), sizeof(PREC_LNDATA));
+  return v;
+}
+
+
+/* FUNCTION: Return the i-th value of a mapped float TLI column (compact
+   column format):                                                          */
+static inline float
+tlifloat(const char *col,  /* Column in the mapping                         */
+         PREC_NREC i){     /* Index                                         */
+  float v;
+  memcpy(&v, col + i*sizeof(float), sizeof(float));
+  return v;
+}
+
+
+/* FUNCTION: Return the i-th scaled wavelength of a mapped compact TLI
+   wavelength column:                                                       */
+static inline uint32_t
+tliword(const char *col,  /* Column in the mapping                          */
+        PREC_NREC i){     /* Index                                          */
+  uint32_t v;
+  memcpy(&v, col + i*sizeof(uint32_t), sizeof(uint32_t));
+  return v;
+}
+
+
+/* FUNCTION: Return the i-th wavelength of a TLI line range:                */
+static inline PREC_LNDATA
+tliwl(const struct tliseg *seg, /* Line range                               */
+      PREC_NREC i){             /* Index                                    */
+  if (seg->fmt == TLI_DOUBLE)
+    return tlivalue(seg->wl, i);
+  return seg->wl0 + seg->dwl*tliword(seg->wl, i);
+}
+
+
+/* FUNCTION: Return the i-th isotope ID of a mapped TLI column:             */
+static inline short
+tliisoid(const char *col,  /* Column in the mapping                         */
+         PREC_NREC i){     /* Index                                         */
+  short v;
+  memcpy(&v, col + i*sizeof(short), sizeof(short));
+  return v;
+}
+
+
 /* FNUCTION:
-  Do a binary search in file pointed by 'fp' between 'off' and 'off+nfields'
-  looking for 'target' as the first item of a record of length 'reclength',
-  result index (with respect to offs) is stored in 'resultp'.               */
+  Do a binary search in the wavelengths of the mapped TLI line range 'seg'
+  of 'nfields' values looking for 'target', result index is stored in
+  'resultp'.                                                                */
 void
-datafileBS(FILE *fp,            /* File pointer                             */
-           PREC_NREC offs,      /* Initial position of data in tli file     */
+datafileBS(const struct tliseg *seg, /* Line range in the TLI mapping       */
            PREC_NREC nfields,   /* Number of fields to search               */
            PREC_LNDATA target,  /* Target value                             */
            PREC_NREC *resultp,  /* Result index                             */
-           int reclength,       /* Total length of record                   */
            int up){             /* Flag to search up, or down               */
 
   /* Variable to keep wavelength:                                           */
@@ -29,13 +81,12 @@ datafileBS(FILE *fp,            /* File pointer                             */
             hi=nfields-1,  /* Starting point of binary search               */
             loc;           /* Current location of closest value             */
 
-  tr_output(TOUT_DEBUG, "BS: Start looking from %li in %li fields "
-    "for %f\n", offs, nfields, target);
+  tr_output(TOUT_DEBUG, "BS: Start looking in %li fields for %f\n",
+    nfields, target);
   /* Binary search:                                                         */
   do{
     loc = (hi+lo)/2;                           /* Mid record's index        */
-    fseek(fp, offs+reclength*loc, SEEK_SET);   /* Move pointer              */
-    fread(&temp, sizeof(PREC_LNDATA), 1, fp);  /* Read value                */
+    temp = tliwl(seg, loc);                    /* Read value                */
     tr_output(TOUT_DEBUG, "BS: found wl %.8f microns at position %li\n",
                                 temp*tli_to_microns, loc);
     /* Re-set lower or higher boundary:                                     */
@@ -50,9 +101,7 @@ datafileBS(FILE *fp,            /* File pointer                             */
     loc = lo;
     /* Linear search for the entries above loc:                             */
     while(loc < nfields-1){
-      fseek(fp, offs + reclength*(loc+1), SEEK_SET);
-      fread(&temp, sizeof(PREC_LNDATA), 1, fp);
-      if (temp > target)
+      if (tliwl(seg, loc+1) > target)
         break;
       loc++;
     }
@@ -60,9 +109,7 @@ datafileBS(FILE *fp,            /* File pointer                             */
     loc = hi;
     /* Linear search for the entries below loc:                             */
     while(loc > 0){
-      fseek(fp, offs + reclength*(loc-1), SEEK_SET);
-      fread(&temp, sizeof(PREC_LNDATA), 1, fp);
-      if (temp < target)
+      if (tliwl(seg, loc-1) < target)
         break;
       loc--;
     }
@@ -70,10 +117,8 @@ datafileBS(FILE *fp,            /* File pointer                             */
   }
   /* Final remarks:                                                         */
   *resultp = loc;
-  fseek(fp, offs + reclength*loc, SEEK_SET);
-  fread(&temp, sizeof(PREC_LNDATA), 1, fp);
   tr_output(TOUT_RESULT, "Binary search found wavelength: %.8f at "
-    "position %li.\n", temp*tli_to_microns, loc);
+    "position %li.\n", tliwl(seg, loc)*tli_to_microns, loc);
 }
 
 
@@ -105,12 +150,12 @@ readtli_bin(FILE *fp,
   fread(&li->lr_ver,  sizeof(unsigned short), 1, fp);
   fread(&li->lr_rev,  sizeof(unsigned short), 1, fp);
   /* Check compatibility of versions:                                       */
-  if(li->tli_ver != compattliversion) {
+  if(li->tli_ver != compattliversion && li->tli_ver != blocktliversion) {
     tr_output(TOUT_ERROR,
       "The version of the TLI file: %i (lineread v%i.%i) is not "
       "compatible with this version of transit, which can only "
-      "read version %i.\n", li->tli_ver, li->lr_ver,
-      li->lr_rev, compattliversion);
+      "read versions %i and %i.\n", li->tli_ver, li->lr_ver,
+      li->lr_rev, compattliversion, blocktliversion);
     exit(EXIT_FAILURE);
   }
 
@@ -403,33 +448,377 @@ readinfo_tli(struct transit *tr,
 }
 
 
+/* FUNCTION: Advise the kernel that the values [first, first+n) of the
+   mapped column col (of values of the given size) will be needed soon, so
+   that it starts reading them in (e.g., from network storage).             */
+static void
+tliadvise(struct tlimap *map, /* Mapped TLI file                            */
+          const char *col,    /* Column in the mapping                      */
+          PREC_NREC first,    /* Index of the first value                   */
+          PREC_NREC n,        /* Number of values                           */
+          size_t size){       /* Size of the values (bytes)                 */
+  size_t page = sysconf(_SC_PAGESIZE),
+         lo   = (col - map->base) + first*size, /* Byte range in the file   */
+         hi   = lo + n*size;
+  if (n <= 0)
+    return;
+  lo = lo / page * page;
+  posix_madvise(map->base + lo, hi - lo, POSIX_MADV_WILLNEED);
+}
+
+
+/* FUNCTION:
+   Set the line ranges of a TLI file with a column layout (version
+   compattliversion): the wavelength, isotope-ID, lower-state energy, and
+   gf columns of all the lines, sorted by isotope and then by wavelength.
+   One range per isotope.
+   Return: the number of lines to read, or -1 on unexpected EOF             */
+static PREC_NREC
+tlicolumns(struct transit *tr,   /* transit structure                       */
+           struct tlimap *map,   /* Mapped TLI file                         */
+           long start,           /* Position of the wavelength column       */
+           int nlines,           /* Number of line transitions              */
+           int niso,             /* Number of isotopes in line data         */
+           int *isotran,         /* Number of transitions per isotope       */
+           PREC_LNDATA iniw,     /* Initial wavelength (TLI units)          */
+           PREC_LNDATA finw){    /* Final wavelength (TLI units)            */
+  struct tliseg *seg;
+  const char *wl, *isoid, *elow, *gf;
+  long offset=0;         /* Isotope offset (in number of transitions)       */
+  /* Indices of first and last transitions to be stored                     */
+  PREC_NREC ifirst, ilast, n=0;
+  int i;
+
+  /* Starting location for wavelength, isoID, Elow, and gf data in file:    */
+  wl    = map->base + start;
+  isoid = wl    + (size_t)nlines*sizeof(PREC_LNDATA);
+  elow  = isoid + (size_t)nlines*sizeof(short);
+  gf    = elow  + (size_t)nlines*sizeof(PREC_LNDATA);
+  if (gf + (size_t)nlines*sizeof(PREC_LNDATA) > map->base + map->size){
+    tr_output(TOUT_ERROR, "Unexpected end of file '%s'.\n", tr->f_line);
+    return -1;
+  }
+
+  map->nseg = niso;
+  map->seg  = (struct tliseg *)calloc(niso, sizeof(struct tliseg));
+  for (i=0; i<niso; i++){
+    seg = map->seg + i;
+    seg->fmt  = TLI_DOUBLE;
+    seg->wl   = wl   + offset*sizeof(PREC_LNDATA);
+    seg->elow = elow + offset*sizeof(PREC_LNDATA);
+    seg->gf   = gf   + offset*sizeof(PREC_LNDATA);
+    seg->iso  = tliisoid(isoid, offset);
+
+    /* Do binary search in units of TLI:                                    */
+    datafileBS(seg, isotran[i], iniw, &ifirst, 0);
+    datafileBS(seg, isotran[i], finw, &ilast,  1);
+    tr_output(TOUT_DEBUG, "Initial and final entries are: "
+      "%li and %li.\n", ifirst+offset, ilast+offset);
+
+    /* Range of transitions to read:                                        */
+    seg->first = ifirst;
+    seg->count = ilast - ifirst + 1;
+    /* Request the range of each column ahead of setlinestore() (a
+       streamed line list is read as it goes instead):                      */
+    if (tr->ds.th->linechunk == 0){
+      tliadvise(map, seg->wl,   ifirst, seg->count, sizeof(PREC_LNDATA));
+      tliadvise(map, seg->elow, ifirst, seg->count, sizeof(PREC_LNDATA));
+      tliadvise(map, seg->gf,   ifirst, seg->count, sizeof(PREC_LNDATA));
+    }
+
+    /* Count the number of lines:                                           */
+    n += seg->count;
+    /* Move the wl offset to next isotope:                                  */
+    offset += isotran[i];
+  }
+  return n;
+}
+
+
+/* FUNCTION:
+   Set the sampled temperatures and the reference line strengths of the
+   ethreshold block cut (see tliblocks()).  The temperatures span the
+   atmospheric and the opacity-grid temperatures.  The reference strength
+   of a species is the largest strength among the strongest lines of the
+   blocks within the wavelength range, a lower bound of the maximum line
+   strength that the extinction routines compare to ethreshold.             */
+static void
+tlicutinit(struct transit *tr,   /* transit structure                       */
+           struct lineinfo *li,  /* lineinfo structure                      */
+           const char *index,    /* Block index in the mapping              */
+           int nblock,           /* Number of blocks                        */
+           PREC_LNDATA iniw,     /* Initial wavelength (TLI units)          */
+           PREC_LNDATA finw,     /* Final wavelength (TLI units)            */
+           double *temp,         /* Sampled temperatures [TLI_NCUT]         */
+           double *zcut,         /* Partition functions [niso][TLI_NCUT]    */
+           double *kref){        /* Reference strengths [nmol][TLI_NCUT]    */
+  struct transithint *th = tr->ds.th;
+  struct atm_data *at = tr->ds.at;
+  struct isotopes *iso = tr->ds.iso;
+  struct tliblock blk;
+  double tlo=th->temp.i, thi=th->temp.f, *T, *Z, a, wn, k;
+  int b, i, j, m, t, nT;
+
+  for (i=0; i<at->rads.n; i++){
+    tlo = fmin(tlo, at->atm.t[i]*at->atm.tfct);
+    thi = fmax(thi, at->atm.t[i]*at->atm.tfct);
+  }
+  tlo = fmax(tlo, li->tmin);
+  thi = fmin(thi, li->tmax);
+  for (t=0; t<TLI_NCUT; t++)
+    temp[t] = tlo + t*(thi-tlo)/(TLI_NCUT-1);
+
+  /* Partition functions, linearly interpolated from the TLI tables:        */
+  for (i=0; i<iso->n_i; i++){
+    T  = li->db[iso->isof[i].d].T;
+    Z  = li->isov[i].z;
+    nT = li->isov[i].n;
+    for (t=0, j=0; t<TLI_NCUT; t++){
+      while (j < nT-2 && T[j+1] < temp[t])
+        j++;
+      if (nT == 1)
+        zcut[i*TLI_NCUT+t] = Z[0];
+      else
+        zcut[i*TLI_NCUT+t] = Z[j] + (Z[j+1]-Z[j])*(temp[t]-T[j])/(T[j+1]-T[j]);
+    }
+  }
+
+  /* Reference strengths from the strongest line of each block:             */
+  for (b=0; b<nblock; b++){
+    memcpy(&blk, index + b*TLI_BLOCKINFO, sizeof(struct tliblock));
+    if (blk.n <= 0 || blk.wlrep < iniw || blk.wlrep > finw)
+      continue;
+    i = blk.iso;
+    if ((m=iso->imol[i]) < 0)
+      continue;
+    a  = SIGCTE*blk.gfmax*iso->isoratio[i]/iso->isof[i].m;
+    wn = 1.0/(blk.wlrep*TLI_WAV_UNITS);
+    for (t=0; t<TLI_NCUT; t++){
+      k = a * exp(-EXPCTE*TLI_E_UNITS*blk.elowrep/temp[t]) *
+          (1-exp(-EXPCTE*wn/temp[t])) / zcut[i*TLI_NCUT+t];
+      kref[m*TLI_NCUT+t] = fmax(kref[m*TLI_NCUT+t], k);
+    }
+  }
+}
+
+
+/* FUNCTION:
+   Return 1 if no line of the block can reach the ethreshold cut at any of
+   the sampled temperatures (bounding the line strengths by the block's
+   largest gf and smallest lower-state energy), else 0.                     */
+static int
+tliweak(struct transit *tr,       /* transit structure                      */
+        struct tliblock *blk,     /* Block-index entry                      */
+        double *temp,             /* Sampled temperatures [TLI_NCUT]        */
+        double *zcut,             /* Partition functions [niso][TLI_NCUT]   */
+        double *kref){            /* Reference strengths [nmol][TLI_NCUT]   */
+  struct isotopes *iso = tr->ds.iso;
+  double a;
+  int i=blk->iso, m=iso->imol[i], t;
+
+  if (m < 0)
+    return 0;
+  a = SIGCTE*blk->gfmax*iso->isoratio[i]/iso->isof[i].m;
+  for (t=0; t<TLI_NCUT; t++)
+    if (a*exp(-EXPCTE*TLI_E_UNITS*blk->elowmin/temp[t])/zcut[i*TLI_NCUT+t]
+        >= tr->ds.th->ethresh * kref[m*TLI_NCUT+t])
+      return 0;
+  return 1;
+}
+
+
+/* FUNCTION:
+   Set the line ranges of a blocked TLI file (version blocktliversion):
+   blocks of lines of a single isotope, sorted by isotope and then by
+   wavelength, listed in an index with the wavelength range and line
+   strength bounds of each block.  Only the blocks that overlap the
+   wavelength range are read (and searched when they extend beyond it).
+   With blockcut, skip as well the blocks whose lines fall below the
+   ethreshold cut.
+   Return: the number of lines to read, or
+           -1 on unexpected EOF
+           -7 on invalid column format                                      */
+static PREC_NREC
+tliblocks(struct transit *tr,   /* transit structure                        */
+          struct lineinfo *li,  /* lineinfo structure                       */
+          struct tlimap *map,   /* Mapped TLI file                          */
+          long start,           /* Position of the column format            */
+          PREC_LNDATA iniw,     /* Initial wavelength (TLI units)           */
+          PREC_LNDATA finw){    /* Final wavelength (TLI units)             */
+  struct tliseg *seg;
+  struct tliblock blk;
+  const char *index;     /* Block index                                     */
+  int fmt,               /* Column format                                   */
+      nblock,            /* Number of blocks                                */
+      ncut=0,            /* Number of blocks below the ethreshold cut       */
+      b;
+  size_t wsize, csize;   /* Size of wavelength and of Elow and gf values    */
+  double temp[TLI_NCUT], *zcut=NULL, *kref=NULL;
+  PREC_NREC ifirst, ilast, n=0;
+
+  if (start + 2*sizeof(int) > map->size){
+    tr_output(TOUT_ERROR, "Unexpected end of file '%s'.\n", tr->f_line);
+    return -1;
+  }
+  memcpy(&fmt,    map->base+start,             sizeof(int));
+  memcpy(&nblock, map->base+start+sizeof(int), sizeof(int));
+  index = map->base + start + 2*sizeof(int);
+  if (fmt != TLI_DOUBLE && fmt != TLI_COMPACT){
+    tr_output(TOUT_ERROR, "Invalid column format (%d) of TLI file '%s'.\n",
+      fmt, tr->f_line);
+    return -7;
+  }
+  if (index + (size_t)nblock*TLI_BLOCKINFO > map->base + map->size){
+    tr_output(TOUT_ERROR, "Unexpected end of file '%s'.\n", tr->f_line);
+    return -1;
+  }
+  wsize = (fmt == TLI_DOUBLE) ? sizeof(double) : sizeof(uint32_t);
+  csize = (fmt == TLI_DOUBLE) ? sizeof(double) : sizeof(float);
+  tr_output(TOUT_DEBUG, "TLI has %d blocks of %s columns.\n", nblock,
+    (fmt == TLI_DOUBLE) ? "double" : "compact");
+
+  if (tr->ds.th->blockcut){
+    zcut = (double *)calloc(tr->ds.iso->n_i*TLI_NCUT,   sizeof(double));
+    kref = (double *)calloc(tr->ds.mol->nmol*TLI_NCUT, sizeof(double));
+    tlicutinit(tr, li, index, nblock, iniw, finw, temp, zcut, kref);
+  }
+
+  map->nseg = 0;
+  map->seg  = (struct tliseg *)calloc(nblock > 0 ? nblock : 1,
+                                      sizeof(struct tliseg));
+  for (b=0; b<nblock; b++){
+    memcpy(&blk, index + b*TLI_BLOCKINFO, sizeof(struct tliblock));
+    /* Skip the blocks out of range, and the weak ones:                     */
+    if (blk.n <= 0 || blk.wlmax < iniw || blk.wlmin > finw)
+      continue;
+    if (blk.offset < 0 ||
+        blk.offset + (size_t)blk.n*(wsize+2*csize) > map->size){
+      tr_output(TOUT_ERROR, "Unexpected end of file '%s'.\n", tr->f_line);
+      free(zcut);
+      free(kref);
+      return -1;
+    }
+    if (kref && tliweak(tr, &blk, temp, zcut, kref)){
+      ncut++;
+      continue;
+    }
+
+    seg = map->seg + map->nseg;
+    seg->fmt   = fmt;
+    seg->iso   = blk.iso;
+    seg->wl    = map->base + blk.offset;
+    seg->elow  = seg->wl   + (size_t)blk.n*wsize;
+    seg->gf    = seg->elow + (size_t)blk.n*csize;
+    seg->wl0   = blk.wlmin;
+    seg->dwl   = (blk.wlmax - blk.wlmin)/UINT32_MAX;
+    seg->first = 0;
+    seg->count = blk.n;
+    /* Search the range within the block:                                   */
+    if (blk.wlmin < iniw || blk.wlmax > finw){
+      datafileBS(seg, blk.n, iniw, &ifirst, 0);
+      datafileBS(seg, blk.n, finw, &ilast,  1);
+      if (ilast < ifirst || tliwl(seg, ifirst) < iniw ||
+                            tliwl(seg, ilast)  > finw)
+        continue;
+      seg->first = ifirst;
+      seg->count = ilast - ifirst + 1;
+    }
+    /* Request the range of each column ahead of setlinestore() (a
+       streamed line list is read as it goes instead):                      */
+    if (tr->ds.th->linechunk == 0){
+      tliadvise(map, seg->wl,   seg->first, seg->count, wsize);
+      tliadvise(map, seg->elow, seg->first, seg->count, csize);
+      tliadvise(map, seg->gf,   seg->first, seg->count, csize);
+    }
+
+    n += seg->count;
+    map->nseg++;
+  }
+  if (kref)
+    tr_output(TOUT_INFO, "Skipped %d of %d TLI blocks below the ethreshold "
+      "cut.\n", ncut, nblock);
+  free(zcut);
+  free(kref);
+  return n;
+}
+
+
+/* FUNCTION:
+   Set up the line store to stream the line ranges of the mapped TLI file
+   in chunks of up to th->linechunk lines (see linefirst()), rather than
+   reading them all into memory.  The stream takes over the mapping and
+   the line ranges.
+   Return: 0 on success, -1 on failure                                      */
+static int
+setlinestream(struct transit *tr,   /* transit structure                    */
+              struct lineinfo *li,  /* lineinfo structure                   */
+              struct tlimap *map){  /* Mapped TLI file and ranges to read   */
+  struct line_transition *lt = &li->lt;
+  struct linestream *ls;
+  int i, s;
+
+  ls = (struct linestream *)calloc(1, sizeof(struct linestream));
+  ls->segstart = (PREC_NREC *)calloc(map->nseg+1, sizeof(PREC_NREC));
+  if ((ls->fd = open(tr->f_line, O_RDONLY)) < 0){
+    tr_output(TOUT_ERROR, "Couldn't open '%s' to stream the lines: %s.\n",
+      tr->f_line, strerror(errno));
+    free(ls->segstart);
+    free(ls);
+    return -1;
+  }
+  posix_fadvise(ls->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  ls->map = *map;
+  for (s=0, i=-1; s < map->nseg; s++){
+    ls->segstart[s+1] = ls->segstart[s] + map->seg[s].count;
+    if (map->seg[s].count > 0 && map->seg[s].iso != i){
+      ls->nrun++;
+      i = map->seg[s].iso;
+    }
+  }
+  ls->nline = li->n_l;
+  ls->chunk = tr->ds.th->linechunk;
+  ls->owns  = &tr->owns;
+  ls->wn0   = tr->wns.i;
+  ls->wfct  = lt->wfct;
+  ls->efct  = lt->efct;
+  ls->iso   = tr->ds.iso;
+  lt->ls = ls;
+
+  tr_output(TOUT_INFO, "Streaming %li transitions in chunks of up to %li "
+    "lines.\n", ls->nline, ls->chunk);
+  return 0;
+}
+
+
 /* FUNCTION:
   Read and store the line transition info (central wavelength, isotope
   ID, lowE, log(gf)) into lineinfo.  Return the number of lines read.
+  The TLI file is memory mapped (shared with other processes reading the
+  same file through the page cache): the wavelength ranges are searched
+  and read in place, without copying the columns.
 
   Return: the number of records read on success, else:
           -1 unexpected EOF
-          -2 file non-seekable
+          -2 file could not be mapped
           -3 on non-integer number of structure records
           -4 First field is not valid while looking for starting point
-          -5 One of the fields contained an invalid flaoating point         */
+          -5 One of the fields contained an invalid flaoating point
+          -6 the line store (or stream) could not be set up
+          -7 invalid column format of a blocked TLI file                    */
 int readdatarng(struct transit *tr,   /* transit structure                  */
                 struct lineinfo *li){ /* lineinfo structure                 */
 
-  struct line_transition *lt = &li->lt;  /* line_transition structure       */
   FILE *fp;              /* Data file pointer                               */
+  struct stat st;        /* Data file status                                */
+  struct tlimap map;     /* Mapped TLI file                                 */
   int nlines,            /* Number of line transitions                      */
       niso,              /* Number of isotopes in line transition data      */
-      nread,             /* Number of transitions to read for each isotope  */
       *isotran,          /* Number of transitions per isotope in TLI        */
-      start,             /* Position of first LT for isotope in TLI         */
       i,                 /* for-loop index                                  */
-      offset=0,          /* Isotope offset (in number of transitions)       */
-      wl_loc, iso_loc,   /* Offsets for isoID, Elow, and gf data            */
-      el_loc, gf_loc,    /* (in memory)                                     */
       rn;                /* Return IDs                                      */
-  /* Indices of first and last transitions to be stored                     */
-  long ifirst, ilast;
+  long start;            /* Position of the line data in TLI                */
+  PREC_NREC n;           /* Number of lines to read                         */
 
   /* Auxiliary variables to keep wavelength limits:                         */
   PREC_LNDATA iniw = 1.0/(tr->wns.f*tr->wns.fct) / TLI_WAV_UNITS;
@@ -448,94 +837,477 @@ int readdatarng(struct transit *tr,   /* transit structure                  */
     return -1;
   }
 
-  /* Check seekability:                                                     */
-  if(fseek(fp, 0, SEEK_CUR)){
-    tr_output(TOUT_ERROR, "File '%s' was not seekable.\n", tr->f_line);
+  /* Map the file (the mapping outlives the file pointer):                  */
+  memset(&map, 0, sizeof(struct tlimap));
+  if (fstat(fileno(fp), &st) != 0 ||
+      (map.base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED,
+                       fileno(fp), 0)) == MAP_FAILED){
+    tr_output(TOUT_ERROR, "File '%s' could not be memory mapped: %s.\n",
+      tr->f_line, strerror(errno));
+    fclose(fp);
     return -2;
   }
+  map.size = st.st_size;
+  fclose(fp);
 
   /* Read total number of transitions in TLI file:                          */
   /* FINDME: May be better to put endinfo to the right position
              (i.e., avoid this  -sizeof(int)):                              */
-  fseek(fp, li->endinfo - sizeof(int), SEEK_SET);
-  fread(&nlines, sizeof(int), 1, fp);
+  start = li->endinfo - sizeof(int);
+  if (start + 2*sizeof(int) > map.size){
+    tr_output(TOUT_ERROR, "Unexpected end of file '%s'.\n", tr->f_line);
+    munmap(map.base, map.size);
+    return -1;
+  }
+  memcpy(&nlines, map.base+start, sizeof(int));
+  start += sizeof(int);
   tr_output(TOUT_INFO, "TLI has %d transition lines.\n", nlines);
 
   /* Number of isotopes in line transition data:                            */
-  fread(&niso, sizeof(int), 1, fp);
+  memcpy(&niso, map.base+start, sizeof(int));
+  start += sizeof(int);
   tr_output(TOUT_DEBUG, "TLI has %d isotopes.\n", niso);
+  if (start + niso*sizeof(int) > map.size){
+    tr_output(TOUT_ERROR, "Unexpected end of file '%s'.\n", tr->f_line);
+    munmap(map.base, map.size);
+    return -1;
+  }
+
   /* Number of transitions per isotope:                                     */
   isotran = calloc(niso, sizeof(int));
-  fread(isotran, sizeof(int), niso, fp);
+  memcpy(isotran, map.base+start, niso*sizeof(int));
   for (i=0; i<niso; i++){
     tr_output(TOUT_DEBUG, "Ntransitions[%d]: %d.\n", i, isotran[i]);
   }
+  start += niso*sizeof(int);
+
+  /* Set the ranges of lines to read:                                       */
+  if (li->tli_ver == blocktliversion)
+    n = tliblocks(tr, li, &map, start, iniw, finw);
+  else
+    n = tlicolumns(tr, &map, start, nlines, niso, isotran, iniw, finw);
+  free(isotran);
+  if (n < 0){
+    munmap(map.base, map.size);
+    free(map.seg);
+    return n;
+  }
+  li->n_l = n;
+
+  /* Stream the lines in chunks (the stream keeps the mapping):             */
+  if (tr->ds.th->linechunk > 0){
+    if (setlinestream(tr, li, &map) != 0){
+      munmap(map.base, map.size);
+      free(map.seg);
+      return -6;
+    }
+  }
+  /* Build the line store straight from the mapped columns:                 */
+  else{
+    rn = setlinestore(tr, li, &map);
+    munmap(map.base, map.size);
+    free(map.seg);
+    if (rn != 0)
+      return -6;
+  }
 
-  /* Get current location of pointer:                                       */
-  start = ftell(fp);
-  li->n_l = 0;
-
-  /* Allocation for line transition structures:                             */
-  /* The size might be larger than needed, adjust at the end                */
-  lt->gf    = (PREC_LNDATA *)calloc(nlines, sizeof(PREC_LNDATA));
-  lt->wl    = (PREC_LNDATA *)calloc(nlines, sizeof(PREC_LNDATA));
-  lt->elow  = (PREC_LNDATA *)calloc(nlines, sizeof(PREC_LNDATA));
-  lt->isoid = (short       *)calloc(nlines, sizeof(short));
-  /* Check for allocation errors:                                           */
-  if(!lt->gf || !lt->wl || !lt->elow || !lt->isoid) {
-    tr_output(TOUT_ERROR, "Couldn't allocate memory for "
-      "linetran structure array of length %i, in function "
-      "readdatarng.\n", nlines);
-    exit(EXIT_FAILURE);
+  tr->pi |= TRPI_READDATA;  /* Update progress indicator                    */
+  return li->n_l;           /* Return the number of lines read              */
+}
+
+
+/* FUNCTION:
+   Convert a range of lines of the mapped TLI file into the line store
+   (see setlinestore()).                                                    */
+static void
+tlirange(const struct tliseg *seg, /* Line range                            */
+         double wfct,              /* Wavelength units factor               */
+         double efct,              /* Lower-state energy units factor       */
+         double ratio,             /* Isotopic ratio                        */
+         double mass,              /* Isotope mass                          */
+         double *restrict wn,      /* Wavenumber                            */
+         double *restrict elr,     /* Scaled lower-state energy             */
+         double *restrict lgf){    /* Log of the strength factors           */
+  PREC_NREC k, n=seg->count;
+  double wl0=seg->wl0, dwl=seg->dwl;
+
+  if (seg->fmt == TLI_DOUBLE){
+    const char *wl   = seg->wl   + seg->first*sizeof(PREC_LNDATA),
+               *elow = seg->elow + seg->first*sizeof(PREC_LNDATA),
+               *gf   = seg->gf   + seg->first*sizeof(PREC_LNDATA);
+    for (k=0; k<n; k++){
+      wn [k] = 1.0/(tlivalue(wl, k)*wfct);
+      elr[k] = -EXPCTE*efct*tlivalue(elow, k);
+      lgf[k] = log(SIGCTE*tlivalue(gf, k)*ratio/mass);
+    }
+  }
+  else{
+    const char *wl   = seg->wl   + seg->first*sizeof(uint32_t),
+               *elow = seg->elow + seg->first*sizeof(float),
+               *gf   = seg->gf   + seg->first*sizeof(float);
+    for (k=0; k<n; k++){
+      wn [k] = 1.0/((wl0 + dwl*tliword(wl, k))*wfct);
+      elr[k] = -EXPCTE*efct*tlifloat(elow, k);
+      lgf[k] = log(SIGCTE*tlifloat(gf, k)*ratio/mass);
+    }
   }
+}
 
-  /* Starting location for wavelength, isoID, Elow, and gf data in file:    */
-  wl_loc  = start;
-  iso_loc = wl_loc  + nlines*sizeof(PREC_LNDATA);
-  el_loc  = iso_loc + nlines*sizeof(short);
-  gf_loc  = el_loc  + nlines*sizeof(PREC_LNDATA);
 
-  for (i=0; i<niso; i++){
-    /* Do binary search in units of TLI:                                    */
-    datafileBS(fp, start, isotran[i], iniw, &ifirst, sizeof(PREC_LNDATA), 0);
-    datafileBS(fp, start, isotran[i], finw, &ilast,  sizeof(PREC_LNDATA), 1);
-    ifirst += offset;
-    ilast  += offset;
-    tr_output(TOUT_DEBUG, "Initial and final entries are: "
-      "%li and %li.\n", ifirst, ilast);
-
-    /* Number of transitions to read:                                       */
-    nread = ilast - ifirst + 1;
-    /* Move pointer to each section and read info:                          */
-    /* Wavelength:                                                          */
-    fseek(fp, ifirst*sizeof(PREC_LNDATA) + wl_loc,  SEEK_SET);
-    fread(lt->wl+li->n_l,    sizeof(PREC_LNDATA), nread, fp);
-    /* Isotope ID:                                                          */
-    fseek(fp, ifirst*sizeof(short)       + iso_loc, SEEK_SET);
-    fread(lt->isoid+li->n_l, sizeof(short),       nread, fp);
-    /* Lower-state energy:                                                  */
-    fseek(fp, ifirst*sizeof(PREC_LNDATA) + el_loc,  SEEK_SET);
-    fread(lt->elow+li->n_l,  sizeof(PREC_LNDATA), nread, fp);
-    /* gf:                                                                  */
-    fseek(fp, ifirst*sizeof(PREC_LNDATA) + gf_loc,  SEEK_SET);
-    fread(lt->gf+li->n_l,    sizeof(PREC_LNDATA), nread, fp);
+/* FUNCTION:
+   Convert the line transitions of the mapped TLI file into the line store
+   used by computemolext(): aligned arrays with the wavenumber, the scaled
+   lower-state energy, and the logarithm of the temperature-independent
+   factors of the line strength, so that the strength of a line at
+   temperature T and partition function Z is:
+     exp(lgf + elr/T) * (1 - exp(-EXPCTE*wn/T)) / Z.
+   The line ranges come sorted by isotope and then by wavelength, group
+   them in runs of a same isotope so that computemolext() can bisect them.
+   Return: 0 on success, -1 on allocation failure                          */
+int
+setlinestore(struct transit *tr,   /* transit structure                     */
+             struct lineinfo *li,  /* lineinfo structure                    */
+             struct tlimap *map){  /* Mapped TLI file and ranges to read    */
+  struct line_transition *lt = &li->lt;
+  struct isotopes *iso = tr->ds.iso;
+  struct tliseg *seg;
+  PREC_NREC n = li->n_l,
+            ln;
+  size_t size = (n > 0 ? n : 1) * sizeof(double);
+  void *wn, *elr, *lgf;
+  int i, r, s;
+
+  if (posix_memalign(&wn,  LINE_ALIGN, size) != 0 ||
+      posix_memalign(&elr, LINE_ALIGN, size) != 0 ||
+      posix_memalign(&lgf, LINE_ALIGN, size) != 0){
+    tr_output(TOUT_ERROR, "Couldn't allocate memory for the line store "
+      "of %li transitions.\n", n);
+    return -1;
+  }
+  lt->wn  = (double *)wn;
+  lt->elr = (double *)elr;
+  lt->lgf = (double *)lgf;
+
+  /* Count the isotope runs (consecutive ranges of a same isotope):         */
+  lt->nrun = 0;
+  for (s=0, i=-1; s < map->nseg; s++)
+    if (map->seg[s].count > 0 && map->seg[s].iso != i){
+      lt->nrun++;
+      i = map->seg[s].iso;
+    }
+  lt->rfirst = (PREC_NREC *)calloc(lt->nrun+1, sizeof(PREC_NREC));
+  lt->riso   = (short     *)calloc(lt->nrun+1, sizeof(short));
+
+  for (s=0, ln=0, r=-1, i=-1; s < map->nseg; s++){
+    seg = map->seg + s;
+    if (seg->count > 0 && seg->iso != i){
+      lt->rfirst[++r] = ln;
+      lt->riso[r]     = i = seg->iso;
+    }
+    ln += seg->count;
+  }
+  lt->rfirst[lt->nrun] = n;
+
+  /* Read each range of the mapped columns into the line store:             */
+  for (s=0, ln=0; s < map->nseg; s++){
+    seg = map->seg + s;
+    tlirange(seg, lt->wfct, lt->efct, iso->isoratio[seg->iso],
+             iso->isof[seg->iso].m, lt->wn+ln, lt->elr+ln, lt->lgf+ln);
+    ln += seg->count;
+  }
 
-    /* Count the number of lines:                                           */
-    li->n_l += nread;
-    /* Move the wl offset to next isotope:                                  */
-    start += isotran[i]*sizeof(double);
-    offset += isotran[i];
+  tr_output(TOUT_DEBUG, "Line store: %li transitions in %i isotope "
+    "runs.\n", n, lt->nrun);
+  return 0;
+}
+
+
+/* FUNCTION: Read size bytes of the TLI file, at the position of col in
+   the mapping, into buf.  Exit on failure.                                 */
+static void
+tlipread(struct linestream *ls, /* Line stream                              */
+         char *buf,             /* Output buffer                            */
+         const char *col,       /* Position in the mapping                  */
+         size_t size){          /* Number of bytes                          */
+  off_t off = col - ls->map.base;
+  ssize_t rn;
+
+  while (size > 0){
+    rn = pread(ls->fd, buf, size, off);
+    if (rn <= 0){
+      tr_output(TOUT_ERROR, "Couldn't read the line stream: %s.\n",
+        rn < 0 ? strerror(errno) : "unexpected end of file");
+      exit(EXIT_FAILURE);
+    }
+    buf  += rn;
+    off  += rn;
+    size -= rn;
   }
+}
 
-  /* Re-allocate arrays to their correct size:                              */
-  lt->wl    = (PREC_LNDATA *)realloc(lt->wl,    li->n_l*sizeof(PREC_LNDATA));
-  lt->isoid = (short       *)realloc(lt->isoid, li->n_l*sizeof(short));
-  lt->elow  = (PREC_LNDATA *)realloc(lt->elow,  li->n_l*sizeof(PREC_LNDATA));
-  lt->gf    = (PREC_LNDATA *)realloc(lt->gf,    li->n_l*sizeof(PREC_LNDATA));
 
-  fclose(fp);               /* Close file                                   */
-  tr->pi |= TRPI_READDATA;  /* Update progress indicator                    */
-  return li->n_l;           /* Return the number of lines read              */
+/* FUNCTION:
+   Whether no group of co-added lines (see computemolext()) can hold both
+   the line at wavenumber wn1 and the next line of its isotope run, at wn2.
+   A group is centered at the oversampled wavenumber closest to its first
+   line, thus at or above the one closest to wn1, and takes in the lines
+   within one oversampling interval of its center.                          */
+static _Bool
+groupbreak(struct linestream *ls, /* Line stream                            */
+           PREC_RES wn1,          /* Wavenumber of a line                   */
+           PREC_RES wn2){         /* Wavenumber of the next line (<= wn1)   */
+  prop_samp *ows = ls->owns;
+  PREC_RES odwn = ows->d/ows->o;  /* Oversampling interval                  */
+  long iown = (wn1 - ls->wn0)/odwn;
+
+  /* Beyond the oversampled range, take the widest group:                   */
+  if (wn1 < ls->wn0 || iown+1 >= ows->n)
+    return wn1 - wn2 >= 2*odwn;
+  if (fabs(wn1 - ows->v[iown+1]) < fabs(wn1 - ows->v[iown]))
+    iown++;
+  return ows->v[iown] - wn2 >= odwn;
+}
+
+
+/* FUNCTION:
+   Read the chunk of the line stream ls that starts at the stream index
+   pos into the chunk buffer ck, using raw as scratch space for the TLI
+   columns.  Unless it is the last one, the chunk ends at its latest
+   boundary that no co-added group of lines spans (a change of isotope
+   run, or see groupbreak()), so that going through the chunks in order
+   adds up the lines exactly as going through the whole line store does.
+   Return: the stream index past the chunk                                  */
+static PREC_NREC
+readchunk(struct linestream *ls,      /* Line stream                        */
+          PREC_NREC pos,              /* Stream index of the chunk          */
+          struct line_transition *ck, /* Chunk buffer                       */
+          char *raw){                 /* Raw-column buffer                  */
+  struct tliseg *seg, part;
+  PREC_NREC n=0, k, cnt;
+  size_t wsize, csize;
+  int s=0, r=-1, i=-1;
+
+  /* Range that holds the first line of the chunk:                          */
+  while (s+1 < ls->map.nseg && ls->segstart[s+1] <= pos)
+    s++;
+
+  for (; s < ls->map.nseg && n < ls->chunk; s++){
+    seg = ls->map.seg + s;
+    k   = pos + n - ls->segstart[s];  /* First line to read in the range    */
+    cnt = seg->count - k;
+    if (cnt > ls->chunk - n)
+      cnt = ls->chunk - n;
+    if (cnt <= 0)
+      continue;
+
+    /* Read the columns of the lines, then convert them into the buffer:    */
+    wsize = (seg->fmt == TLI_DOUBLE) ? sizeof(PREC_LNDATA) : sizeof(uint32_t);
+    csize = (seg->fmt == TLI_DOUBLE) ? sizeof(PREC_LNDATA) : sizeof(float);
+    tlipread(ls, raw,               seg->wl   + (seg->first+k)*wsize,
+             cnt*wsize);
+    tlipread(ls, raw + cnt*wsize,   seg->elow + (seg->first+k)*csize,
+             cnt*csize);
+    tlipread(ls, raw + cnt*(wsize+csize), seg->gf + (seg->first+k)*csize,
+             cnt*csize);
+    part = *seg;
+    part.wl    = raw;
+    part.elow  = raw + cnt*wsize;
+    part.gf    = raw + cnt*(wsize+csize);
+    part.first = 0;
+    part.count = cnt;
+    if (seg->iso != i){
+      ck->rfirst[++r] = n;
+      ck->riso[r]     = i = seg->iso;
+    }
+    tlirange(&part, ls->wfct, ls->efct, ls->iso->isoratio[seg->iso],
+             ls->iso->isof[seg->iso].m, ck->wn+n, ck->elr+n, ck->lgf+n);
+    n += cnt;
+  }
+  ck->nrun = r + 1;
+
+  /* End the chunk at a safe boundary, between lines k-1 and k:             */
+  if (pos + n < ls->nline){
+    for (k=n-1; k >= 1; k--){
+      while (ck->rfirst[r] > k)
+        r--;
+      if (ck->rfirst[r] == k || groupbreak(ls, ck->wn[k-1], ck->wn[k]))
+        break;
+    }
+    if (k >= 1){
+      n = k;
+      ck->nrun = (ck->rfirst[r] == k) ? r : r+1;
+    }
+    /* The chunk lies within a group, warn once per stream:                 */
+    else if (!__sync_lock_test_and_set(&ls->warned, 1))
+      tr_output(TOUT_WARN, "The line chunk at %li ends within a group of "
+        "co-added lines, its lines add up slightly differently than "
+        "without chunks.  Use a larger --linechunk.\n", pos);
+  }
+  ck->rfirst[ck->nrun] = n;
+  return pos + n;
+}
+
+
+/* FUNCTION: Read-ahead thread, read the chunk following the current one
+   into the other buffer of the cursor.                                     */
+static void *
+readahead(void *arg){  /* Line cursor                                       */
+  struct linecursor *lc = (struct linecursor *)arg;
+  int b = 1 - lc->cur;
+
+  lc->end[b] = readchunk(lc->lt->ls, lc->pos[b], lc->buf+b, lc->raw[b]);
+  return NULL;
+}
+
+
+/* FUNCTION: Start reading the chunk that follows the current one, unless
+   it is the end of the stream, or the other buffer already holds it.       */
+static void
+startahead(struct linecursor *lc){  /* Line cursor                          */
+  int b = 1 - lc->cur;
+
+  if (lc->end[lc->cur] >= lc->lt->ls->nline || lc->pos[b] == lc->end[lc->cur])
+    return;
+  lc->pos[b] = lc->end[lc->cur];
+  if (pthread_create(&lc->thread, NULL, readahead, lc) == 0)
+    lc->busy = 1;
+  else
+    readahead(lc);  /* Read it now */
+}
+
+
+/* FUNCTION: Wait for the read-ahead thread to finish.                      */
+static void
+waitahead(struct linecursor *lc){  /* Line cursor                           */
+  if (lc->busy){
+    pthread_join(lc->thread, NULL);
+    lc->busy = 0;
+  }
+}
+
+
+/* FUNCTION:
+   Allocate the chunk buffers of a cursor over the line store of tr (see
+   linefirst()).  Each thread going through the line store concurrently
+   needs its own cursor.  On failure, freemem_linecursor() still frees the
+   buffers allocated so far.
+   Return: 0 on success, -1 on allocation failure                           */
+int
+alloc_linecursor(struct transit *tr,     /* transit structure               */
+                 struct linecursor *lc){ /* Line cursor                     */
+  struct line_transition *lt = &tr->ds.li->lt;
+  struct linestream *ls = lt->ls;
+  void *wn, *elr, *lgf;
+  size_t size;
+  int b;
+
+  memset(lc, 0, sizeof(struct linecursor));
+  lc->lt = lt;
+  /* A stored line list is a single chunk:                                  */
+  if (ls == NULL){
+    lc->maxrun  = lt->nrun;
+    lc->maxline = tr->ds.li->n_l;
+    return 0;
+  }
+
+  lc->maxrun  = ls->nrun;
+  lc->maxline = ls->chunk;
+  size = ls->chunk * sizeof(double);
+  for (b=0; b<2; b++){
+    if (posix_memalign(&wn,  LINE_ALIGN, size) != 0)
+      wn  = NULL;
+    if (posix_memalign(&elr, LINE_ALIGN, size) != 0)
+      elr = NULL;
+    if (posix_memalign(&lgf, LINE_ALIGN, size) != 0)
+      lgf = NULL;
+    lc->buf[b].wfct   = lt->wfct;
+    lc->buf[b].efct   = lt->efct;
+    lc->buf[b].wn     = (double *)wn;
+    lc->buf[b].elr    = (double *)elr;
+    lc->buf[b].lgf    = (double *)lgf;
+    if (!wn || !elr || !lgf){
+      tr_output(TOUT_ERROR, "Couldn't allocate memory for the line chunks "
+        "of %li transitions.\n", ls->chunk);
+      return -1;
+    }
+    lc->buf[b].rfirst = (PREC_NREC *)calloc(ls->nrun+1, sizeof(PREC_NREC));
+    lc->buf[b].riso   = (short     *)calloc(ls->nrun+1, sizeof(short));
+    /* Largest raw columns (double format):                                 */
+    lc->raw[b] = (char *)malloc(3*size);
+    lc->pos[b] = -1;  /* Empty */
+    if (!lc->buf[b].rfirst || !lc->buf[b].riso || !lc->raw[b]){
+      tr_output(TOUT_ERROR, "Allocation fail.\n");
+      return -1;
+    }
+  }
+  return 0;
+}
+
+
+/* FUNCTION:
+   Go through the line store one chunk at a time:
+     for (lt=linefirst(lc); lt; lt=linenext(lc))
+   If the lines are stored, the only chunk is the line store itself.  If
+   they are streamed, each chunk holds up to th->linechunk lines, in runs
+   of a same isotope as in the line store, and the next chunk is read in
+   the background while the current one is in use.  A group of lines that
+   computemolext() co-adds never spans two chunks.
+   Return: the first chunk                                                  */
+struct line_transition *
+linefirst(struct linecursor *lc){  /* Line cursor                           */
+  struct linestream *ls = lc->lt->ls;
+
+  if (ls == NULL)
+    return lc->lt;
+  waitahead(lc);
+  /* Keep the first chunk if a previous pass left it in a buffer:           */
+  if (lc->pos[lc->cur] != 0){
+    lc->cur = 1 - lc->cur;
+    if (lc->pos[lc->cur] != 0){
+      lc->pos[lc->cur] = 0;
+      lc->end[lc->cur] = readchunk(ls, 0, lc->buf+lc->cur, lc->raw[lc->cur]);
+    }
+  }
+  startahead(lc);
+  return lc->buf + lc->cur;
+}
+
+
+/* FUNCTION: Move the cursor to the next chunk (see linefirst()).
+   Return: the next chunk, or NULL at the end of the line store             */
+struct line_transition *
+linenext(struct linecursor *lc){  /* Line cursor                            */
+  struct linestream *ls = lc->lt->ls;
+
+  if (ls == NULL)
+    return NULL;
+  waitahead(lc);
+  if (lc->end[lc->cur] >= ls->nline)
+    return NULL;
+  lc->cur = 1 - lc->cur;
+  startahead(lc);
+  return lc->buf + lc->cur;
+}
+
+
+/* FUNCTION: Free the chunk buffers of a line cursor.
+   Return: 0 on success                                                     */
+int
+freemem_linecursor(struct linecursor *lc){  /* Line cursor                  */
+  int b;
+
+  waitahead(lc);
+  if (lc->lt == NULL || lc->lt->ls == NULL)
+    return 0;
+  for (b=0; b<2; b++){
+    free(lc->buf[b].wn);
+    free(lc->buf[b].elr);
+    free(lc->buf[b].lgf);
+    free(lc->buf[b].rfirst);
+    free(lc->buf[b].riso);
+    free(lc->raw[b]);
+  }
+  return 0;
 }
 
 
@@ -546,32 +1318,32 @@ int readdatarng(struct transit *tr,   /* transit structure                  */
 int
 readlineinfo(struct transit *tr){
   struct transithint *th=tr->ds.th;
-  static struct lineinfo li;
-  static struct isotopes iso;
+  struct lineinfo *li = &tr->st.li;
+  struct isotopes *iso = &tr->st.iso;
   long rn;  /* Sub-routines returned status */
   int filecheck;  /* Integer to check if opacity file exists */
 
-  memset(&li,  0, sizeof(struct lineinfo));
-  memset(&iso, 0, sizeof(struct isotopes));
-  tr->ds.li  = &li;   /* lineinfo                                           */
-  tr->ds.iso = &iso;  /* isotopes                                           */
+  memset(li,  0, sizeof(struct lineinfo));
+  memset(iso, 0, sizeof(struct isotopes));
+  tr->ds.li  = li;   /* lineinfo                                            */
+  tr->ds.iso = iso;  /* isotopes                                            */
 
   /* Set some defaults:                                                     */
-  li.ni  = iso.n_i  = 0;  /* Number of isotopes                             */
-  li.ndb = iso.n_db = 0;  /* Number of databases                            */
+  li->ni  = iso->n_i  = 0; /* Number of isotopes                            */
+  li->ndb = iso->n_db = 0; /* Number of databases                           */
   /* Min and max allowed temperatures in TLI files:                         */
-  li.tmin =     0.0;
-  li.tmax = 70000.0;
+  li->tmin =     0.0;
+  li->tmax = 70000.0;
 
   /* Read hinted info file:                                                 */
   tr_output(TOUT_INFO, "Reading info file '%s' ...\n", th->f_line);
-  rn = readinfo_tli(tr, &li);
+  rn = readinfo_tli(tr, li);
   tr_output(TOUT_INFO, "Done.\n\n");
 
   /* Check the remainder range of the hinted values
      related to line database reading:                                      */
   if (rn != -2){
-    if((rn=checkrange(tr, &li)) < 0) {
+    if((rn=checkrange(tr, li)) < 0) {
       tr_output(TOUT_ERROR, "checkrange() returned error code %i.\n", rn);
       exit(EXIT_FAILURE);
     }
@@ -586,11 +1358,11 @@ readlineinfo(struct transit *tr){
 
   /* Check for an opacity file:                                             */
   filecheck = access(th->f_opa, F_OK);
-  /* Only read the TLI file if there is no opacity file                     */
-  if(filecheck == -1 && rn != -2){
+  /* Only read the TLI file if there is no opacity file (or to extend it):  */
+  if((filecheck == -1 || th->opaextend) && rn != -2){
     /* Read data file:                                                      */
     tr_output(TOUT_INFO, "Reading data.\n");
-    if((rn=readdatarng(tr, &li)) < 0) {
+    if((rn=readdatarng(tr, li)) < 0) {
       tr_output(TOUT_ERROR, "readdatarng returned error code %li.\n", rn);
       exit(EXIT_FAILURE);
     }
@@ -610,7 +1382,7 @@ readlineinfo(struct transit *tr){
   tr_output(TOUT_INFO, "Status so far:\n"
     " * I read %li records from the datafile.\n"
     " * The wavelength range read was %.8g to %.8g microns.\n",
-    li.n_l, 1.0/tr->wns.f*fct_to_microns,
+    li->n_l, 1.0/tr->wns.f*fct_to_microns,
     1.0/tr->wns.i*fct_to_microns);
   return 0;
 }
@@ -684,11 +1456,22 @@ freemem_lineinfo(struct lineinfo *li,
 int
 freemem_linetransition(struct line_transition *lt,
                        long *pi){
-  /* Free the four arrays of lt:                                            */
-  free(lt->wl);
-  free(lt->elow);
-  free(lt->gf);
-  free(lt->isoid);
+  /* Free the arrays of lt:                                                 */
+  free(lt->wn);
+  free(lt->elr);
+  free(lt->lgf);
+  free(lt->rfirst);
+  free(lt->riso);
+
+  /* Close the line stream:                                                 */
+  if (lt->ls){
+    close(lt->ls->fd);
+    munmap(lt->ls->map.base, lt->ls->map.size);
+    free(lt->ls->map.seg);
+    free(lt->ls->segstart);
+    free(lt->ls);
+    lt->ls = NULL;
+  }
 
   /* Unset appropiate flags:                                                */
   *pi &= ~TRPI_READDATA;
@@ -3,6 +3,8 @@
 
 #include <transit.h>
 
+#define MOD_CHUNK 256  /* Wavenumbers per parallel work unit              */
+
 
 /* FUNCTION
    Compute the light path and optical depth at a given impact parameter
@@ -108,6 +110,109 @@ totaltau1(PREC_RES b,    /* Impact parameter                                */
 }
 
 
+/* FUNCTION
+   Tabulate, for each impact parameter, the weights of the extinction
+   samples in the optical depth of totaltau1().  totaltau1() is linear in
+   the extinction and its path geometry does not depend on wavenumber, so
+   tau() evaluates each ray as a dot product of the weights with the
+   extinction column instead.  The weights include the parabolic
+   extinction at the closest approach and the factor of two of the
+   symmetric path.
+   Return: 0 on success                                                     */
+int
+slantweights(struct transit *tr){  /* transit struct                        */
+  struct optdepth *tau = tr->ds.tau; /* Optical-depth struct                */
+  PREC_RES *rad  = tr->rads.v;       /* Layer radius array                  */
+  long     nrad  = tr->rads.n,       /* Number of layers                    */
+           nip   = tr->ips.n;        /* Number of impact parameters         */
+  PREC_RES refr  = tr->ds.ir->n[0];  /* Constant index of refraction        */
+  long ip, rs,          /* Impact-parameter and closest-layer indices       */
+       n, k;            /* Number of layers in the path, for-loop index     */
+  double b, r0,         /* Impact parameter and closest approach            */
+         p[3],          /* Weights of the parabolic extinction at r0        */
+         unit[3],       /* Unit vector                                      */
+         rr[nrad+1],    /* Radii along the path                             */
+         s[nrad+1],     /* Distance along the path                          */
+         h[nrad+1],     /* Intervals along the path                         */
+         c[nrad+1];     /* Simpson weights along the path                   */
+  PREC_RES *w;
+
+  /* Allocate the weights, or reset the ones kept from the previous run:    */
+  if (tau->w == NULL){
+    tau->first = (long *)calloc(nip, sizeof(long));
+    tau->nw    = (long *)calloc(nip, sizeof(long));
+    tau->w     = (PREC_RES **)calloc(nip, sizeof(PREC_RES *));
+    tau->w[0]  = (PREC_RES  *)calloc(nip*nrad, sizeof(PREC_RES));
+  }
+  else{
+    memset(tau->first, 0, nip*sizeof(long));
+    memset(tau->nw,    0, nip*sizeof(long));
+    memset(tau->w[0],  0, nip*nrad*sizeof(PREC_RES));
+  }
+
+  for (ip=0; ip < nip; ip++){
+    tau->w[ip] = w = tau->w[0] + ip*nrad;
+    /* Same impact parameter as passed to transittau() by tau():            */
+    b  = tr->ips.v[ip]*tr->ips.fct/tr->rads.fct;
+    r0 = b/refr;
+
+    /* Outermost layer, no path:                                            */
+    rs = binsearch(rad, 0, nrad-1, r0);
+    if ((rs == -5) || (rs == -2) || (rs == nrad-1))
+      continue;
+    /* Leave the error handling to totaltau1():                             */
+    if (rs < 0){
+      tau->nw[ip] = -1;
+      continue;
+    }
+    n = nrad - rs;
+
+    /* Extinction at r0 (as in totaltau1(), use the layers rs-1 to rs+1
+       if there are only two layers in the path):                           */
+    tau->first[ip] = (n == 2) ? rs-1 : rs;
+    for (k=0; k<3; k++){
+      unit[0] = unit[1] = unit[2] = 0.0;
+      unit[k] = 1.0;
+      p[k] = interp_parab(rad+tau->first[ip], unit, r0);
+    }
+
+    /* Radii along the path, with an intermediate point if there are only
+       two layers:                                                          */
+    rr[0] = r0;
+    for (k=1; k<n; k++)
+      rr[k] = rad[rs+k];
+    if (n == 2){
+      rr[2] = rr[1];
+      rr[1] = (r0 + rr[2])/2.0;
+    }
+
+    /* Simpson weights along the path (only valid for refraction index 1):  */
+    s[0] = 0;
+    for (k=1; k < n+(n==2); k++)
+      s[k] = sqrt(rr[k]*rr[k] - r0*r0);
+    makeh(s, h, n+(n==2));
+    simpsweights(h, c, n+(n==2));
+
+    /* Collect the weights per layer:                                       */
+    if (n == 2){
+      tau->nw[ip] = 3;
+      for (k=0; k<3; k++)
+        w[k] = 2 * (c[0] + c[1]/2.0) * p[k];
+      w[2] += 2 * (c[1]/2.0 + c[2]);
+    }
+    else{
+      tau->nw[ip] = n;
+      for (k=1; k<n; k++)
+        w[k] = 2 * c[k];
+      for (k=0; k<3; k++)
+        w[k] += 2 * c[0] * p[k];
+    }
+  }
+
+  return 0;
+}
+
+
 /* FUNCTION
    Compute the light path and optical depth at a given impact parameter
    and wavenumber, for a medium with constant index of refraction
@@ -244,8 +349,6 @@ transittau(struct transit *tr,
            PREC_RES b,      /* Impact paramer                               */
            PREC_RES *ex){   /* Extinction array [rad]                       */
 
-  /* Optical depth calculation level:                                       */
-  tr->taulevel = tr->ds.th->taulevel;
   PREC_RES *refr = tr->ds.ir->n;     /* Index-of-refraction array           */
   PREC_RES *rad  = tr->rads.v;       /* Layer radius array                  */
   PREC_RES nrad  = tr->rads.n;       /* Number of layers                    */
@@ -275,8 +378,7 @@ int
 modulation(struct transit *tr){
   struct optdepth *tau = tr->ds.tau;
   struct geometry *sg  = tr->ds.sg;
-  static struct outputray st_out;
-  tr->ds.out = &st_out;
+  tr->ds.out = &tr->st.out;
 
   long w;
   prop_samp *ip = &tr->ips;
@@ -288,8 +390,11 @@ modulation(struct transit *tr){
                                               "makeipsample", TRPI_MAKEIP,
                                               "makewnsample", TRPI_MAKEWN);
 
-  /* Allocate the modulation array:                                         */
-  PREC_RES *out = st_out.o = (PREC_RES *)calloc(wn->n, sizeof(PREC_RES));
+  /* Allocate the modulation array (unless kept from the previous run, every
+     value is overwritten below):                                           */
+  if (tr->ds.out->o == NULL)
+    tr->ds.out->o = (PREC_RES *)calloc(wn->n, sizeof(PREC_RES));
+  PREC_RES *out = tr->ds.out->o;
 
   /* Set time to the user hinted default, and other user hints:             */
   setgeom(sg, HUGE_VAL, &tr->pi);
@@ -299,7 +404,14 @@ modulation(struct transit *tr){
 
   int nextw = wn->n/10;
 
+  /* The wavenumber samples are independent, compute them in parallel
+     chunks when several threads are available:                             */
+  int nthreads = tr->nthreads;
+  tr->modlevel = tr->ds.th->modlevel;
+
   /* Calculate the modulation spectrum at each wavenumber:                  */
+  #pragma omp parallel for schedule(dynamic, MOD_CHUNK)                   \
+                           num_threads(nthreads) if(nthreads > 1)
   for(w=0; w < wn->n; w++){
     out[w] = sol->spectrum(tr, tau->t[w], wn->v[w], tau->last[w],
                            tau->toomuch, ip);
@@ -324,7 +436,7 @@ modulation(struct transit *tr){
     }
 
     /* Print to screen the progress status:                                 */
-    if(w==nextw){
+    if(nthreads == 1 && w==nextw){
       nextw += wn->n/10;
       tr_output(TOUT_DEBUG, "%i%% ", (10*(int)(10*w/wn->n+0.9999999999)));
     }
@@ -484,7 +596,6 @@ modulationperwn(struct transit *tr,  /* Transit structure                   */
                 double toomuch,      /* Maximum optical depth calculated    */
                 prop_samp *ip){      /* Impact parameter array              */
 
-  tr->modlevel = tr->ds.th->modlevel;
   struct geometry *sg  = tr->ds.sg;
 
   switch(tr->modlevel){
@@ -564,6 +675,7 @@ freemem_outputray(struct outputray *out,
                   long *pi){
   /* Free arrays: */
   free(out->o);
+  out->o = NULL;
 
   /* Clear PI and return: */
   *pi &= ~(TRPI_MODULATION);
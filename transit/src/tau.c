@@ -5,6 +5,7 @@
 
 #define CIA_DOFLOAT  2
 #define CIA_RADFIRST 1
+#define TAU_CHUNK  256  /* Wavenumbers per parallel work unit               */
 
 /* FUNCTION
    Initialize the optical depth structure for transit or eclipse geometry   */
@@ -14,44 +15,135 @@ init_optdepth(struct transit *tr){
   long int nwn  = tr->wns.n;         /* Number of wavenumbers               */
   long int i;                        /* For counting angles                 */
   int an = tr->ann;                  /* Number of angles                    */
-  static struct optdepth tau;        /* Optical depth                       */
-  static struct grid intens;         /* Intensity grid                      */
+  struct optdepth *tau = &tr->st.tau;   /* Optical depth                    */
+  struct grid *intens = &tr->st.intens; /* Intensity grid                   */
 
   long int nrad = tr->rads.n;  /* Number of layers                          */
   if (strcmp(tr->sol->name, "transit") == 0)
     nrad = tr->ips.n;          /* Number of impact parameter samples        */
 
   /* Initialize tau (optical depth) structure:                              */
-  tr->ds.tau    = &tau;
+  tr->ds.tau    = tau;
   /* Set maximum optical depth:                                             */
   if(th->toomuch > 0)
-    tau.toomuch = th->toomuch;
+    tau->toomuch = th->toomuch;
 
-  /* Allocate array with layer index where tau reaches toomuch:             */
-  tau.last = (long      *)calloc(nwn,      sizeof(long));
-  /* Allocate optical-depth array [rad][wn]:                                */
-  tau.t    = (PREC_RES **)calloc(nwn,      sizeof(PREC_RES *));
-  tau.t[0] = (PREC_RES  *)calloc(nwn*nrad, sizeof(PREC_RES  ));
-  for(i=1; i<nwn; i++)
-    tau.t[i] = tau.t[0] + i*nrad;
+  /* Reset the arrays kept from the previous run:                          */
+  if (tau->t != NULL){
+    memset(tau->last, 0, nwn*sizeof(long));
+    memset(tau->t[0], 0, nwn*nrad*sizeof(PREC_RES));
+  }
+  else{
+    /* Allocate array with layer index where tau reaches toomuch:           */
+    tau->last = (long      *)calloc(nwn,      sizeof(long));
+    /* Allocate optical-depth array [rad][wn]:                              */
+    tau->t    = (PREC_RES **)calloc(nwn,      sizeof(PREC_RES *));
+    tau->t[0] = (PREC_RES  *)calloc(nwn*nrad, sizeof(PREC_RES  ));
+    for(i=1; i<nwn; i++)
+      tau->t[i] = tau->t[0] + i*nrad;
+  }
+
+  /* Optical depth calculation level (read by tau()'s parallel loop):       */
+  tr->taulevel = th->taulevel;
+
+  /* Tabulate the slant-path weights (constant index of refraction):        */
+  if (strcmp(tr->sol->name, "transit") == 0 && th->taulevel == 1)
+    slantweights(tr);
 
   /* Eclipse-only structures:                                               */
   if (strcmp(tr->sol->name, "eclipse") == 0){
     /* Initialize intensity grid structure:                                 */
-    tr->ds.intens = &intens;
-    memset(&intens, 0, sizeof(struct grid));
-
-    /* Allocate 2D array of intensities [angle][wn]:                        */
-    intens.a    = (PREC_RES **)calloc(an,     sizeof(PREC_RES *));
-    intens.a[0] = (PREC_RES  *)calloc(an*nwn, sizeof(PREC_RES  ));
-    for(i=1; i<an; i++)
-      intens.a[i] = intens.a[0] + i*nwn;
+    tr->ds.intens = intens;
+
+    /* Allocate 2D array of intensities [angle][wn] (every run overwrites
+       all of its values):                                                  */
+    if (intens->a == NULL){
+      intens->a    = (PREC_RES **)calloc(an,     sizeof(PREC_RES *));
+      intens->a[0] = (PREC_RES  *)calloc(an*nwn, sizeof(PREC_RES  ));
+      for(i=1; i<an; i++)
+        intens->a[i] = intens->a[0] + i*nwn;
+    }
   }
 
   return 0;
 }
 
 
+/* FUNCTION
+   Compute the molecular extinction at layer r, either by interpolating
+   the opacity grid or line by line (density and Z are scratch arrays for
+   the latter).                                                             */
+static void
+layerext(struct transit *tr,   /* transit struct                            */
+         long r,               /* Radius index                              */
+         PREC_ATM *density,    /* Molecular densities at layer r            */
+         double *Z,            /* Isotopic partition functions at layer r   */
+         struct extwork *ew){  /* computemolext() scratch buffers           */
+  int i, rn;
+
+  if (tr->fp_opa != NULL)
+    interpolmolext(tr, r, tr->ds.ex->e);
+  else if (tr->f_line != NULL){
+    for (i=0; i < tr->ds.mol->nmol; i++)
+      density[i] = tr->ds.mol->molec[i].d[r];
+    for (i=0; i < tr->ds.iso->n_i; i++)
+      Z[i]       = tr->ds.iso->isov[i].z [r];
+    if((rn=computemolext(tr, tr->ds.ex->e+r, tr->atm.t[r]*tr->atm.tfct,
+                         density, Z, 0, ew)) != 0) {
+      tr_output(TOUT_ERROR, "computemolext() returned error code %i.\n", rn);
+      exit(EXIT_FAILURE);
+    }
+  }
+  tr->ds.ex->computed[r] = 1;
+}
+
+
+/* FUNCTION
+   Optical depth of the ray ri (at height or impact parameter b, in cm)
+   for the extinction profile er, from the slant-path weights if they
+   were tabulated, or else from transittau() or eclipsetau().               */
+static inline PREC_RES
+raytau(struct transit *tr,
+       long ri,             /* Ray index                                    */
+       PREC_RES b,          /* Height or impact parameter (cm)              */
+       PREC_RES *er){       /* Extinction per layer                         */
+  struct optdepth *tau = tr->ds.tau;
+  double rfct = tr->rads.fct;
+  long i;
+
+  if (tau->w != NULL && tau->nw[ri] >= 0){
+    PREC_RES *w = tau->w[ri],
+             *x = er + tau->first[ri],
+             sum = 0.0;
+    for (i=0; i < tau->nw[ri]; i++)
+      sum += w[i] * x[i];
+    return rfct * sum;
+  }
+  return rfct * tr->sol->optdepth(tr, b/rfct, er);
+}
+
+
+/* FUNCTION
+   Set tau.last at wavenumber index wi once the ray ri reaches toomuch,
+   warning if that happens too close to the top of the atmosphere.          */
+static void
+settoomuch(struct transit *tr,
+           long wi,          /* Wavenumber index                            */
+           long ri,          /* Ray index                                   */
+           PREC_RES b){      /* Height or impact parameter (cm)             */
+  struct optdepth *tau = tr->ds.tau;
+
+  tau->last[wi] = ri;
+  if (ri < 3) {
+    tr_output(TOUT_WARN, "At wavenumber %g (cm-1), the optical "
+      "depth (%g) exceeded toomuch (%g) at the height "
+      "level %li (%g km), this should have happened in a "
+      "deeper layer.\n", tr->wns.v[wi],
+      tau->t[wi][ri], tau->toomuch, ri, b/1e5);
+  }
+}
+
+
 /* FUNCTION
    Calculate the optical depth as a function of radii for a spherically
    symmetric planet.
@@ -63,11 +155,9 @@ tau(struct transit *tr){
 
   struct extinction *ex = tr->ds.ex;     /* Extinction struct               */
   PREC_RES **e = ex->e;                  /* Extinction coefficient          */
-  PREC_RES (*fcn)() = tr->sol->optdepth; /* eclipsetau or transittau func.  */
 
   long wi, ri = 0; /* Indices for wavenumber, and radius                    */
-  int rn;          /* Functions output code                                 */
-  int i;
+  int nthreads = tr->nthreads;  /* Number of threads                       */
 
   FILE *totEx   = NULL,
        *cloudEx = NULL,
@@ -75,6 +165,7 @@ tau(struct transit *tr){
 
   PREC_ATM *density = (PREC_ATM *)calloc(tr->ds.mol->nmol, sizeof(PREC_ATM));
   double   *Z       = (double   *)calloc(tr->ds.iso->n_i,  sizeof(double));
+  struct extwork ew;  /* Scratch buffers for computemolext()                */
 
   prop_samp *rad = &tr->rads;  /* Radius sampling                           */
   PREC_RES *r  = rad->v;       /* Radius array                              */
@@ -143,11 +234,11 @@ tau(struct transit *tr){
   transitacceptflag(tr->fl, th->fl, TRU_TAUBITS);
 
   /* Set cloud structure:                                                   */
-  static struct extcloud cl;
-  cl.cloudext = th->cl.cloudext;  /* Maximum cloud extinction               */
-  cl.cloudtop = th->cl.cloudtop;  /* Top layer radius                       */
-  cl.cloudbot = th->cl.cloudbot;  /* Radius of maxe                         */
-  tr->ds.cl = &cl;
+  struct extcloud *cl = &tr->st.cl;
+  cl->cloudext = th->cl.cloudext; /* Maximum cloud extinction               */
+  cl->cloudtop = th->cl.cloudtop; /* Top layer radius                       */
+  cl->cloudbot = th->cl.cloudbot; /* Radius of maxe                         */
+  tr->ds.cl = cl;
 
   /* Has the extinction coefficient been calculated boolean:                */
   _Bool *comp = ex->computed;
@@ -156,25 +247,15 @@ tau(struct transit *tr){
   if(tr->save.ext)
     restfile_extinct(tr->save.ext, e, comp, rnn, wnn);
 
+  /* Allocate the line-by-line scratch buffers once for all layers:         */
+  if (tr->fp_opa == NULL && tr->f_line != NULL)
+    if (alloc_extwork(tr, &ew, 0) != 0)
+      exit(EXIT_FAILURE);
+
   /* Compute extinction at the outermost layer:                             */
   if(!comp[rnn-1]){
     tr_output(TOUT_INFO, "Computing extinction at outermost layer.\n");
-    if (tr->fp_opa != NULL)
-      rn = interpolmolext(tr, rnn-1, ex->e);
-    else if (tr->f_line != NULL){
-      for (i=0; i < tr->ds.mol->nmol; i++)
-        density[i] = tr->ds.mol->molec[i].d[rnn-1];
-      for (i=0; i < tr->ds.iso->n_i; i++)
-        Z[i]       = tr->ds.iso->isov[i].z [rnn-1];
-
-      if((rn=computemolext(tr, ex->e+(rnn-1), tr->atm.t[rnn-1]*tr->atm.tfct,
-                           density, Z, 0)) != 0) {
-        tr_output(TOUT_ERROR,  "computemolext() returned error "
-          "code %i.\n", rn);
-        exit(EXIT_FAILURE);
-      }
-    }
-    ex->computed[rnn-1] = 1;
+    layerext(tr, rnn-1, density, Z, &ew);
   }
 
   /* Save total, cloud, and scattering extinction to file if requested:     */
@@ -191,95 +272,131 @@ tau(struct transit *tr){
   }
 
   tr_output(TOUT_INFO, "Calculating optical depth at various radii:\n");
-  /* For each wavenumber:                                                   */
-  for(wi=0; wi<wnn; wi++){
-    tau_wn = tau->t[wi];
-
-    /* Print output every 10% progress:                                     */
-    if(wi > wnextout){
-      tr_output(TOUT_DEBUG, "%i%%\n", (int)(100*(float)wi/wnn+0.5));
-      wnextout += (long)(wnn/10.0);
+  /* Transit geometry with several threads: finalize the extinction of
+     every layer above the lowest impact parameter first, so that the
+     wavenumber samples become independent and are computed in parallel
+     (the files written per wavenumber require the serial loop):            */
+  if (nthreads > 1 && !th->savefiles &&
+      strcmp(tr->sol->name, "transit") == 0){
+    while (lastr > 0 && h[nh-1]*hfct < r[lastr]*rfct)
+      lastr--;
+    tr_output(TOUT_DEBUG, "Computing extinction down to radius %i.\n",
+                          lastr+1);
+    /* Interpolated layers are independent, whereas computemolext()
+       already runs in parallel over wavenumber tiles:                      */
+    if (tr->fp_opa != NULL){
+      #pragma omp parallel for schedule(dynamic, 1) num_threads(nthreads)
+      for (ri=lastr; ri < rnn-1; ri++)
+        if (!comp[ri])
+          layerext(tr, ri, NULL, NULL, NULL);
     }
+    else
+      for (ri=rnn-2; ri >= lastr; ri--)
+        if (!comp[ri])
+          layerext(tr, ri, density, Z, &ew);
+
+    #pragma omp parallel for schedule(dynamic, TAU_CHUNK)                   \
+            num_threads(nthreads) private(ri)
+    for(wi=0; wi<wnn; wi++){
+      PREC_RES *tw = tau->t[wi],
+               erw[rnn];   /* Extinction per radius at this wavenumber      */
+      double   esw[rnn],   /* Scattering extinction                         */
+               ecw[rnn];   /* Cloud extinction                              */
+
+      computeextscat(esw, rnn, sc, rad->v, rad->fct, temp, tfct,
+                     wn->v[wi]*wfct);
+      computeextcloud(ecw, rnn, cl, rad, temp, tfct, wn->v[wi]*wfct);
+      for(ri=0; ri < rnn; ri++)
+        erw[ri] = e[ri][wi] + esw[ri] + ecw[ri] + e_cs[wi][ri];
+
+      for(ri=0; ri < nh; ri++){
+        tw[ri] = raytau(tr, ri, h[ri]*hfct, erw);
+        if (tw[ri] > tau->toomuch){
+          settoomuch(tr, wi, ri, h[ri]*hfct);
+          break;
+        }
+      }
+      if(ri==nh){
+        tr_output(TOUT_WARN, "At wavenumber %g cm-1, tau reached "
+          "the bottom of the atmosphere with tau: %g (tau max: %g).\n",
+          wn->v[wi], tw[ri-1], tau->toomuch);
+        tau->last[wi] = ri-1;
+      }
+    }
+  }
+  /* Else, compute the extinction as the rays reach deeper layers:          */
+  else{
+    for(wi=0; wi<wnn; wi++){
+      tau_wn = tau->t[wi];
 
-    /* Calculate extinction from scattering, clouds, and CIA at each level: */
-    computeextscat(e_s,  rnn, sc, rad->v, rad->fct, temp, tfct, wn->v[wi]*wfct);
-    computeextcloud(e_c, rnn, &cl, rad, temp, tfct, wn->v[wi]*wfct);
-
-    /* Put the extinction values in a new array, the values may be
-       temporarily overwritten by (fcn)(), but they should be restored:     */
-    for(ri=0; ri < rnn; ri++)
-      er[ri] = e[ri][wi] + e_s[ri] + e_c[ri] + e_cs[wi][ri];
-
-    /* For each height:                                                     */
-    for(ri=0; ri < nh; ri++){
-      /* Compute extinction at new radius if the impact parameter is smaller
-         than the radius of last calculated extinction:                     */
-      if(h[ri]*hfct < r[lastr]*rfct){
-        /* FINDME: What if the ray ends up going through a lower layer because
-           of the refraction? */
-        if(ri)
-          tr_output(TOUT_DEBUG, "Last Tau (height=%9.4g, wn=%9.4g): "
-                               "%10.4g.\n", h[ri-1], wn->v[wi], tau_wn[ri-1]);
-        /* While the extinction at a radius bigger than the impact
-           parameter is not computed, go for it: */
-        do{
-          if(!comp[--lastr]){
-            /* Compute extinction at given radius:                          */
-            tr_output(TOUT_DEBUG, "Radius %i: %.9g cm ... \n",
-                                        lastr+1, r[lastr]*rfct);
-            if (tr->fp_opa != NULL)
-              rn = interpolmolext(tr, lastr, ex->e);
-            else if (tr->f_line != NULL){
-              for (i=0; i < tr->ds.mol->nmol; i++)
-                density[i] = tr->ds.mol->molec[i].d[lastr];
-              for (i=0; i < tr->ds.iso->n_i; i++)
-                Z[i]       = tr->ds.iso->isov[i].z [lastr];
-              if((rn=computemolext(tr, ex->e+lastr,
-                         tr->atm.t[lastr]*tr->atm.tfct, density, Z, 0)) != 0) {
-                tr_output(TOUT_ERROR,
-                  "computemolext() returned error code %i.\n", rn);
-                exit(EXIT_FAILURE);
-              }
-            }
-            ex->computed[lastr] = 1;
-            /* Update the value of the extinction at the right place:       */
-            er[lastr] = e[lastr][wi] + e_s[lastr] + e_c[lastr] +
-                        e_cs[wi][lastr];
-          }
-        }while(h[ri]*hfct < r[lastr]*rfct);
+      /* Print output every 10% progress:                                   */
+      if(wi > wnextout){
+        tr_output(TOUT_DEBUG, "%i%%\n", (int)(100*(float)wi/wnn+0.5));
+        wnextout += (long)(wnn/10.0);
       }
-      /* :::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::: */
-      /* Calculate the optical depth (call to transittau or eclipsetau):    */
-      tau_wn[ri] = rfct * fcn(tr, h[ri]*hfct/rfct, er);
-
-      /* Check if the optical depth reached toomuch:                        */
-      if (tau_wn[ri] > tau->toomuch){
-        tau->last[wi] = ri;   /* Set tau.last                               */
-        if (ri < 3) {
-          tr_output(TOUT_WARN, "At wavenumber %g (cm-1), the optical "
-            "depth (%g) exceeded toomuch (%g) at the height "
-            "level %li (%g km), this should have happened in a "
-            "deeper layer.\n", wn->v[wi],
-            tau_wn[ri], tau->toomuch, ri, h[ri]*hfct/1e5);
+
+      /* Calculate extinction from scattering, clouds, and CIA at each
+         level:                                                             */
+      computeextscat(e_s,  rnn, sc, rad->v, rad->fct, temp, tfct,
+                     wn->v[wi]*wfct);
+      computeextcloud(e_c, rnn, cl, rad, temp, tfct, wn->v[wi]*wfct);
+
+      /* Put the extinction values in a new array, the values may be
+         temporarily overwritten by (fcn)(), but they should be restored:   */
+      for(ri=0; ri < rnn; ri++)
+        er[ri] = e[ri][wi] + e_s[ri] + e_c[ri] + e_cs[wi][ri];
+
+      /* For each height:                                                   */
+      for(ri=0; ri < nh; ri++){
+        /* Compute extinction at new radius if the impact parameter is smaller
+           than the radius of last calculated extinction:                   */
+        if(h[ri]*hfct < r[lastr]*rfct){
+          /* FINDME: What if the ray ends up going through a lower layer
+             because of the refraction?                                     */
+          if(ri)
+            tr_output(TOUT_DEBUG, "Last Tau (height=%9.4g, wn=%9.4g): "
+                       "%10.4g.\n", h[ri-1], wn->v[wi], tau_wn[ri-1]);
+          /* While the extinction at a radius bigger than the impact
+             parameter is not computed, go for it:                          */
+          do{
+            if(!comp[--lastr]){
+              /* Compute extinction at given radius:                        */
+              tr_output(TOUT_DEBUG, "Radius %i: %.9g cm ... \n",
+                                          lastr+1, r[lastr]*rfct);
+              layerext(tr, lastr, density, Z, &ew);
+              /* Update the value of the extinction at the right place:     */
+              er[lastr] = e[lastr][wi] + e_s[lastr] + e_c[lastr] +
+                          e_cs[wi][lastr];
+            }
+          }while(h[ri]*hfct < r[lastr]*rfct);
+        }
+        /* :::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::::  */
+        /* Calculate the optical depth:                                     */
+        tau_wn[ri] = raytau(tr, ri, h[ri]*hfct, er);
+
+        /* Check if the optical depth reached toomuch:                      */
+        if (tau_wn[ri] > tau->toomuch){
+          settoomuch(tr, wi, ri, h[ri]*hfct);
+          break;  /* Exit height loop when tau reached toomuch            */
         }
-        break;  /* Exit height loop when the optical depth reached toomuch  */
+        tr_output(TOUT_DEBUG, "Tau(lambda %li=%9.07g, r=%9.4g) : %g "
+          "(toomuch: %g)\n", wi, wn->v[wi], r[ri], tau_wn[ri], tau->toomuch);
       }
-      tr_output(TOUT_DEBUG, "Tau(lambda %li=%9.07g, r=%9.4g) : %g "
-        "(toomuch: %g)\n", wi, wn->v[wi], r[ri], tau_wn[ri], tau->toomuch);
-    }
 
-    /* Write total, cloud, and scattering extinction to file if requested:  */
-    if (th->savefiles){
-      save1Darray(tr, totEx,    er, rnn, wi);
-      save1Darray(tr, cloudEx, e_c, rnn, wi);
-      save1Darray(tr, scattEx, e_s, rnn, wi);
-    }
+      /* Write total, cloud, and scattering extinction to file if
+         requested:                                                         */
+      if (th->savefiles){
+        save1Darray(tr, totEx,    er, rnn, wi);
+        save1Darray(tr, cloudEx, e_c, rnn, wi);
+        save1Darray(tr, scattEx, e_s, rnn, wi);
+      }
 
-    if(ri==nh){
-      tr_output(TOUT_WARN, "At wavenumber %g cm-1, tau reached "
-        "the bottom of the atmosphere with tau: %g (tau max: %g).\n",
-        wn->v[wi], tau_wn[ri-1], tau->toomuch);
-      tau->last[wi] = ri-1;
+      if(ri==nh){
+        tr_output(TOUT_WARN, "At wavenumber %g cm-1, tau reached "
+          "the bottom of the atmosphere with tau: %g (tau max: %g).\n",
+          wn->v[wi], tau_wn[ri-1], tau->toomuch);
+        tau->last[wi] = ri-1;
+      }
     }
   }
   tr_output(TOUT_INFO, "Done.\n");
@@ -329,6 +446,8 @@ tau(struct transit *tr){
   /* Free allocated memory:                                                 */
   free(density);
   free(Z);
+  if (tr->fp_opa == NULL && tr->f_line != NULL)
+    freemem_extwork(&ew);
   if (strcmp(tr->sol->name, "eclipse") == 0)
     free(h);
   return 0;
@@ -630,6 +749,14 @@ freemem_tau(struct optdepth *tau,  /* Optical depth structure               */
   free(tau->t[0]);
   free(tau->t);
   free(tau->last);
+  tau->t = NULL;
+  if (tau->w != NULL){
+    free(tau->w[0]);
+    free(tau->w);
+    free(tau->first);
+    free(tau->nw);
+    tau->w = NULL;
+  }
 
   /* Update progress indicator and return:                                  */
   *pi &= ~(TRPI_TAU);
@@ -4,41 +4,69 @@
 /* TBD: calloc checks */
 
 #include <transit.h>
+
+/* Context of the single-context interface (transit_init(), run_transit(),
+   etc.).  Each context created with tr_create() holds all of the state of
+   a model, so that independent contexts can compute spectra concurrently
+   (e.g., one per thread), while sharing the read-only opacity grid
+   through the page cache or the shared-memory registry.                    */
 struct transit transit;
-long itr=0;
-struct timeval tv;
-double t0=0.0;
-int    init_run=0;
 
-void transit_init(int argc, char **argv);
-int  get_no_samples(void);
-void get_waveno_arr(double *waveno_arr, int waveno);
-void set_radius(double refradius);
-void run_transit(double *re_input, int transint, double *transit_out,
-                 int transit_out_size);
-void do_transit(double *transit_out);
+static void init_context(struct transit *tr, int argc, char **argv);
+static void init_worker(struct transit *wk, struct transit *tr);
+static void do_transit(struct transit *tr, double *transit_out);
+static void free_run(struct transit *tr);
+static void free_context(struct transit *tr);
+static void free_worker(struct transit *wk);
+
+
+/* FUNCTION
+   Allocate a new, uninitialized transit context.
+   Return: pointer to the context                                           */
+struct transit *
+tr_create(void){
+  struct transit *tr = (struct transit *)calloc(1, sizeof(struct transit));
+  if (tr == NULL)
+    transitallocerror(1);
+  return tr;
+}
 
 
-void transit_init(int argc, char **argv){
-  /* The purpose of this function is to set up and initialize all the
-     structures nessisary to run the transit code.                          */
-  memset(&transit, 0, sizeof(struct transit));
+/* FUNCTION
+   Set up and initialize all the structures necessary to run the transit
+   code with the given arguments, from reading the atmosphere and line
+   information to the opacity grid and cross sections.                     */
+void
+tr_init(struct transit *tr, int argc, char **argv){
+  /* The arguments parser and the verbosity level are process wide,
+     initialize one context at a time:                                      */
+  #pragma omp critical (transit_init)
+  init_context(tr, argc, argv);
+}
+
+
+static void
+init_context(struct transit *tr, int argc, char **argv){
+  struct timeval tv;
+
+  memset(tr, 0, sizeof(struct transit));
   verblevel=2;
 
   /* Process the command line arguments:                                    */
-  fw(processparameters, !=0, argc, argv, &transit);
-  t0 = timecheck(verblevel, itr,  0, "processparameters", tv, t0);
+  fw(processparameters, !=0, argc, argv, tr);
+  tr->t0 = timecheck(verblevel, tr->itr,  0, "processparameters", tv,
+                     tr->t0);
 
   tr_output(TOUT_INFO, "verblevel: %d\n", verblevel);
 
   /* Accept all general hints:                                              */
-  fw(acceptgenhints, !=0, &transit);
+  fw(acceptgenhints, !=0, tr);
   /* Presentation:                                                          */
   printintro();
 
   /* Make wavenumber binning:                                               */
-  fw(makewnsample, <0, &transit);
-  t0 = timecheck(verblevel, itr,  1, "makewnsample", tv, t0);
+  fw(makewnsample, <0, tr);
+  tr->t0 = timecheck(verblevel, tr->itr,  1, "makewnsample", tv, tr->t0);
   if(fw_status>0)
     tr_output(TOUT_INFO,
       "makewnsample() modified some of the hinted "
@@ -46,167 +74,471 @@ void transit_init(int argc, char **argv){
       fw_status);
 
   /* Read Atmosphere information:                                           */
-  fw(getatm, !=0, &transit);
-  t0 = timecheck(verblevel, itr,  2, "getatm", tv, t0);
+  fw(getatm, !=0, tr);
+  tr->t0 = timecheck(verblevel, tr->itr,  2, "getatm", tv, tr->t0);
 
   /* Read line info:                                                        */
-  fw(readlineinfo, !=0, &transit);
-  t0 = timecheck(verblevel, itr,  3, "readlineinfo", tv, t0);
+  fw(readlineinfo, !=0, tr);
+  tr->t0 = timecheck(verblevel, tr->itr,  3, "readlineinfo", tv, tr->t0);
 
   /* Make radius binning and interpolate data to new value:                 */
-  fw(makeradsample, <0, &transit);
-  t0 = timecheck(verblevel, itr,  4, "makeradsample", tv, t0);
+  fw(makeradsample, <0, tr);
+  tr->t0 = timecheck(verblevel, tr->itr,  4, "makeradsample", tv, tr->t0);
   if(fw_status>0)
     tr_output(TOUT_INFO, "makeradsample() modified some of the hinted "
       "parameters. Flag: 0x%lx.\n", fw_status);
 
   /* Calculate opacity grid:                                                */
-  fw(opacity, <0, &transit);
-  t0 = timecheck(verblevel, itr,  5, "opacity", tv, t0);
+  fw(opacity, <0, tr);
+  tr->t0 = timecheck(verblevel, tr->itr,  5, "opacity", tv, tr->t0);
 
   /* Initialize Cross section:                                              */
-  fw(readcs, !=0, &transit);
-  t0 = timecheck(verblevel, itr,  6, "readcs", tv, t0);
-  init_run = 1;
+  fw(readcs, !=0, tr);
+  tr->t0 = timecheck(verblevel, tr->itr,  6, "readcs", tv, tr->t0);
+  tr->init = 1;
 }
 
 
-int get_no_samples(void){
-  /* This function will return the size of the wave number array */
-  return (int)transit.wns.n;
+/* FUNCTION
+   Return: the size of the wavenumber array                                 */
+int
+tr_nsamples(struct transit *tr){
+  return (int)tr->wns.n;
 }
 
-void get_waveno_arr(double * waveno_arr, int waveno){
+
+/* FUNCTION
+   Copy the wavenumber array into waveno_arr (or set it to -1 if the
+   context has not been initialized).                                       */
+void
+tr_waveno(struct transit *tr, double *waveno_arr, int waveno){
   int i;
-  if (init_run > 0){
-    for(i=0; i < (int)transit.wns.n; i++){
-      waveno_arr[i] = transit.wns.v[i];
+  if (tr->init){
+    for(i=0; i < (int)tr->wns.n; i++){
+      waveno_arr[i] = tr->wns.v[i];
     }
   }
   else{
     printf("Transit not initialized, please run init. Values set -1\n");
-    for(i=0; i < (int)transit.wns.n; i++){
+    for(i=0; i < (int)tr->wns.n; i++){
         waveno_arr[i] = -1;
     }
   }
 }
 
 
+/* FUNCTION
+   Set the reference radius of the context.                                 */
+void
+tr_setradius(struct transit *tr, double refradius){
+  tr->r0 = refradius;
+}
+
+
+/* FUNCTION
+   Compute the spectrum of the context for the atmospheric profile
+   re_input (see reloadatm()) and store it in transit_out.                  */
+void
+tr_run(struct transit *tr, double *re_input, int transint,
+       double *transit_out, int transit_out_size){
+  fw(reloadatm, <0, tr, re_input);
+  do_transit(tr, transit_out);
+}
+
+
+/* FUNCTION
+   Compute the spectra of nmodels atmospheric profiles.  re_batch holds the
+   profiles one after the other (ninput = nlayers*(nmol+1) values each, as
+   in tr_run()), and batch_out receives the spectra ([nout][nwave], with
+   nout = nmodels and nwave the number of wavenumber samples).  The models
+   are distributed over the OpenMP threads, each one running its own
+   context: the context itself, and worker contexts that share its
+   read-only data (see init_worker(), these are kept until tr_free()).
+   Every context reuses its per-model arrays from one model to the next.
+   The contexts share the hints, thus the extinction savefile (saveext)
+   and the savefiles output, which a batch refuses.                         */
+void
+tr_runbatch(struct transit *tr, double *re_batch, int nmodels, int ninput,
+            double *batch_out, int nout, int nwave){
+  struct transit *wk; /* Context of the current thread                      */
+  int nw = tr->nthreads, /* Number of contexts in use                       */
+      nthr = tr->nthreads,
+      i, m;
+
+  if (!tr->init){
+    printf("Transit init not run, please initialize transit.\n");
+    return;
+  }
+
+  /* Check the shape of the arrays:                                         */
+  if (ninput != tr->ds.at->rads.n*(tr->ds.mol->nmol+1) ||
+      nout   != nmodels || nwave != tr->wns.n){
+    tr_output(TOUT_ERROR,
+      "Batch input [%d][%d] and output [%d][%d] arrays do not match %d "
+      "models of %li layers, %i species, and %li wavenumber samples.\n",
+      nmodels, ninput, nout, nwave, nmodels, tr->ds.at->rads.n,
+      tr->ds.mol->nmol, tr->wns.n);
+    exit(EXIT_FAILURE);
+  }
+
+  /* Every model would read and write the same files:                       */
+  if (tr->ds.th->save.ext != NULL || tr->ds.th->savefiles){
+    tr_output(TOUT_ERROR, "A batch run cannot use the 'saveext' or "
+      "'savefiles' options.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (nw > nmodels)
+    nw = nmodels;
+
+  /* Set up the missing worker contexts:                                    */
+  if (nw-1 > tr->nwk){
+    tr->wk = (struct transit **)realloc(tr->wk,
+                                        (nw-1)*sizeof(struct transit *));
+    for (i=tr->nwk; i < nw-1; i++){
+      tr->wk[i] = tr_create();
+      init_worker(tr->wk[i], tr);
+    }
+    tr->nwk = nw-1;
+  }
+  for (i=0; i < tr->nwk; i++)
+    tr->wk[i]->r0 = tr->r0;
+
+  /* One model per work unit, one context per thread.  Each context runs
+     its models serially (the workers have a single thread):                */
+  if (nw > 1)
+    tr->nthreads = 1;
+  #pragma omp parallel for schedule(dynamic, 1) num_threads(nw) \
+                           private(wk) if(nw > 1)
+  for (m=0; m < nmodels; m++){
+    wk = tr;
+#ifdef _OPENMP
+    if (omp_get_thread_num() > 0)
+      wk = tr->wk[omp_get_thread_num()-1];
+#endif
+    tr_run(wk, re_batch + (long)m*ninput, ninput,
+           batch_out + (long)m*nwave, nwave);
+  }
+  tr->nthreads = nthr;
+}
+
+
+/* Return a copy of the n bytes at src.                                      */
+static void *
+duparray(const void *src, size_t n){
+  void *dst = malloc(n);
+  if (dst == NULL)
+    transitallocerror(n);
+  return memcpy(dst, src, n);
+}
+
+
+/* Set up wk as a batch worker of the initialized context tr.  The worker
+   shares the read-only data of tr (hints, line information and store,
+   opacity grid, tabulated cross sections, and the fixed information of
+   the atmosphere, molecules, and isotopes), and owns a copy of the
+   per-layer arrays that each model overwrites (see reloadatm() and
+   makeradsample()).  Its per-model arrays are allocated by its first run.  */
+static void
+init_worker(struct transit *wk, struct transit *tr){
+  struct atm_data  *at  = &wk->st.at;
+  struct molecules *mol = &wk->st.mol;
+  struct isotopes  *iso = &wk->st.iso;
+  struct cross     *cs  = &wk->st.cross;
+  long nlay = tr->ds.at->rads.n,  /* Number of atmospheric-file layers      */
+       nrad = tr->rads.n,         /* Number of sampled layers               */
+       nwn  = tr->wns.n;
+  int i;
+
+  memcpy(wk, tr, sizeof(struct transit));
+  wk->parent   = tr;
+  wk->nthreads = 1;
+  wk->nwk      = 0;
+  wk->wk       = NULL;
+  wk->itr      = 0;
+  wk->runrad   = wk->runip = 0;
+  memset(&wk->ips, 0, sizeof(prop_samp));
+
+  /* Per-model structures, allocated by the first run:                      */
+  wk->st.ex.e        = NULL;
+  wk->st.ex.computed = NULL;
+  wk->st.tau.t       = NULL;
+  wk->st.tau.last    = NULL;
+  wk->st.tau.w       = NULL;
+  wk->st.ir.n        = NULL;
+  wk->st.out.o       = NULL;
+  wk->st.intout.o    = NULL;
+  wk->st.intens.a    = NULL;
+  wk->ds.ex     = &wk->st.ex;
+  wk->ds.tau    = &wk->st.tau;
+  wk->ds.ir     = &wk->st.ir;
+  wk->ds.out    = &wk->st.out;
+  wk->ds.intens = &wk->st.intens;
+  wk->ds.cl     = &wk->st.cl;
+  wk->ds.sg     = &wk->st.sg;
+
+  /* Atmospheric profile (reloadatm()):                                     */
+  *at = *tr->ds.at;
+  at->rads.v = duparray(at->rads.v, nlay*sizeof(PREC_RES));
+  at->atm.t  = duparray(at->atm.t,  nlay*sizeof(PREC_ATM));
+  at->mm     = duparray(at->mm,     nlay*sizeof(double));
+  at->molec  = duparray(at->molec,  at->n_aiso*sizeof(prop_mol));
+  for (i=0; i < at->n_aiso; i++){
+    at->molec[i].d = duparray(at->molec[i].d, nlay*sizeof(PREC_ATM));
+    at->molec[i].q = duparray(at->molec[i].q, nlay*sizeof(PREC_ATM));
+  }
+  wk->ds.at = at;
+
+  /* Sampled layers (makeradsample()):                                      */
+  wk->rads.v = duparray(tr->rads.v, nrad*sizeof(PREC_RES));
+  wk->atm.t  = duparray(tr->atm.t,  nrad*sizeof(PREC_ATM));
+  wk->atm.p  = duparray(tr->atm.p,  nrad*sizeof(PREC_ATM));
+  wk->atm.mm = duparray(tr->atm.mm, nrad*sizeof(double));
+  *mol = *tr->ds.mol;
+  mol->molec = duparray(mol->molec, mol->nmol*sizeof(prop_mol));
+  for (i=0; i < mol->nmol; i++){
+    mol->molec[i].d = duparray(mol->molec[i].d, nrad*sizeof(PREC_ATM));
+    mol->molec[i].q = duparray(mol->molec[i].q, nrad*sizeof(PREC_ATM));
+  }
+  wk->ds.mol = mol;
+  *iso = *tr->ds.iso;
+  iso->isov = duparray(iso->isov, iso->n_i*sizeof(prop_isov));
+  for (i=0; i < iso->n_i; i++)
+    iso->isov[i].z = duparray(iso->isov[i].z, nrad*sizeof(PREC_ZREC));
+  wk->ds.iso = iso;
+
+  /* Interpolated cross sections (interpcs()):                              */
+  *cs = *tr->ds.cross;
+  cs->e     = (PREC_CS **)calloc(nwn,      sizeof(PREC_CS *));
+  cs->e[0]  = (PREC_CS  *)calloc(nwn*nrad, sizeof(PREC_CS));
+  cs->et    = (PREC_CS **)calloc(nwn,      sizeof(PREC_CS *));
+  cs->et[0] = (PREC_CS  *)calloc(nwn*nrad, sizeof(PREC_CS));
+  for (i=1; i < nwn; i++){
+    cs->e[i]  = cs->e[0]  + i*nrad;
+    cs->et[i] = cs->et[0] + i*nrad;
+  }
+  wk->ds.cross = cs;
+}
+
+
+/* FUNCTION
+   Free all the memory of a context created with tr_create().               */
+void
+tr_free(struct transit *tr){
+  if (tr->init)
+    free_context(tr);
+  free(tr);
+}
+
+
+void transit_init(int argc, char **argv){
+  /* The purpose of this function is to set up and initialize all the
+     structures nessisary to run the transit code.                          */
+  tr_init(&transit, argc, argv);
+}
+
+
+int get_no_samples(void){
+  /* This function will return the size of the wave number array */
+  return tr_nsamples(&transit);
+}
+
+void get_waveno_arr(double * waveno_arr, int waveno){
+  tr_waveno(&transit, waveno_arr, waveno);
+}
+
+
 void set_radius(double refradius){
-  transit.r0 = refradius;
+  tr_setradius(&transit, refradius);
 }
 
 
 void run_transit(double *re_input, int transtint, double *transit_out,
                  int transit_out_size){
-  fw(reloadatm, <0, &transit, re_input);
-  do_transit(transit_out);
+  tr_run(&transit, re_input, transtint, transit_out, transit_out_size);
+}
+
+
+void run_transit_batch(double *re_batch, int nmodels, int ninput,
+                       double *batch_out, int nout, int nwave){
+  tr_runbatch(&transit, re_batch, nmodels, ninput, batch_out, nout, nwave);
 }
 
 
-void do_transit(double * transit_out){
+static void
+do_transit(struct transit *tr, double *transit_out){
+  struct timeval tv;
   int i;
 
-  if (init_run == 0){
+  if (!tr->init){
     /* Warn the user if Transit init has not been executed:                 */
     printf("Transit init not run, please initialize transit.\n");
   }
 
-  else if (transit.opabreak){
+  else if (tr->opabreak){
     /* Do not calculate spectra:                                            */
     /* Nothing to do here ...                                               */
   }
 
   else{
     /* Else, run the code:                                                  */
-    fw(makeipsample, <0, &transit);
-    t0 = timecheck(verblevel, itr,  6, "makeipsample", tv, t0);
+    fw(makeipsample, <0, tr);
+    tr->t0 = timecheck(verblevel, tr->itr,  6, "makeipsample", tv, tr->t0);
     if(fw_status>0)
       tr_output(TOUT_INFO, "makeipsample() modified some of the hinted "
         "parameters. Flag: 0x%lx.\n", fw_status);
 
+    /* The per-model arrays of the previous run are reused, unless the
+       sampling changed:                                                    */
+    if (tr->runrad != tr->rads.n || tr->runip != tr->ips.n)
+      free_run(tr);
+
     /* Interpolate the cross section:                                       */
-    fw(interpcs, !=0, &transit);
-    t0 = timecheck(verblevel, itr,  9, "interpcs", tv, t0);
+    fw(interpcs, !=0, tr);
+    tr->t0 = timecheck(verblevel, tr->itr,  9, "interpcs", tv, tr->t0);
 
     /* Compute index of refraction:                                         */
-    fw(idxrefrac, !=0, &transit);
-    t0 = timecheck(verblevel, itr,  10, "idxrefrac", tv, t0);
+    fw(idxrefrac, !=0, tr);
+    tr->t0 = timecheck(verblevel, tr->itr,  10, "idxrefrac", tv, tr->t0);
 
     /* Calculate extinction coefficient:                                    */
-    fw(extwn, !=0, &transit);
-    t0 = timecheck(verblevel, itr, 11, "extwn", tv, t0);
+    fw(extwn, !=0, tr);
+    tr->t0 = timecheck(verblevel, tr->itr, 11, "extwn", tv, tr->t0);
 
     /* Initialize structures for the optical-depth calculation:             */
-    fw(init_optdepth, !=0, &transit);
+    fw(init_optdepth, !=0, tr);
 
     /* Calculate optical depth for eclipse:                                 */
-    if(strcmp(transit.sol->name, "eclipse") == 0){
+    if(strcmp(tr->sol->name, "eclipse") == 0){
       tr_output(TOUT_INFO, "\nCalculating eclipse:\n");
 
-      fw(tau, !=0, &transit);
-      t0 = timecheck(verblevel, itr, 12, "tau eclipse", tv, t0);
+      fw(tau, !=0, tr);
+      tr->t0 = timecheck(verblevel, tr->itr, 12, "tau eclipse", tv, tr->t0);
 
       /* Calculate optical depth for eclipse:                               */
-      for(i=0; i < transit.ann; i++){
+      for(i=0; i < tr->ann; i++){
         /* Set the angle index:                                             */
-        transit.angleIndex = i;
+        tr->angleIndex = i;
 
         /* Calculate eclipse intensity (erg/s/sr/cm):                       */
-        fw(emergent_intens, !=0, &transit);
-        t0 = timecheck(verblevel, itr, 13, "emergent intensity", tv, t0);
+        fw(emergent_intens, !=0, tr);
+        tr->t0 = timecheck(verblevel, tr->itr, 13, "emergent intensity", tv,
+                           tr->t0);
       }
 
       /* Calculates flux  erg/s/cm                                          */
-      fw(flux, !=0, &transit);
-      t0 = timecheck(verblevel, itr, 14, "flux", tv, t0);
-
-      /* Free no longer needed memory                                       */
-      freemem_intensityGrid(transit.ds.intens, &transit.pi);
+      fw(flux, !=0, tr);
+      tr->t0 = timecheck(verblevel, tr->itr, 14, "flux", tv, tr->t0);
     }
 
     /* Calculate optical depth for transit:                                 */
-    else if (strcmp(transit.sol->name, "transit") == 0){
+    else if (strcmp(tr->sol->name, "transit") == 0){
       tr_output(TOUT_INFO, "\nCalculating transit:\n");
-      fw(tau, !=0, &transit);
-      t0 = timecheck(verblevel, itr, 12, "tau transit", tv, t0);
+      fw(tau, !=0, tr);
+      tr->t0 = timecheck(verblevel, tr->itr, 12, "tau transit", tv, tr->t0);
 
       /* Calculate transit modulation:                                      */
-      fw(modulation, !=0, &transit);
-      t0 = timecheck(verblevel, itr, 13, "modulation", tv, t0);
+      fw(modulation, !=0, tr);
+      tr->t0 = timecheck(verblevel, tr->itr, 13, "modulation", tv, tr->t0);
     }
 
-    for(int i=0; i < transit.wns.n; i++){
-      transit_out[i] = transit.ds.out->o[i];
+    for(int i=0; i < tr->wns.n; i++){
+      transit_out[i] = tr->ds.out->o[i];
     }
 
-    /* Free arrays allocated inside the individual call:                    */
-    free(transit.save.ext);
-    freemem_samp(&transit.ips);
-    freemem_idexrefrac(transit.ds.ir,  &transit.pi);
-    freemem_extinction(transit.ds.ex,  &transit.pi);
-    freemem_tau(       transit.ds.tau, &transit.pi);
-    freemem_outputray( transit.ds.out, &transit.pi);
+    /* Free arrays allocated inside the individual call, keep the
+       per-model arrays for the next run (the extinction savefile name
+       belongs to the hints, shared with the batch workers):                */
+    freemem_samp(&tr->ips);
+    tr->runrad = tr->rads.n;
+    tr->runip  = tr->ips.n;
 
-    t0 = timecheck(verblevel, itr, 14, "THE END", tv, t0);
+    tr->t0 = timecheck(verblevel, tr->itr, 14, "THE END", tv, tr->t0);
     tr_output(TOUT_INFO,
       "--------------------------------------------------\n");
-    itr++;
+    tr->itr++;
+  }
+}
+
+
+/* Free the per-model arrays (index of refraction, extinction, optical
+   depth, intensity, and output) kept from the last run of a context.       */
+static void
+free_run(struct transit *tr){
+  if (tr->runrad == 0)
+    return;
+  freemem_idexrefrac(tr->ds.ir,  &tr->pi);
+  freemem_extinction(tr->ds.ex,  &tr->pi);
+  freemem_tau(       tr->ds.tau, &tr->pi);
+  freemem_outputray( tr->ds.out, &tr->pi);
+  if (strcmp(tr->sol->name, "eclipse") == 0)
+    freemem_intensityGrid(tr->ds.intens, &tr->pi);
+  tr->runrad = tr->runip = 0;
+}
+
+
+/* Free all the memory used by an initialized context.  Check if all these
+   data structures can be used when called from bart.                       */
+static void
+free_context(struct transit *tr){
+  int i;
+
+  if (tr->parent != NULL){
+    free_worker(tr);
+    return;
   }
+  for (i=0; i < tr->nwk; i++)
+    tr_free(tr->wk[i]);
+  free(tr->wk);
+  free_run(tr);
+  freemem_molecules( tr->ds.mol, &tr->pi);
+  freemem_atmosphere(tr->ds.at,  &tr->pi);
+  if (tr->fp_opa == NULL)
+    freemem_linetransition(&tr->ds.li->lt,  &tr->pi);
+  freemem_lineinfo(tr->ds.li,  &tr->pi);
+  freemem_cs(tr->ds.cross,     &tr->pi);
+  if (tr->ds.op != NULL)
+    detachopacity(tr->ds.op);
+  freemem_transit(tr);
+  tr->init = 0;
 }
 
+
+/* Free the arrays owned by a batch worker (see init_worker()).             */
+static void
+free_worker(struct transit *wk){
+  struct atm_data  *at  = wk->ds.at;
+  struct molecules *mol = wk->ds.mol;
+  struct isotopes  *iso = wk->ds.iso;
+  int i;
+
+  free_run(wk);
+  free(at->rads.v);
+  free(at->atm.t);
+  free(at->mm);
+  for (i=0; i < at->n_aiso; i++)
+    free_mol(at->molec+i);
+  free(at->molec);
+  for (i=0; i < mol->nmol; i++)
+    free_mol(mol->molec+i);
+  free(mol->molec);
+  for (i=0; i < iso->n_i; i++)
+    free_isov(iso->isov+i);
+  free(iso->isov);
+  free(wk->ds.cross->e[0]);
+  free(wk->ds.cross->e);
+  free(wk->ds.cross->et[0]);
+  free(wk->ds.cross->et);
+  freemem_samp(&wk->rads);
+  free_atm(&wk->atm);
+  wk->init = 0;
+}
+
+
 void free_memory(void){
   /* Free all the memory used in transit, and should be
-     called at the end of the program. Check if all these data structures
-     can be used when called from bart.                                     */
-  freemem_molecules( transit.ds.mol, &transit.pi);
-  freemem_atmosphere(transit.ds.at,  &transit.pi);
-  if (transit.fp_opa == NULL)
-    freemem_linetransition(&transit.ds.li->lt,  &transit.pi);
-  freemem_lineinfo(transit.ds.li,  &transit.pi);
-  freemem_cs(transit.ds.cross,     &transit.pi);
-  freemem_transit(&transit);
-  init_run = 0;
+     called at the end of the program.                                      */
+  free_context(&transit);
 }
 
 #ifdef TEST_TRANSIT
@@ -218,7 +550,7 @@ int main(int argc, char **argv) {
   transit_init(argc, argv);
   int trans_size = get_no_samples();
   double tmp[trans_size];
-  do_transit(tmp);
+  do_transit(&transit, tmp);
   free_memory();
   return EXIT_SUCCESS;
 }
@@ -1,4 +1,4 @@
-%module transit_module
+%module(threads="1") transit_module
 %{
 #define SWIG_FILE_WITH_INIT
 //extern struct transit transit;
@@ -16,6 +16,20 @@ extern void set_radius(double refradius);
 extern void run_transit(double *re_input, int transint, double *\
 transit_out,int transit_out_size);
 extern void free_memory(void);
+
+struct transit;
+extern struct transit *tr_create(void);
+extern void tr_init(struct transit *tr, int argc, char **argv);
+extern int  tr_nsamples(struct transit *tr);
+extern void tr_waveno(struct transit *tr, double *waveno_arr, int waveno);
+extern void tr_setradius(struct transit *tr, double refradius);
+extern void tr_run(struct transit *tr, double *re_input, int transint,
+                   double *transit_out, int transit_out_size);
+extern void tr_runbatch(struct transit *tr, double *re_batch, int nmodels,
+                        int ninput, double *batch_out, int nout, int nwave);
+extern void tr_free(struct transit *tr);
+extern void run_transit_batch(double *re_batch, int nmodels, int ninput,
+                              double *batch_out, int nout, int nwave);
 %}
 
 %include "numpy.i"
@@ -27,6 +41,8 @@ extern void free_memory(void);
 %apply (double* ARGOUT_ARRAY1,int DIM1) {(double* waveno_arr, int waveno)}
 %apply (double* ARGOUT_ARRAY1,int DIM1) {(double* transit_out, int transit_out_size)}
 %apply (double* IN_ARRAY1, int DIM1) {(double* re_input, int transint)}
+%apply (double* IN_ARRAY2, int DIM1, int DIM2) {(double* re_batch, int nmodels, int ninput)}
+%apply (double* INPLACE_ARRAY2, int DIM1, int DIM2) {(double* batch_out, int nout, int nwave)}
 /*%exception
 {
      errno = 0;
@@ -92,6 +108,9 @@ extern void free_memory(void);
 //extern char ** argv;
 //extern int init_run;
 
+/* Keep the GIL while in transit, except in tr_run() below:               */
+%nothread;
+
 extern void transit_init(int argc, char **argv);
 extern int  get_no_samples(void);
 extern void get_waveno_arr(double * waveno_arr, int waveno);
@@ -99,4 +118,27 @@ extern void set_radius(double refradius);
 extern void run_transit(double * re_input, int transint, double *\
 transit_out,int transit_out_size);
 extern void free_memory(void);
+/* Batched run: re_batch is a [nmodels][nlayers*(nmol+1)] array of profiles,
+   batch_out a preallocated [nmodels][nwave] array for the spectra:        */
+%thread;
+extern void run_transit_batch(double *re_batch, int nmodels, int ninput,
+                              double *batch_out, int nout, int nwave);
+%nothread;
+
+/* Transit contexts (opaque handles).  Each handle holds an independent
+   model; tr_run() releases the GIL, so that Python threads can compute
+   spectra of different handles concurrently:                              */
+struct transit;
+extern struct transit *tr_create(void);
+extern void tr_init(struct transit *tr, int argc, char **argv);
+extern int  tr_nsamples(struct transit *tr);
+extern void tr_waveno(struct transit *tr, double *waveno_arr, int waveno);
+extern void tr_setradius(struct transit *tr, double refradius);
+%thread;
+extern void tr_run(struct transit *tr, double *re_input, int transint,
+                   double *transit_out, int transit_out_size);
+extern void tr_runbatch(struct transit *tr, double *re_batch, int nmodels,
+                        int ninput, double *batch_out, int nout, int nwave);
+%nothread;
+extern void tr_free(struct transit *tr);
 
@@ -6,6 +6,7 @@
 /* keeps tracks of number of errors that where allowed to continue. */
 int verblevel;
 int maxline=1000;
+__thread long fw_status;
 
 inline void transitdot(int thislevel,
                        int verblevel,